@@ -8,6 +8,26 @@
 using namespace std;
 namespace asio = boost::asio;
 
+static void print_trace(const ipfs_cache::LookupTrace& trace)
+{
+    using ipfs_cache::LookupTrace;
+    using chrono::microseconds;
+    using chrono::duration_cast;
+
+    for (auto& s : trace.spans) {
+        cout << "  +" << duration_cast<microseconds>(s.start).count() << "us "
+             << LookupTrace::name(s.step) << " "
+             << duration_cast<microseconds>(s.duration).count() << "us";
+
+        if (!s.cid.empty()) cout << " " << s.cid;
+        if (s.bytes)        cout << " " << s.bytes << "B";
+        if (s.cache_hit)    cout << " (cached)";
+        if (s.ec)           cout << " error: " << s.ec.message();
+
+        cout << endl;
+    }
+}
+
 int main(int argc, const char** argv)
 {
     /*
@@ -23,6 +43,10 @@ int main(int argc, const char** argv)
          "Path to the IPFS repository")
         ("ipns", po::value<string>(), "IPNS of the database")
         ("key", po::value<string>(), "Key to retrieve")
+        ("trace", po::bool_switch(), "Print where the time of the lookup went")
+        ("fresh", po::bool_switch(),
+         "Wait for the database to be downloaded instead of using the last "
+         "known one")
         ;
 
     po::variables_map vm;
@@ -51,6 +75,8 @@ int main(int argc, const char** argv)
     }
 
     string key = vm["key"].as<string>();
+    bool trace = vm["trace"].as<bool>();
+    bool fresh = vm["fresh"].as<bool>();
 
     asio::io_service ios;
 
@@ -60,14 +86,28 @@ int main(int argc, const char** argv)
             ipfs_cache::Client client(ios, ipns, repo);
 
             try {
-                cout << "Waiting for DB update..." << endl;
-                client.wait_for_db_update(yield);
+                if (fresh) {
+                    cout << "Waiting for DB update..." << endl;
+                    client.wait_for_db_update(yield);
+                }
+                else {
+                    cout << "Waiting for DB..." << endl;
+                    client.wait_for_db(yield);
+                }
 
                 cout << "Fetching..." << endl;
-                ipfs_cache::CachedContent value = client.get_content(key, yield);
+                ipfs_cache::LookupTrace lookup_trace;
+                ipfs_cache::CachedContent value = client.get_content(key, lookup_trace, yield);
+
+                cout << "Time stamp: " << value.ts << endl;
+
+                if (!value.content_type.empty()) {
+                    cout << "Content type: " << value.content_type << endl;
+                }
+
+                cout << "Value: " << value.data << endl;
 
-                cout << "Time stamp: " << value.ts << endl
-                     << "Value: " << value.data << endl;
+                if (trace) print_trace(lookup_trace);
             }
             catch (const exception& e) {
                 cerr << "Error: " << e.what() << endl;
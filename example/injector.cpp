@@ -1,9 +1,19 @@
 #include <boost/program_options.hpp>
 #include <boost/asio/io_service.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/optional.hpp>
 #include <boost/beast.hpp>
 #include <ipfs_cache/injector.h>
 #include <ipfs_cache/client.h>
+#include <ipfs_cache/error.h>
 #include <iostream>
+#include <chrono>
+#include <deque>
+#include <limits>
+#include <map>
+#include <functional>
+#include <memory>
+#include <thread>
 
 #include "parse_vars.h"
 
@@ -24,19 +34,101 @@ void fail(sys::error_code ec, char const* what)
     cerr << what << ": " << ec.message() << "\n";
 }
 
-// Handles an HTTP server connection
-void serve( tcp::socket socket
-          , ipfs_cache::Injector& injector
-          , asio::yield_context yield)
+using Request  = http::request<http::string_body>;
+using Response = http::response<http::string_body>;
+
+// Limits of the HTTP server, see the command line options in `main`.
+struct ServerOptions {
+    bool     wait_for_room   = false;
+    size_t   max_connections = 1024;
+    // Requests read from a connection before the responses to the previous
+    // ones are written.
+    size_t   max_pipeline    = 16;
+    uint64_t max_body        = 16 * 1024 * 1024;
+    // Bodies of the requests of all connections read and not yet answered.
+    // Further requests wait for room before their bodies are read. A body
+    // bigger than this is only let in when nothing else is in flight.
+    uint64_t max_in_flight_bytes = 512 * 1024 * 1024;
+    // For reading a request (including the wait for it on an idle
+    // connection, or for room in a full pipeline while no response gets
+    // written).
+    chrono::seconds read_timeout = chrono::seconds(30);
+    // For writing a response.
+    chrono::seconds write_timeout = chrono::seconds(30);
+};
+
+static Response make_response( const Request& req
+                             , http::status status
+                             , string body)
 {
-    sys::error_code ec;
+    Response res{status, req.version()};
+
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(http::field::content_type, "text/plain");
+    res.body() = move(body);
+    res.keep_alive(req.keep_alive());
+    res.prepare_payload();
+
+    return res;
+}
+
+using Vars = map<string_view, string_view>;
+
+// Optional: priority=interactive|normal|bulk, timeout=<milliseconds>,
+// add_timeout=<milliseconds> and content_type=<MIME type>.
+static ipfs_cache::Injector::InsertOptions insert_options( Vars& vars
+                                                         , bool wait_for_room)
+{
+    using Priority = ipfs_cache::Injector::Priority;
+
+    ipfs_cache::Injector::InsertOptions opts;
+
+    opts.wait_for_room = wait_for_room;
+
+    auto priority = vars["priority"];
+    if      (priority == "interactive") opts.priority = Priority::interactive;
+    else if (priority == "bulk")        opts.priority = Priority::bulk;
+
+    auto timeout = vars["timeout"].to_string();
+    if (!timeout.empty()) {
+        opts.timeout = chrono::milliseconds(strtoul(timeout.c_str(), nullptr, 10));
+    }
 
-    boost::beast::flat_buffer buffer;
-    http::request<http::string_body> req;
+    auto add_timeout = vars["add_timeout"].to_string();
+    if (!add_timeout.empty()) {
+        opts.add_timeout = chrono::milliseconds(strtoul(add_timeout.c_str(), nullptr, 10));
+    }
+
+    opts.content_type = vars["content_type"].to_string();
 
-    // Read a request
-    http::async_read(socket, buffer, req, yield[ec]);
-    if (ec) return fail(ec, "http::async_read");
+    return opts;
+}
+
+// The response to an insert which ended with `ec`.
+static Response respond(const Request& req, sys::error_code ec)
+{
+    // The injector is overloaded, tell the client to come back later.
+    if (ec == ipfs_cache::error::queue_full || ec == asio::error::timed_out) {
+        auto res = make_response(req, http::status::service_unavailable, "BUSY");
+        res.set(http::field::retry_after, "1");
+        return res;
+    }
+
+    if (ec) {
+        fail(ec, "insert_content");
+        return make_response(req, http::status::internal_server_error, "FAIL");
+    }
+
+    return make_response(req, http::status::ok, "OK");
+}
+
+// Inserts the content posted in `req`.
+static Response handle( const Request& req
+                      , ipfs_cache::Injector& injector
+                      , bool wait_for_room
+                      , asio::yield_context yield)
+{
+    sys::error_code ec;
 
     auto vars = parse_vars(req.body());
 
@@ -44,41 +136,534 @@ void serve( tcp::socket socket
     auto value = vars["value"].to_string();
 
     if (key.empty() || value.empty()) {
-        http::response<http::string_body> res
-            { http::status::bad_request
-            , req.version()};
+        return make_response(req, http::status::bad_request, "FAIL");
+    }
+
+    auto opts = insert_options(vars, wait_for_room);
+
+    injector.insert_content(key, move(value), opts, yield[ec]);
+
+    return respond(req, ec);
+}
 
-        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-        res.set(http::field::content_type, "text/plain");
-        res.body() = "FAIL";
-        res.prepare_payload();
+class Server;
+
+// The state of an HTTP connection shared by the coroutines serving it, they
+// all run on its strand.
+struct Connection {
+    Server& server;
+    tcp::socket socket;
+    asio::io_service::strand strand;
+    // Responses in the order of the requests, empty while being worked on.
+    deque<shared_ptr<boost::optional<Response>>> responses;
+    bool reading_done = false;
+    // Never expires, canceled to wake up the reader and the writer.
+    asio::steady_timer changed;
+    // Closes the socket once it expires, at the earliest of the deadlines
+    // of the reader and the writer.
+    asio::steady_timer deadline;
+    asio::steady_timer::time_point read_deadline;
+    asio::steady_timer::time_point write_deadline;
+
+    Connection(Server&, tcp::socket);
+
+    void notify() { changed.cancel(); }
+
+    // A zero duration disarms the deadline.
+    void set_read_deadline(chrono::seconds d) {
+        read_deadline = to_deadline(d);
+        deadline.expires_at(min(read_deadline, write_deadline));
+    }
 
-        http::async_write(socket, res, yield[ec]);
-        return;
+    void set_write_deadline(chrono::seconds d) {
+        write_deadline = to_deadline(d);
+        deadline.expires_at(min(read_deadline, write_deadline));
     }
 
-    string ipfs_id = injector.insert_content(key, value, yield[ec]);
-    if (ec) return fail(ec, "insert_content");
+    void wait(asio::yield_context yield) {
+        sys::error_code ec;
+        changed.async_wait(yield[ec]);
+    }
 
-    http::response<http::string_body> res{http::status::ok, req.version()};
-    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-    res.set(http::field::content_type, "text/plain");
-    res.body() = "OK";
-    res.keep_alive(req.keep_alive());
-    res.prepare_payload();
+    void close() {
+        sys::error_code ec;
+        socket.close(ec);
+        deadline.cancel();
+        notify();
+    }
+
+    ~Connection();
+
+private:
+    static asio::steady_timer::time_point to_deadline(chrono::seconds d) {
+        if (d == chrono::seconds(0)) {
+            return asio::steady_timer::time_point::max();
+        }
+        return asio::steady_timer::clock_type::now() + d;
+    }
+};
+
+// Accepts connections and serves them, no more than `max_connections` at
+// once: while at the limit new connections wait in the listen backlog.
+class Server {
+public:
+    Server( asio::io_service& ios
+          , ipfs_cache::Injector& injector
+          , ServerOptions options)
+        : injector(injector)
+        , options(options)
+        , _ios(ios)
+        , _strand(ios)
+        , _has_room(ios, asio::steady_timer::time_point::max())
+    {}
+
+    void start(uint16_t port)
+    {
+        asio::spawn(_strand, [this, port] (asio::yield_context yield) {
+                accept(port, yield);
+            });
+    }
+
+    // Called (from any thread) once a connection is done with.
+    void release()
+    {
+        _strand.dispatch([this] {
+                --_connections;
+                _has_room.cancel();
+            });
+    }
+
+    // Waits until request bodies of `bytes` more fit into
+    // `max_in_flight_bytes` and takes them, the coroutine is resumed on the
+    // strand of the connection.
+    void reserve(Connection&, uint64_t bytes, asio::yield_context);
+
+    // Gives back what `reserve` took, may be called from any thread.
+    void unreserve(uint64_t bytes)
+    {
+        _strand.dispatch([this, bytes] {
+                _in_flight_bytes -= bytes;
+                grant();
+            });
+    }
+
+    asio::io_service& get_io_service() { return _ios; }
+
+    ipfs_cache::Injector& injector;
+    const ServerOptions options;
+
+private:
+    void accept(uint16_t port, asio::yield_context);
+    void grant();
+
+private:
+    asio::io_service& _ios;
+    asio::io_service::strand _strand;
+    size_t _connections = 0;
+    // Never expires, canceled when a connection is released.
+    asio::steady_timer _has_room;
+    uint64_t _in_flight_bytes = 0;
+    // Connections waiting for `reserve`, in order of arrival.
+    deque<pair<uint64_t, function<void()>>> _reserve_waiters;
+};
+
+Connection::Connection(Server& server, tcp::socket s)
+    : server(server)
+    , socket(move(s))
+    , strand(server.get_io_service())
+    , changed(server.get_io_service(), asio::steady_timer::time_point::max())
+    , deadline(server.get_io_service(), asio::steady_timer::time_point::max())
+    , read_deadline(asio::steady_timer::time_point::max())
+    , write_deadline(asio::steady_timer::time_point::max())
+{}
+
+Connection::~Connection()
+{
+    server.release();
+}
+
+void Server::reserve(Connection& c, uint64_t bytes, asio::yield_context yield)
+{
+    using Handler = asio::handler_type< asio::yield_context
+                                      , void(sys::error_code)>::type;
+
+    Handler handler(yield);
+    asio::async_result<Handler> result(handler);
+
+    auto& strand = c.strand;
+
+    _strand.dispatch([this, bytes, &strand, handler] {
+            _reserve_waiters.emplace_back(bytes, [&strand, handler] {
+                    strand.post([handler] () mutable {
+                            handler(sys::error_code());
+                        });
+                });
+            grant();
+        });
 
-    http::async_write(socket, res, yield[ec]);
-    if (ec) fail(ec, "http::async_write");
+    return result.get();
 }
 
-// Accepts incoming connections and launches the sessions
-static
-void accept( asio::io_service& ios
-           , uint16_t port
-           , ipfs_cache::Injector& injector
-           , asio::yield_context yield)
+// Runs on the strand of the server.
+void Server::grant()
+{
+    while (!_reserve_waiters.empty()) {
+        auto& w = _reserve_waiters.front();
+
+        if (_in_flight_bytes != 0
+            && _in_flight_bytes + w.first > options.max_in_flight_bytes) {
+            break;
+        }
+
+        _in_flight_bytes += w.first;
+
+        auto resume = move(w.second);
+        _reserve_waiters.pop_front();
+        resume();
+    }
+}
+
+// The body of a request which is streamed to the injector while it's read,
+// the state lives on the strand of the connection.
+struct BodyStream {
+    // The header, for responding.
+    Request head;
+    http::request_parser<http::buffer_body> parser;
+    shared_ptr<beast::flat_buffer> buffer;
+    // The body has been read, or reading it failed.
+    bool done = false;
+    bool failed = false;
+    // The insert is over.
+    bool finished = false;
+
+    BodyStream( http::request_parser<http::string_body>&& p
+              , shared_ptr<beast::flat_buffer> buffer)
+        : head(p.get().base())
+        , parser(move(p))
+        , buffer(move(buffer))
+    {
+        done = parser.is_done();
+    }
+};
+
+// Reads into `b` what comes next of the body, at least a byte unless the
+// body is over. Runs on the strand of the connection.
+static void read_some_body( shared_ptr<Connection> c
+                          , shared_ptr<BodyStream> s
+                          , asio::mutable_buffer b
+                          , function<void(sys::error_code, size_t)> h)
 {
-    tcp::acceptor acceptor{ios};
+    auto& body = s->parser.get().body();
+
+    body.data = asio::buffer_cast<void*>(b);
+    body.size = asio::buffer_size(b);
+    body.more = true;
+
+    c->set_read_deadline(c->server.options.read_timeout);
+
+    http::async_read_some(c->socket, *s->buffer, s->parser, c->strand.wrap(
+        [c, s, b, h] (sys::error_code ec, size_t) {
+            c->set_read_deadline(chrono::seconds(0));
+
+            // The buffer is full.
+            if (ec == http::error::need_buffer) ec = sys::error_code();
+
+            size_t n = asio::buffer_size(b) - s->parser.get().body().size;
+
+            if (!ec && n == 0 && !s->parser.is_done()) {
+                return read_some_body(c, s, b, h);
+            }
+
+            if (ec || s->parser.is_done()) {
+                s->done = true;
+                s->failed = bool(ec);
+                c->notify();
+            }
+
+            h(ec, n);
+        }));
+}
+
+// Inserts the content streamed as the body of a request with the variables
+// (see `handle`) in `query`.
+static Response handle_stream( shared_ptr<Connection> c
+                             , shared_ptr<BodyStream> s
+                             , const string& query
+                             , asio::yield_context yield)
+{
+    auto& server = c->server;
+    auto& ios = server.get_io_service();
+
+    auto vars = parse_vars(query);
+    auto key  = vars["key"].to_string();
+
+    if (key.empty()) {
+        return make_response(s->head, http::status::bad_request, "FAIL");
+    }
+
+    auto opts = insert_options(vars, server.options.wait_for_room);
+
+    if (opts.content_type.empty()) {
+        opts.content_type = s->head[http::field::content_type].to_string();
+    }
+
+    // Called by the injector from its own coroutine, the reads are done on
+    // the strand of the connection.
+    auto source = [c, s, &ios] (asio::mutable_buffer b, asio::yield_context yield) {
+        using Handler = asio::handler_type< asio::yield_context
+                                          , void(sys::error_code, size_t)>::type;
+
+        Handler handler(yield);
+        asio::async_result<Handler> result(handler);
+
+        auto resume = [&ios, handler] (sys::error_code ec, size_t n) {
+            ios.post([handler, ec, n] () mutable { handler(ec, n); });
+        };
+
+        c->strand.dispatch([c, s, b, resume] {
+                if (s->done) return resume(sys::error_code(), 0);
+                read_some_body(c, s, b, resume);
+            });
+
+        return result.get();
+    };
+
+    sys::error_code ec;
+
+    server.injector.insert_content(key, source, opts, yield[ec]);
+
+    return respond(s->head, ec);
+}
+
+// Writes the responses as they get ready, closes the connection once they
+// are all written or one asks for it to be closed.
+static void write_responses( shared_ptr<Connection> c
+                           , asio::yield_context yield)
+{
+    while (c->socket.is_open()) {
+        if (c->responses.empty()) {
+            if (c->reading_done) break;
+            c->wait(yield);
+            continue;
+        }
+
+        auto slot = c->responses.front();
+
+        if (!*slot) {
+            c->wait(yield);
+            continue;
+        }
+
+        c->responses.pop_front();
+        c->notify(); // There is room for another request.
+
+        sys::error_code ec;
+
+        // A client which doesn't read its responses doesn't hold the
+        // connection forever.
+        c->set_write_deadline(c->server.options.write_timeout);
+        http::async_write(c->socket, **slot, yield[ec]);
+        c->set_write_deadline(chrono::seconds(0));
+
+        if (ec) {
+            fail(ec, "http::async_write");
+            break;
+        }
+
+        // Interim responses (100 Continue) are followed by the final one.
+        if ((*slot)->result_int() / 100 == 1) continue;
+
+        if (!(*slot)->keep_alive()) break;
+    }
+
+    c->close();
+}
+
+// Closes the connection when its deadline passes.
+static void watch_deadline( shared_ptr<Connection> c
+                          , asio::yield_context yield)
+{
+    while (c->socket.is_open()) {
+        sys::error_code ec;
+        c->deadline.async_wait(yield[ec]);
+
+        if (c->deadline.expires_at() <= asio::steady_timer::clock_type::now()) {
+            return c->close();
+        }
+    }
+}
+
+// Handles an HTTP server connection. Requests are read and handled while the
+// responses to the previous ones are still being worked on or written,
+// which lets clients pipeline their inserts, and the connection is kept
+// open for as long as the client wants.
+static void serve(shared_ptr<Connection> c, asio::yield_context yield)
+{
+    auto& server = c->server;
+    auto& options = server.options;
+
+    asio::spawn(c->strand, [c] (auto yield) { write_responses(c, yield); });
+    asio::spawn(c->strand, [c] (auto yield) { watch_deadline(c, yield); });
+
+    // Shared with the streamed bodies.
+    auto buffer = make_shared<beast::flat_buffer>();
+
+    while (c->socket.is_open()) {
+        if (c->responses.size() >= options.max_pipeline) {
+            // Armed again on each change of the pipeline, such as a
+            // response written.
+            c->set_read_deadline(options.read_timeout);
+            c->wait(yield);
+            continue;
+        }
+
+        sys::error_code ec;
+
+        c->set_read_deadline(options.read_timeout);
+
+        http::request_parser<http::string_body> parser;
+        // Streamed bodies are never held in memory as a whole, the others
+        // are limited once the header tells which ones they are.
+        parser.body_limit(numeric_limits<uint64_t>::max());
+
+        http::async_read_header(c->socket, *buffer, parser, yield[ec]);
+
+        // With the key in the target, as in "POST /?key=<key>", the body is
+        // the content itself and it's streamed to the injector.
+        string query;
+        bool streamed = false;
+
+        if (!ec) {
+            auto target = parser.get().target();
+            auto q = target.find('?');
+
+            if (q != string_view::npos) {
+                query = target.substr(q + 1).to_string();
+                streamed = parse_vars(query).count("key") != 0;
+            }
+        }
+
+        // The size of the body is checked before it's read.
+        if (!ec && !streamed) {
+            auto length = parser.content_length();
+
+            if (length && *length > options.max_body) {
+                ec = http::error::body_limit;
+            }
+            else {
+                parser.body_limit(options.max_body);
+            }
+        }
+
+        // Room for the body is waited for before it's read (and before the
+        // client is told to send it), without the read deadline. Streamed
+        // bodies are read as the injector takes them.
+        uint64_t reserved = 0;
+
+        if (!ec && !streamed) {
+            auto length = parser.content_length();
+            reserved = min(length ? *length : options.max_body, options.max_body);
+
+            c->set_read_deadline(chrono::seconds(0));
+            server.reserve(*c, reserved, yield);
+            c->set_read_deadline(options.read_timeout);
+        }
+
+        if (!ec && beast::iequals( parser.get()[http::field::expect]
+                                 , "100-continue")) {
+            auto cont = make_shared<boost::optional<Response>>(
+                    Response{http::status::continue_, parser.get().version()});
+            c->responses.push_back(std::move(cont));
+            c->notify();
+        }
+
+        if (!ec && streamed) {
+            c->set_read_deadline(chrono::seconds(0));
+
+            auto s = make_shared<BodyStream>(move(parser), buffer);
+            auto slot = make_shared<boost::optional<Response>>();
+
+            c->responses.push_back(slot);
+
+            asio::spawn(server.get_io_service(), [c, s, slot, query] (auto yield) {
+                    auto res = handle_stream(c, s, query, yield);
+
+                    c->strand.dispatch([c, s, slot, res = std::move(res)] () mutable {
+                            s->finished = true;
+                            // What is left of the body is in the way of
+                            // further requests.
+                            if (!s->done) res.keep_alive(false);
+                            *slot = std::move(res);
+                            c->notify();
+                        });
+                });
+
+            // The next request comes after the body.
+            while (c->socket.is_open() && !s->done && !s->finished) {
+                c->wait(yield);
+            }
+
+            if (!s->done || s->failed || !s->head.keep_alive()) break;
+            continue;
+        }
+
+        if (!ec) http::async_read(c->socket, *buffer, parser, yield[ec]);
+
+        c->set_read_deadline(chrono::seconds(0));
+
+        if (ec) server.unreserve(reserved);
+
+        if (ec == http::error::body_limit) {
+            Request req{http::verb::post, "", parser.get().version()};
+            req.keep_alive(false);
+
+            auto res = make_response( req
+                                    , http::status::payload_too_large
+                                    , "TOO LARGE");
+
+            c->responses.push_back(
+                    make_shared<boost::optional<Response>>(move(res)));
+            break;
+        }
+
+        if (ec) {
+            if (ec != http::error::end_of_stream
+                && ec != asio::error::operation_aborted) {
+                fail(ec, "http::async_read");
+            }
+            break;
+        }
+
+        auto req = make_shared<Request>(parser.release());
+        auto slot = make_shared<boost::optional<Response>>();
+
+        c->responses.push_back(slot);
+
+        // Inserts don't touch the connection and run in parallel, only the
+        // response is handed back to the strand of the connection.
+        asio::spawn(server.get_io_service(), [c, req, slot, reserved] (auto yield) {
+                auto& s = c->server;
+                auto res = handle( *req, s.injector, s.options.wait_for_room
+                                 , yield);
+
+                s.unreserve(reserved);
+
+                c->strand.dispatch([c, slot, res = std::move(res)] () mutable {
+                        *slot = std::move(res);
+                        c->notify();
+                    });
+            });
+
+        if (!req->keep_alive()) break;
+    }
+
+    c->reading_done = true;
+    c->notify();
+}
+
+void Server::accept(uint16_t port, asio::yield_context yield)
+{
+    tcp::acceptor acceptor{_ios};
 
     sys::error_code ec;
 
@@ -99,17 +684,24 @@ void accept( asio::io_service& ios
     acceptor.listen(asio::socket_base::max_connections, ec);
     if (ec) return fail(ec, "listen");
 
-    tcp::socket socket{ios};
+    tcp::socket socket{_ios};
 
     for (;;) {
+        if (_connections >= options.max_connections) {
+            _has_room.async_wait(yield[ec]);
+            continue;
+        }
+
         acceptor.async_accept(socket, yield[ec]);
         if (ec) return fail(ec, "accept");
 
-        asio::spawn( yield
-                   , [s = move(socket), &injector]
-                     (auto yield) mutable {
-                         serve(move(s), injector, yield);
-                     });
+        ++_connections;
+
+        auto c = make_shared<Connection>(*this, move(socket));
+
+        // Each connection has a strand of its own so that connections are
+        // served in parallel.
+        asio::spawn(c->strand, [c] (auto yield) { serve(c, yield); });
     }
 }
 
@@ -128,6 +720,43 @@ int main(int argc, const char** argv)
          "Path to the IPFS repository")
         ("port,p", po::value<uint16_t>()->default_value(0),
          "Port the server will listen on (use 0 for random)")
+        ("threads", po::value<unsigned>()->default_value(
+                max(1u, thread::hardware_concurrency())),
+         "Number of threads running the event loop")
+        ("max-connections", po::value<size_t>()->default_value(1024),
+         "Number of HTTP connections served at once, further ones wait "
+         "to be accepted")
+        ("max-pipeline", po::value<size_t>()->default_value(16),
+         "Number of requests of an HTTP connection handled at once")
+        ("max-body", po::value<uint64_t>()->default_value(16*1024*1024),
+         "Largest accepted request body in bytes")
+        ("read-timeout", po::value<unsigned>()->default_value(30),
+         "Seconds after which a connection with no complete request "
+         "is closed")
+        ("write-timeout", po::value<unsigned>()->default_value(30),
+         "Seconds after which a connection with a response not yet "
+         "written is closed")
+        ("max-in-flight-bytes", po::value<uint64_t>()->default_value(512*1024*1024),
+         "Request body bytes of all connections held at once, further "
+         "bodies wait to be read")
+        ("node-storage", po::value<string>()->default_value("files"),
+         "How database nodes are stored in IPFS: "
+         "files, linked (only the root is pinned) or raw (raw blocks)")
+        ("min-concurrency", po::value<unsigned>()->default_value(1),
+         "Lower bound of the number of contents added to IPFS at once")
+        ("max-concurrency", po::value<unsigned>()->default_value(64),
+         "Upper bound of the number of contents added to IPFS at once")
+        ("max-queue-entries", po::value<size_t>()->default_value(10000),
+         "Number of inserts which may wait for IPFS")
+        ("max-queue-bytes", po::value<size_t>()->default_value(256*1024*1024),
+         "Number of content bytes which may wait for IPFS")
+        ("queue-wait", po::bool_switch()->default_value(false),
+         "Hold requests until there is room in a full insert queue "
+         "(by default they are answered with 503 Service Unavailable)")
+        ("max-waiting-entries", po::value<size_t>()->default_value(1000),
+         "Number of requests which may be held with --queue-wait")
+        ("max-waiting-bytes", po::value<size_t>()->default_value(64*1024*1024),
+         "Number of content bytes which may be held with --queue-wait")
         ;
 
     po::variables_map vm;
@@ -141,6 +770,25 @@ int main(int argc, const char** argv)
 
     string repo   = vm["repo"].as<string>();
     uint16_t port = vm["port"].as<uint16_t>();
+    unsigned threads = max(1u, vm["threads"].as<unsigned>());
+
+    using NodeStorage = ipfs_cache::Injector::NodeStorage;
+
+    string storage_name = vm["node-storage"].as<string>();
+    NodeStorage storage;
+
+    if      (storage_name == "files")  storage = NodeStorage::files;
+    else if (storage_name == "linked") storage = NodeStorage::linked_objects;
+    else if (storage_name == "raw")    storage = NodeStorage::raw_blocks;
+    else {
+        cerr << "Unknown node storage \"" << storage_name << "\"" << endl;
+        return 1;
+    }
+
+    ipfs_cache::Injector::Concurrency concurrency;
+
+    concurrency.min = vm["min-concurrency"].as<unsigned>();
+    concurrency.max = vm["max-concurrency"].as<unsigned>();
 
     asio::io_service ios;
 
@@ -148,17 +796,40 @@ int main(int argc, const char** argv)
      * Create the injector and the server and start the main loop.
      */
     try {
-        ipfs_cache::Injector injector(ios, repo);
+        ipfs_cache::Injector injector(ios, repo, storage, concurrency);
+
+        ipfs_cache::Injector::QueueLimits limits;
+        limits.max_entries = vm["max-queue-entries"].as<size_t>();
+        limits.max_bytes   = vm["max-queue-bytes"].as<size_t>();
+        limits.max_waiting_entries = vm["max-waiting-entries"].as<size_t>();
+        limits.max_waiting_bytes   = vm["max-waiting-bytes"].as<size_t>();
+        injector.set_queue_limits(limits);
+
+        ServerOptions server_options;
+
+        server_options.wait_for_room   = vm["queue-wait"].as<bool>();
+        server_options.max_connections = max<size_t>(1, vm["max-connections"].as<size_t>());
+        server_options.max_pipeline    = max<size_t>(1, vm["max-pipeline"].as<size_t>());
+        server_options.max_body        = vm["max-body"].as<uint64_t>();
+        server_options.read_timeout    = chrono::seconds(vm["read-timeout"].as<unsigned>());
+        server_options.write_timeout   = chrono::seconds(vm["write-timeout"].as<unsigned>());
+        server_options.max_in_flight_bytes = vm["max-in-flight-bytes"].as<uint64_t>();
 
         cout << "IPNS of this database is " << injector.ipns_id() << endl;
         cout << "Starting event loop, press Ctrl-C to exit." << endl;
 
-        asio::spawn( ios
-                   , [&](asio::yield_context yield) {
-                         accept(ios, port, injector, yield);
-                     });
+        Server server(ios, injector, server_options);
+        server.start(port);
+
+        vector<thread> pool;
+
+        for (unsigned i = 1; i < threads; ++i) {
+            pool.emplace_back([&ios] { ios.run(); });
+        }
 
         ios.run();
+
+        for (auto& t : pool) t.join();
     }
     catch (const exception& e) {
         cerr << "Exception " << e.what() << endl;
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+#include <string>
 #include <boost/date_time/posix_time/posix_time.hpp>
 
 namespace ipfs_cache {
@@ -9,6 +11,11 @@ struct CachedContent {
     boost::posix_time::ptime ts;
     // Cached data.
     std::string data;
+    // As given when the data was inserted, empty if unknown.
+    std::string content_type;
+    // Of the whole content, which may be more than `data` holds (see
+    // Client::get_content_range).
+    uint64_t size = 0;
 };
 
 } // ipfs_cache namespace
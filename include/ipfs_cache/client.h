@@ -1,6 +1,7 @@
 #pragma once
 
 #include <boost/asio/spawn.hpp>
+#include <boost/asio/buffer.hpp>
 #include <boost/system/error_code.hpp>
 #include <functional>
 #include <memory>
@@ -8,6 +9,8 @@
 #include <json.hpp>
 
 #include <ipfs_cache/cached_content.h>
+#include <ipfs_cache/lookup_trace.h>
+#include <ipfs_cache/metrics.h>
 
 namespace boost { namespace asio {
     class io_service;
@@ -17,9 +20,31 @@ namespace ipfs_cache {
 
 class Backend;
 class ClientDb;
+class ContentCache;
 using Json = nlohmann::json;
 
+// The io_service may be run by any number of threads and the member
+// functions may be called from any of them. With more than one thread the
+// client must not be destroyed while the io_service is running.
 class Client {
+public:
+    static const size_t DEFAULT_CONTENT_CACHE_SIZE = 64 * 1024 * 1024;
+
+    // How far the client got in starting up. Once the IPFS node runs, the
+    // last known database (persisted in the repository) is loaded from
+    // local storage at the same time as its IPNS name is resolved.
+    enum class Stage {
+        // The IPFS node runs, there is no database to answer queries from.
+        started,
+        // Queries are answered from the last known database.
+        local_snapshot,
+        // Queries are answered from the latest database found through IPNS.
+        up_to_date
+    };
+
+    using OnChunk = std::function<void( boost::asio::const_buffer
+                                      , boost::asio::yield_context)>;
+
 public:
     static std::unique_ptr<Client> build( boost::asio::io_service&
                                         , std::string ipns
@@ -46,26 +71,109 @@ public:
     // Basically it does this: Look into the database to find the IPFS_ID
     // correspoinding to the `url`, when found, fetch the content corresponding
     // to that IPFS_ID from IPFS.
+    //
+    // Concurrent calls for the same URL are served by a single lookup, and
+    // those for different URLs of the same content by a single fetch.
     CachedContent get_content(std::string url, boost::asio::yield_context);
 
+    // Same as the above, but the returned content is shared by all the
+    // concurrent callers instead of being copied for each of them.
+    std::shared_ptr<const CachedContent>
+    get_shared_content(std::string url, boost::asio::yield_context);
+
+    // Streaming variant of the above. Instead of buffering the whole content
+    // in memory, it is passed to `on_chunk` in pieces as it is read from
+    // IPFS. The `on_chunk` handler may do asynchronous IO (e.g. write the
+    // chunk to a socket) using the yield context it is given, an error set
+    // there stops the transfer. The `data` member of the returned
+    // CachedContent is empty.
+    CachedContent get_content( std::string url
+                             , const OnChunk& on_chunk
+                             , boost::asio::yield_context);
+
+    // Same as the above two, but the steps of the lookup and the time they
+    // took are also recorded in `trace`. These lookups are not shared with
+    // other callers.
+    CachedContent get_content( std::string url
+                             , LookupTrace& trace
+                             , boost::asio::yield_context);
+
+    CachedContent get_content( std::string url
+                             , const OnChunk& on_chunk
+                             , LookupTrace& trace
+                             , boost::asio::yield_context);
+
+    // Fetch `length` bytes of the content starting at `offset`, fewer if the
+    // content ends before that. Only the part of the content holding the
+    // range is fetched from IPFS. The `size` member of the returned
+    // CachedContent is that of the whole content, so an `offset` past its
+    // end can be told apart by an empty `data` and `offset >= size`.
+    CachedContent get_content_range( std::string url
+                                   , uint64_t offset
+                                   , uint64_t length
+                                   , boost::asio::yield_context);
+
+    // Streaming variant of the above, see the streaming `get_content`.
+    CachedContent get_content_range( std::string url
+                                   , uint64_t offset
+                                   , uint64_t length
+                                   , const OnChunk& on_chunk
+                                   , boost::asio::yield_context);
+
+    // Waits for the next database downloaded after the call. New databases
+    // are downloaded in the background and queries keep being answered
+    // from the current one until the top levels of the new one are loaded.
     void wait_for_db_update(boost::asio::yield_context);
 
-    void set_ipns(std::string ipns);
+    // Waits until there is a database to answer queries from. This returns
+    // right away once the last known database (persisted in the repository)
+    // has been loaded and only waits for a download on the first run.
+    void wait_for_db(boost::asio::yield_context);
+
+    // Waits until the client reaches `stage` (or any later one).
+    void wait_for_stage(Stage, boost::asio::yield_context);
+
+    // May be called from any thread.
+    Stage stage() const;
+
+    // Follows the database published under `ipns` from now on, returns
+    // once the name is switched. Queries keep being answered from the
+    // current database (if any) until the top levels of the new one are
+    // loaded or fail to load, and the nodes and contents cached so far are
+    // kept. The stage goes back to `local_snapshot` (if it was
+    // `up_to_date`) until the latest database of the new name is in use.
+    void set_ipns(std::string ipns, boost::asio::yield_context);
 
     std::string id() const;
 
-    const std::string& ipns() const;
-    const std::string& ipfs() const;
+    // Contents fetched by the buffering `get_content` functions are kept in
+    // a cache on disk (in the repository) of at most this many bytes,
+    // DEFAULT_CONTENT_CACHE_SIZE unless set. Zero disables the cache.
+    void set_content_cache_size(size_t);
+
+    // Statistics of the IPFS operations done by this client so far.
+    Metrics metrics() const;
+
+    std::string ipns() const;
+    std::string ipfs() const;
 
     ~Client();
 
 private:
     Client(Backend, std::string ipns, std::string path_to_repo);
 
+    // The content is only shared with concurrent callers, so it may be
+    // moved out of when the pointer is unique.
+    std::shared_ptr<CachedContent>
+    fetch_shared_content(std::string url, boost::asio::yield_context);
+
 private:
     std::string _path_to_repo;
     std::unique_ptr<Backend> _backend;
     std::unique_ptr<ClientDb> _db;
+    std::unique_ptr<ContentCache> _content_cache;
+    struct Flights;
+    std::unique_ptr<Flights> _flights;
 };
 
 } // ipfs_cache namespace
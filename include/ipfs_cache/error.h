@@ -19,6 +19,7 @@ namespace ipfs_cache { namespace error {
         invalid_db_format,
         malformed_db_entry,
         missing_ipfs_link,
+        queue_full,
     };
     
     struct ipfs_category : public boost::system::error_category
@@ -49,6 +50,10 @@ namespace ipfs_cache { namespace error {
                     return "failed to pin";
                 case IPFS_UNPIN_FAILED:
                     return "failed to unpin";
+                case IPFS_CANCELED:
+                    return "operation cancelled";
+                case IPFS_TIMED_OUT:
+                    return "operation timed out";
                 default:
                     return "unknown ipfs error";
             }
@@ -73,6 +78,8 @@ namespace ipfs_cache { namespace error {
                     return "malformed database entry";
                 case error::missing_ipfs_link:
                     return "missing IPFS link to content";
+                case error::queue_full:
+                    return "insert queue is full";
                 default:
                     return "unknown ipfs_cache error";
             }
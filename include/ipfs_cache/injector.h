@@ -1,12 +1,20 @@
 #pragma once
 
+#include <boost/asio/buffer.hpp>
 #include <boost/asio/spawn.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/optional.hpp>
 #include <boost/system/error_code.hpp>
+#include <chrono>
+#include <deque>
 #include <functional>
 #include <memory>
-#include <queue>
+#include <mutex>
+#include <vector>
 
 #include <ipfs_cache/cached_content.h>
+#include <ipfs_cache/metrics.h>
 
 namespace boost { namespace asio {
     class io_service;
@@ -15,22 +23,127 @@ namespace boost { namespace asio {
 namespace ipfs_cache {
 
 class Backend;
+class ConcurrencyLimiter;
+class DedupCache;
 class InjectorDb;
+template<class> class FairQueue;
+class WorkThread;
 
+// The io_service may be run by any number of threads and the member
+// functions may be called from any of them. With more than one thread the
+// injector must not be destroyed while the io_service is running.
 class Injector {
 public:
     using OnInsert = std::function<void(boost::system::error_code, std::string)>;
 
+    // Fills the buffer with the next piece of a content and returns its
+    // size, zero once the content is over. The function may do asynchronous
+    // IO using the yield context it is given, an error set through it aborts
+    // the insertion.
+    using ReadContent = std::function<size_t( boost::asio::mutable_buffer
+                                            , boost::asio::yield_context)>;
+
 private:
     struct InsertEntry {
         std::string key;
         std::string value;
+        // Hex SHA-256 of the value.
+        std::string digest;
         boost::posix_time::ptime ts;
         OnInsert on_insert;
+        // Set instead of `value` (and `digest`) for streamed content.
+        ReadContent source;
+        // Known once the content has been read.
+        boost::optional<uint64_t> size;
+        std::string content_type;
+        // See InsertOptions::add_timeout.
+        std::chrono::steady_clock::duration add_timeout;
+    };
+
+public:
+    // Inserts waiting to be added to IPFS are started in weighted round
+    // robin order of their priorities: per round up to 16 interactive, 4
+    // normal and 1 bulk insert. A class with nothing queued doesn't hold the
+    // others back.
+    enum class Priority { interactive, normal, bulk };
+
+    struct InsertOptions {
+        Priority priority = Priority::normal;
+
+        // If non zero and the content isn't handed over to IPFS within this
+        // time (e.g. because of a long queue), the insertion fails with
+        // asio::error::timed_out. Once handed over it is only interrupted
+        // by `add_timeout`.
+        std::chrono::steady_clock::duration timeout
+            = std::chrono::steady_clock::duration(0);
+
+        // If non zero, each IPFS operation adding the content (the whole
+        // add, or the opening, each chunk and the closing of a streamed
+        // content) is aborted after this time plus a second per MiB it hands
+        // over, and the insertion fails with asio::error::timed_out. Such
+        // timeouts also make the injector lower its concurrency (see
+        // Concurrency).
+        std::chrono::steady_clock::duration add_timeout
+            = std::chrono::steady_clock::duration(0);
+
+        // What to do when the insert queue is full (see QueueLimits): wait
+        // until there is room for the content, or fail right away with
+        // error::queue_full. Waiting counts towards the `timeout`.
+        bool wait_for_room = false;
+
+        // Stored along with the content (see CachedContent::content_type),
+        // longer than 255 characters it is cut short.
+        std::string content_type;
+    };
+
+    // Bounds of the queue of inserts waiting to be handed over to IPFS. A
+    // content bigger than `max_bytes` is only admitted to an empty queue.
+    // Streamed contents (see below) only count towards `max_entries`.
+    //
+    // Inserts waiting for room in the queue (see
+    // InsertOptions::wait_for_room) are bounded by `max_waiting_entries` and
+    // `max_waiting_bytes` in the same way, those which don't fit fail with
+    // error::queue_full. They are let into the queue in order of priority.
+    struct QueueLimits {
+        size_t max_entries = 10000;
+        size_t max_bytes   = 256 * 1024 * 1024;
+        size_t max_waiting_entries = 1000;
+        size_t max_waiting_bytes   = 64 * 1024 * 1024;
+    };
+
+    // How the nodes of the database are stored in IPFS.
+    enum class NodeStorage {
+        // As UnixFS files, each pinned (and later unpinned) on its own, i.e.
+        // every commit costs a pin operation per changed node.
+        files,
+        // As objects linking to their children. Only the root is
+        // (recursively) pinned, so every commit costs a single pin and
+        // unpin. Superseded nodes are left for the IPFS garbage collector.
+        linked_objects,
+        // As raw blocks, each pinned on its own. Storing and loading skips
+        // the UnixFS import and the CIDs are hashes of the nodes themselves.
+        raw_blocks
+    };
+
+    // Bounds of the number of contents being added to IPFS concurrently.
+    // Within them the limit adapts to how fast IPFS adds the contents: it
+    // grows while the adding time stays close to the one of an idle node
+    // and shrinks when it rises well above it.
+    struct Concurrency {
+        unsigned min     = 1;
+        unsigned max     = 64;
+        unsigned initial = 8;
     };
 
 public:
-    Injector(boost::asio::io_service&, std::string path_to_repo);
+    Injector( boost::asio::io_service&
+            , std::string path_to_repo
+            , NodeStorage = NodeStorage::files);
+
+    Injector( boost::asio::io_service&
+            , std::string path_to_repo
+            , NodeStorage
+            , Concurrency);
 
     Injector(const Injector&) = delete;
     Injector& operator=(const Injector&) = delete;
@@ -40,20 +153,69 @@ public:
     // "https://ipfs.io/ipns/" + ipfs.ipns_id()
     std::string ipns_id() const;
 
+    // Statistics of the IPFS operations done by this injector so far and
+    // of its "insert" queue.
+    Metrics metrics() const;
+
+    // Takes effect asynchronously.
+    void set_queue_limits(QueueLimits);
+
     // Insert `content` into IPFS and store its IPFS ID under the `url` in the
     // database. The IPFS ID is also returned as a parameter to the callback
     // function.
     //
+    // The `content` is taken by value and handed over to IPFS without further
+    // copying, so pass it with std::move if the caller no longer needs it.
+    //
+    // Contents are pinned in IPFS once added. Content which was inserted
+    // before (under any URL) isn't added to IPFS again, only the database is
+    // updated with the CID it got then.
+    //
     // When testing or debugging, the content can be found here:
     // "https://ipfs.io/ipfs/" + <IPFS ID>
     void insert_content( std::string url
-                       , const std::string& content
+                       , std::string content
+                       , OnInsert);
+
+    void insert_content( std::string url
+                       , std::string content
+                       , InsertOptions
+                       , OnInsert);
+
+    std::string insert_content( std::string url
+                              , std::string content
+                              , boost::asio::yield_context);
+
+    std::string insert_content( std::string url
+                              , std::string content
+                              , InsertOptions
+                              , boost::asio::yield_context);
+
+    // Same as above, but the content is pulled from `source` and handed over
+    // to IPFS in pieces of 256KiB, so it never needs to be in memory as a
+    // whole. Such content is always added to IPFS, but is recognized when
+    // inserted again as a whole.
+    void insert_content( std::string url
+                       , ReadContent source
+                       , InsertOptions
                        , OnInsert);
 
     std::string insert_content( std::string url
-                              , const std::string& content
+                              , ReadContent source
+                              , InsertOptions
                               , boost::asio::yield_context);
 
+    // Streams the content of the file at `path` as above.
+    void insert_file( std::string url
+                    , std::string path
+                    , InsertOptions
+                    , OnInsert);
+
+    std::string insert_file( std::string url
+                           , std::string path
+                           , InsertOptions
+                           , boost::asio::yield_context);
+
     // Find the content previously stored by the injector under `url`.
     // The content is returned in the parameter of the callback function.
     //
@@ -65,15 +227,58 @@ public:
     ~Injector();
 
 private:
+    void start_inserts();
     void insert_content_from_queue();
+    void update_queue_metrics();
+    void insert_stream(InsertEntry);
+    void enqueue(InsertEntry, InsertOptions);
+    bool has_room(const InsertEntry&) const;
+    bool has_waiting_room(const InsertEntry&) const;
+    void push(InsertEntry, Priority, std::chrono::steady_clock::time_point deadline);
+    void admit_waiting();
+    void insert_hashed(InsertEntry, InsertOptions);
+    void insert_known(InsertEntry, InsertOptions, std::string ipfs_id);
+    void on_added(InsertEntry, boost::system::error_code, std::string ipfs_id);
+    void update_db(InsertEntry, std::string ipfs_id);
+    void expire_inserts();
+    void schedule_expiry(std::chrono::steady_clock::time_point deadline);
 
 private:
     std::unique_ptr<Backend> _backend;
     std::unique_ptr<InjectorDb> _db;
-    std::queue<InsertEntry> _insert_queue;
-    const unsigned int _concurrency = 8;
-    unsigned int _job_count = 0;
+    // Guards the insert queue, the limiter and the dedup cache.
+    boost::asio::io_service::strand _strand;
+    std::unique_ptr<FairQueue<InsertEntry>> _insert_queue;
+    size_t _queued_bytes = 0;
+    QueueLimits _queue_limits;
+    // Inserts waiting for room in the queue, by priority and then in order
+    // of arrival.
+    struct WaitingEntry {
+        InsertEntry entry;
+        Priority priority;
+        std::chrono::steady_clock::time_point deadline;
+    };
+    std::vector<std::deque<WaitingEntry>> _waiting;
+    size_t _waiting_entries = 0;
+    size_t _waiting_bytes = 0;
+    // Fires at the earliest deadline of the queued inserts.
+    boost::asio::steady_timer _expiry_timer;
+    std::chrono::steady_clock::time_point _expiry_at;
+    std::unique_ptr<ConcurrencyLimiter> _limiter;
+    // Streams in progress waiting for the limiter to let them do their
+    // next IPFS operation, called with an error if the injector goes away.
+    std::deque<std::function<void(boost::system::error_code)>> _slot_waiters;
+    // Content digest -> CID of contents added so far, so that re-inserted
+    // content isn't added to IPFS again.
+    std::unique_ptr<DedupCache> _dedup;
+    // Copy of the queue state for `metrics`, which may be called from any
+    // thread.
+    mutable std::mutex _queue_metrics_mutex;
+    Metrics::Queue _queue_metrics;
     std::shared_ptr<bool> _was_destroyed;
+    // Opens and reads the files of `insert_file`, so that a slow disk doesn't
+    // hold up the io_service threads.
+    std::unique_ptr<WorkThread> _file_thread;
 };
 
 } // ipfs_cache namespace
@@ -14,5 +14,7 @@
 #define IPFS_PUBLISH_FAILED          6  // failed to publish CID
 #define IPFS_PIN_FAILED              7  // failed to publish CID
 #define IPFS_UNPIN_FAILED            8  // failed to publish CID
+#define IPFS_CANCELED                9  // operation was cancelled
+#define IPFS_TIMED_OUT              10  // operation timed out
 
 #endif  // ndef GUARD_ipfs_error_codes_h
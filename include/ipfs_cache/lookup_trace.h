@@ -0,0 +1,71 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <boost/system/error_code.hpp>
+
+namespace ipfs_cache {
+
+// Timeline of a single content lookup (see Client::get_content), used to
+// find out where the time of slow lookups goes.
+struct LookupTrace {
+    using Clock = std::chrono::steady_clock;
+
+    enum class Step {
+        // The whole database query, the spans below up to `cat` are nested
+        // in it.
+        query,
+        // Fetch of a database node which wasn't loaded yet.
+        node_fetch,
+        // Parsing of a fetched database node.
+        node_parse,
+        // Parsing of the database entry found for the URL.
+        entry_parse,
+        // Fetch of the content itself.
+        cat
+    };
+
+    struct Span {
+        Step step;
+        // Relative to `started`.
+        Clock::duration start;
+        Clock::duration duration;
+        // Of the node or content, if any.
+        std::string cid;
+        size_t bytes = 0;
+        // Whether a fetch was served from the block or content cache.
+        bool cache_hit = false;
+        boost::system::error_code ec;
+    };
+
+    Clock::time_point started = Clock::now();
+    std::vector<Span> spans;
+
+    // Starts a span and returns its index, spans may nest.
+    size_t begin(Step step) {
+        spans.push_back(Span{step, Clock::now() - started, {}});
+        return spans.size() - 1;
+    }
+
+    // Finishes the span and returns it so that the rest of it can be
+    // filled in.
+    Span& end(size_t i) {
+        auto& span = spans[i];
+        span.duration = Clock::now() - started - span.start;
+        return span;
+    }
+
+    static const char* name(Step step) {
+        switch (step) {
+            case Step::query:       return "query";
+            case Step::node_fetch:  return "node_fetch";
+            case Step::node_parse:  return "node_parse";
+            case Step::entry_parse: return "entry_parse";
+            case Step::cat:         return "cat";
+        }
+        return "unknown";
+    }
+};
+
+} // ipfs_cache namespace
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ipfs_cache {
+
+// A snapshot of the statistics of the operations done through IPFS.
+// Operations served without asking IPFS (e.g. from the block cache or the
+// IPNS resolution cache) are not included.
+struct Metrics {
+    // Latency histogram with buckets of about equal relative width (~12%),
+    // i.e. it keeps the same relative precision for fast and slow samples.
+    struct Histogram {
+        // Inclusive upper bounds (in microseconds) and sample counts of the
+        // non empty buckets in increasing order.
+        std::vector<std::pair<uint64_t, uint64_t>> buckets;
+        uint64_t count  = 0;
+        uint64_t sum_us = 0;
+
+        // Upper bound of the bucket below which the `q` (0..1) fraction of
+        // samples lies, zero if there are no samples.
+        uint64_t percentile(double q) const;
+
+        double mean_us() const {
+            return count ? double(sum_us) / count : 0;
+        }
+    };
+
+    struct Op {
+        uint64_t started   = 0;
+        uint64_t completed = 0;
+        uint64_t in_flight = 0;
+        uint64_t bytes_in  = 0; // Handed over to IPFS (e.g. added content).
+        uint64_t bytes_out = 0; // Returned from IPFS (e.g. cat'ed content).
+        Histogram latency;
+        // Counts of failed operations by the IPFS error code (see
+        // ipfs_error_codes.h), this includes IPFS_CANCELED and
+        // IPFS_TIMED_OUT.
+        std::map<int, uint64_t> errors;
+    };
+
+    // Operations waiting for IPFS in front of it.
+    struct Queue {
+        uint64_t queued    = 0; // Waiting to be started.
+        uint64_t bytes     = 0; // Of the queued entries.
+        uint64_t waiting   = 0; // Waiting for room in the queue.
+        uint64_t in_flight = 0;
+        uint64_t limit     = 0; // Current limit on in_flight.
+        uint64_t limit_increases = 0;
+        uint64_t limit_decreases = 0;
+        uint64_t expired  = 0; // Dropped for their deadline passing.
+        uint64_t rejected = 0; // Failed for the queue being full.
+    };
+
+    struct Cache {
+        uint64_t hits       = 0;
+        uint64_t misses     = 0;
+        uint64_t insertions = 0;
+        uint64_t rejections = 0; // Not admitted by the cache policy.
+        uint64_t evictions  = 0;
+        uint64_t size       = 0; // Bytes currently cached.
+        uint64_t count      = 0; // Items currently cached.
+
+        double hit_rate() const {
+            return hits + misses ? double(hits) / (hits + misses) : 0;
+        }
+    };
+
+    // Indexed by operation name ("add", "cat", "resolve", ...).
+    std::map<std::string, Op> ops;
+
+    // Indexed by queue name, only filled in by Injector::metrics ("insert").
+    std::map<std::string, Queue> queues;
+
+    // Indexed by cache name: "block" (the in memory cache of the backend)
+    // and, only filled in by Client::metrics, "content" (see
+    // Client::set_content_cache_size).
+    std::map<std::string, Cache> caches;
+};
+
+} // ipfs_cache namespace
@@ -1,83 +1,327 @@
 #include <ipfs_bindings.h>
 #include <ipfs_cache/error.h>
 #include <assert.h>
+#include <atomic>
 #include <mutex>
+#include <thread>
 #include <experimental/tuple>
 #include <boost/intrusive/list.hpp>
 #include <boost/optional.hpp>
+#include <list>
+#include <unordered_map>
 
 #include "backend.h"
+#include "block_cache.h"
+#include "metrics.h"
+#include "resolve_cache.h"
 
 using namespace ipfs_cache;
 using namespace std;
 namespace intr = boost::intrusive;
 
-template<class F> struct Defer {
-    F f;
-    ~Defer() { f(); }
-};
+// Handles are allocated and freed at a high rate, so freed ones are kept
+// around for reuse in per thread free lists (bucketed by size). Having the
+// lists per thread means no synchronization is needed. Handles freed on
+// another thread than the one they were allocated on simply migrate there;
+// each list is capped and returns its blocks to the heap when its thread
+// exits, so threads that only free (e.g. Go's) don't hoard or leak them.
+struct HandlePool {
+    static const size_t GRANULARITY = 64;
+    static const size_t CLASS_COUNT = 8;
+    static const unsigned MAX_FREE  = 64;
+
+    struct FreeList {
+        void* head = nullptr;
+        unsigned size = 0;
+
+        ~FreeList() {
+            while (head) {
+                void* next = *reinterpret_cast<void**>(head);
+                ::operator delete(head);
+                head = next;
+            }
+        }
+    };
+
+    static FreeList* free_lists() {
+        static thread_local FreeList lists[CLASS_COUNT];
+        return lists;
+    }
+
+    static size_t size_class(size_t size) {
+        return (size + GRANULARITY - 1) / GRANULARITY - 1;
+    }
+
+    static void* allocate(size_t size) {
+        auto c = size_class(size);
+
+        if (c >= CLASS_COUNT) return ::operator new(size);
 
-template<class F> Defer<F> defer(F&& f) {
-    return Defer<F>{forward<F>(f)};
+        auto& l = free_lists()[c];
+
+        if (!l.head) return ::operator new((c + 1) * GRANULARITY);
+
+        void* p = l.head;
+        l.head = *reinterpret_cast<void**>(p);
+        --l.size;
+        return p;
+    }
+
+    static void deallocate(void* p, size_t size) {
+        auto c = size_class(size);
+
+        if (c >= CLASS_COUNT) return ::operator delete(p);
+
+        auto& l = free_lists()[c];
+
+        if (l.size >= MAX_FREE) return ::operator delete(p);
+
+        *reinterpret_cast<void**>(p) = l.head;
+        l.head = p;
+        ++l.size;
+    }
 };
 
+// A handle is referenced by the Go side until the operation completes and by
+// BackendImpl::handles until the callback is executed or cancelled.
 struct HandleBase : public intr::list_base_hook
                             <intr::link_mode<intr::auto_unlink>> {
+    HandleBase* next_completed = nullptr;
+    bool cancelled = false;
+    atomic<unsigned> refs{2};
+    // Where the operation is accounted for, if anywhere.
+    OpMetrics* metrics = nullptr;
+    OpMetrics::Clock::time_point started;
+
+    virtual void run() = 0;
     virtual void cancel() = 0;
+
+    void release() { if (--refs == 0) delete this; }
+
+    static void* operator new(size_t size) {
+        return HandlePool::allocate(size);
+    }
+
+    static void operator delete(void* p, size_t size) {
+        HandlePool::deallocate(p, size);
+    }
+
     virtual ~HandleBase() { }
 };
 
-struct ipfs_cache::BackendImpl {
+struct ipfs_cache::BackendImpl
+    : public enable_shared_from_this<BackendImpl>
+{
     // This prevents callbacks from being called once Backend is destroyed.
-    bool was_destroyed;
+    atomic<bool> was_destroyed;
     asio::io_service& ios;
-    mutex destruct_mutex;
+    // Guards `handles`, `work` and the `cancelled` flags of the handles.
+    mutex handles_mutex;
+    // Operations in flight.
     intr::list<HandleBase, intr::constant_time_size<false>> handles;
+    // Keeps io_service::run from returning while operations are in flight.
+    boost::optional<asio::io_service::work> work;
+    // Lock free stack of handles completed by Go threads, drained in
+    // batches by the io_service thread.
+    atomic<HandleBase*> completed;
+    // Number of Go threads currently in `complete`, see ~Backend.
+    atomic<unsigned> completing;
+    mutex block_cache_mutex;
+    BlockCache block_cache;
+    // Ids by which operations are cancelled on the Go side, zero is reserved
+    // for operations which can't be.
+    atomic<uint64_t> next_op_id;
+
+    using OnResolve = function<void(sys::error_code, string)>;
+
+    // An IPNS lookup in progress and the callers waiting for it.
+    struct Resolving {
+        uint64_t op_id = 0;
+        uint64_t last_waiter_id = 0;
+        list<pair<uint64_t, OnResolve>> waiters;
+    };
+
+    shared_ptr<ResolveCache> resolve_cache;
+    mutex resolving_mutex;
+    unordered_map<string, Resolving> resolving;
+
+    BackendMetrics metrics;
 
     BackendImpl(asio::io_service& ios)
         : was_destroyed(false)
         , ios(ios)
+        , completed(nullptr)
+        , completing(0)
+        , block_cache(Backend::DEFAULT_BLOCK_CACHE_SIZE)
+        , next_op_id(1)
+        , resolve_cache(ResolveCache::shared())
     {}
+
+    // Defined below, once Handle is.
+    void resolve(const string& ipns, const Backend::OpOptions&, OnResolve);
+    void on_resolved( const string& ipns
+                    , uint64_t op_id
+                    , ResolveCache::Clock::time_point started
+                    , sys::error_code
+                    , string cid);
+    void cancel_resolve(const string& ipns, uint64_t waiter_id);
+
+    void track(HandleBase& h, OpKind kind, size_t bytes_in) {
+        h.metrics = &metrics[kind];
+        h.started = OpMetrics::Clock::now();
+        h.metrics->start(bytes_in);
+    }
+
+    void add(HandleBase& h) {
+        lock_guard<mutex> lock(handles_mutex);
+        if (handles.empty()) work.emplace(ios);
+        handles.push_back(h);
+    }
+
+    BlockCache::Data find_cached(const string& cid) {
+        lock_guard<mutex> lock(block_cache_mutex);
+        return block_cache.find(cid);
+    }
+
+    // Content the cache wouldn't admit isn't copied.
+    void insert_cached(const string& cid, const string& data) {
+        {
+            lock_guard<mutex> lock(block_cache_mutex);
+            if (data.size() > block_cache.max_item_size()) return;
+        }
+
+        insert_cached(cid, make_shared<const string>(data));
+    }
+
+    void insert_cached(const string& cid, BlockCache::Data data) {
+        lock_guard<mutex> lock(block_cache_mutex);
+        block_cache.insert(cid, move(data));
+    }
+
+    // Called from Go threads, the `store_result` function is only executed
+    // if the handle is still going to be used.
+    template<class F>
+    void complete(HandleBase* h, F&& store_result) {
+        ++completing;
+
+        if (was_destroyed) {
+            --completing;
+            return h->release();
+        }
+
+        store_result();
+
+        HandleBase* head = completed.load();
+
+        do {
+            h->next_completed = head;
+        }
+        while (!completed.compare_exchange_weak(head, h));
+
+        // Only the first handle of a batch wakes up the io_service.
+        if (!head) {
+            ios.post([self = shared_from_this()] { self->drain(); });
+        }
+
+        --completing;
+    }
+
+    // May run on several threads at once, each draining a different batch.
+    void drain() {
+        HandleBase* h = completed.exchange(nullptr);
+
+        // Reverse to execute the callbacks in order of completion.
+        HandleBase* fifo = nullptr;
+
+        while (h) {
+            auto next = h->next_completed;
+            h->next_completed = fifo;
+            fifo = h;
+            h = next;
+        }
+
+        while (fifo) {
+            h = fifo;
+            fifo = fifo->next_completed;
+
+            bool run;
+
+            {
+                lock_guard<mutex> lock(handles_mutex);
+                run = !h->cancelled;
+                if (run) h->unlink();
+            }
+
+            if (run) {
+                h->run();
+                h->release();
+            }
+
+            h->release();
+        }
+
+        lock_guard<mutex> lock(handles_mutex);
+        if (handles.empty()) work = boost::none;
+    }
 };
 
+// Operations aborted through their Go context are reported with the usual
+// asio errors so that callers don't need to know about IPFS error codes.
+static sys::error_code to_error_code(int err)
+{
+    switch (err) {
+        case IPFS_CANCELED:  return asio::error::operation_aborted;
+        case IPFS_TIMED_OUT: return asio::error::timed_out;
+        default:             return make_error_code(error::ipfs_error{err});
+    }
+}
+
+// Number of bytes returned by an operation, for the metrics.
+static size_t result_size() { return 0; }
+static size_t result_size(uint64_t) { return 0; }
+static size_t result_size(const string& data) { return data.size(); }
+static size_t result_size(const vector<sys::error_code>&) { return 0; }
+
+static size_t result_size(const vector<Backend::ItemResult>& items)
+{
+    size_t size = 0;
+    for (auto& i : items) size += i.value.size();
+    return size;
+}
+
+static size_t total_size(const vector<string>& buffers)
+{
+    size_t size = 0;
+    for (auto& b : buffers) size += b.size();
+    return size;
+}
+
 template<class... As>
 struct Handle : public HandleBase {
     shared_ptr<BackendImpl> impl;
     function<void(sys::error_code, As&&...)> cb;
-    boost::optional<asio::io_service::work> work;
     tuple<sys::error_code, As...> args;
 
     Handle( shared_ptr<BackendImpl> impl_
           , function<void(sys::error_code, As&&...)> cb)
         : impl(move(impl_))
         , cb(move(cb))
-        , work(asio::io_service::work(impl->ios))
     {
-        impl->handles.push_back(*this);
+        impl->add(*this);
     }
 
     static void call(int err, void* arg, As... args) {
         auto self = reinterpret_cast<Handle*>(arg);
-        auto& ios = self->impl->ios;
 
-        lock_guard<mutex> guard(self->impl->destruct_mutex);
+        if (self->metrics) {
+            self->metrics->finish( OpMetrics::Clock::now() - self->started
+                                 , err
+                                 , result_size(args...));
+        }
 
-        // Already cancelled?
-        if (!self->cb) { delete self; return; }
-
-        self->unlink();
-
-        auto ec = self->impl->was_destroyed
-                ? asio::error::operation_aborted
-                : make_error_code(error::ipfs_error{err});
-
-        self->args = make_tuple(ec, move(args)...);
-
-        ios.dispatch([self] {
-            auto on_exit = defer([=] { delete self; });
-            if (self->impl->was_destroyed) return;
-            std::experimental::apply(self->cb, move(self->args));
-        });
+        self->impl->complete(self, [&] {
+                self->args = make_tuple(to_error_code(err), move(args)...);
+            });
     }
 
     static void call_void(int err, void* arg) {
@@ -88,25 +332,304 @@ struct Handle : public HandleBase {
         call(err, arg, string(data, data + size));
     }
 
+    static void call_uint64(int err, uint64_t value, void* arg) {
+        call(err, arg, value);
+    }
+
+    void run() override {
+        std::experimental::apply(cb, move(args));
+    }
+
+    // Called with BackendImpl::handles_mutex locked.
     void cancel() override {
-        work = boost::none;
+        cancelled = true;
+        unlink();
+
         std::get<0>(args) = asio::error::operation_aborted;
 
         impl->ios.post([cb = move(cb), as = move(args)] () mutable {
                 std::experimental::apply(cb, move(as));
             });
+
+        release();
+    }
+};
+
+// Owns the buffer into which the Go side reads data, so that the buffer
+// outlives the read even if the operation gets cancelled.
+struct ReadHandle : public Handle<string> {
+    string buffer;
+
+    ReadHandle( shared_ptr<BackendImpl> impl
+              , function<void(sys::error_code, string&&)> cb
+              , size_t size)
+        : Handle<string>(move(impl), move(cb))
+        , buffer(size, '\0')
+    {}
+
+    static void call_read(int err, uint64_t size, void* arg) {
+        auto self = static_cast<ReadHandle*>(reinterpret_cast<Handle<string>*>(arg));
+        self->buffer.resize(err == IPFS_SUCCESS ? size : 0);
+        call(err, arg, move(self->buffer));
+    }
+};
+
+// Keeps the added buffers alive while the Go side reads them.
+struct AddHandle : public Handle<string> {
+    vector<string> buffers;
+    vector<const void*> data;
+    vector<size_t> sizes;
+
+    AddHandle( shared_ptr<BackendImpl> impl
+             , function<void(sys::error_code, string&&)> cb
+             , vector<string> buffers_)
+        : Handle<string>(move(impl), move(cb))
+        , buffers(move(buffers_))
+    {
+        // The Go side expects at least one buffer.
+        if (buffers.empty()) buffers.emplace_back();
+
+        data.reserve(buffers.size());
+        sizes.reserve(buffers.size());
+
+        for (auto& b : buffers) {
+            data.push_back(b.data());
+            sizes.push_back(b.size());
+        }
+    }
+};
+
+// Keeps a chunk of streamed content alive while the Go side reads it.
+struct WriteHandle : public Handle<> {
+    string chunk;
+
+    WriteHandle( shared_ptr<BackendImpl> impl
+               , function<void(sys::error_code)> cb
+               , string chunk)
+        : Handle<>(move(impl), move(cb))
+        , chunk(move(chunk))
+    {}
+};
+
+// Completion of the batched operations. Input buffers of `add_many` are
+// kept here for as long as the Go side may read them.
+template<class Item>
+struct BatchHandle : public Handle<vector<Item>> {
+    using Base = Handle<vector<Item>>;
+
+    vector<string> buffers;
+    vector<const void*> data;
+    vector<size_t> sizes;
+
+    BatchHandle( shared_ptr<BackendImpl> impl
+               , function<void(sys::error_code, vector<Item>&&)> cb
+               , vector<string> buffers_ = {})
+        : Base(move(impl), move(cb))
+        , buffers(move(buffers_))
+    {
+        data.reserve(buffers.size());
+        sizes.reserve(buffers.size());
+
+        for (auto& b : buffers) {
+            data.push_back(b.data());
+            sizes.push_back(b.size());
+        }
+    }
+
+    static Backend::ItemResult make_item(int err, const char* d, size_t size, Backend::ItemResult*) {
+        return { to_error_code(err), string(d, d + size) };
+    }
+
+    static sys::error_code make_item(int err, const char*, size_t, sys::error_code*) {
+        return to_error_code(err);
+    }
+
+    static void call_batch( const int* errs
+                          , const char* const* d
+                          , const size_t* sizes
+                          , size_t count
+                          , void* arg)
+    {
+        vector<Item> items;
+        items.reserve(count);
+
+        for (size_t i = 0; i < count; ++i) {
+            items.push_back(make_item( errs[i]
+                                     , d ? d[i] : nullptr
+                                     , d ? sizes[i] : 0
+                                     , (Item*) nullptr));
+        }
+
+        Base::call(IPFS_SUCCESS, arg, move(items));
     }
 };
 
+// Go side arguments of a single operation.
+struct OpArgs {
+    uint64_t id;
+    int64_t timeout_ms;
+};
+
+// Called right before the operation is handed over to Go.
+static int64_t timeout_ms(const Backend::OpOptions& opts)
+{
+    using namespace std::chrono;
+
+    if (opts.timeout <= opts.timeout.zero()) return 0;
+
+    // Round up so that short timeouts don't turn into none at all.
+    return max<int64_t>(1, duration_cast<milliseconds>(opts.timeout).count());
+}
+
+static OpArgs start_op( BackendImpl& impl
+                      , const Backend::OpOptions& opts
+                      , HandleBase& h
+                      , OpKind kind
+                      , size_t bytes_in = 0)
+{
+    impl.track(h, kind, bytes_in);
+
+    OpArgs op{0, timeout_ms(opts)};
+
+    if (opts.cancel) {
+        op.id = impl.next_op_id++;
+        *opts.cancel = [id = op.id] { go_ipfs_cache_cancel(id); };
+    }
+
+    return op;
+}
+
+// For operations served without going to IPFS (e.g. from a cache), these
+// are over before they could be cancelled.
+static void set_no_cancel(const Backend::OpOptions& opts)
+{
+    if (opts.cancel) *opts.cancel = [] {};
+}
+
+// Passes C strings of `strs` to `f`. The pointers are only valid during the
+// call.
+template<class F>
+static void with_c_strings(const vector<string>& strs, F&& f)
+{
+    vector<const char*> ptrs;
+    ptrs.reserve(strs.size());
+    for (auto& s : strs) ptrs.push_back(s.c_str());
+    f((void*) ptrs.data(), ptrs.size());
+}
+
+void BackendImpl::resolve( const string& ipns
+                         , const Backend::OpOptions& opts
+                         , OnResolve cb)
+{
+    unique_lock<mutex> lock(resolving_mutex);
+
+    auto& r = resolving[ipns];
+
+    // Without a callback this is a background revalidation.
+    if (cb) {
+        auto id = ++r.last_waiter_id;
+        r.waiters.emplace_back(id, move(cb));
+
+        if (opts.cancel) {
+            weak_ptr<BackendImpl> w = shared_from_this();
+
+            *opts.cancel = [w, ipns, id] {
+                if (auto self = w.lock()) self->cancel_resolve(ipns, id);
+            };
+        }
+    }
+
+    if (r.op_id) return; // Already in progress.
+
+    auto op_id = r.op_id = next_op_id++;
+
+    lock.unlock();
+
+    auto started = ResolveCache::Clock::now();
+
+    auto h = new Handle<string>{ shared_from_this()
+                               , [self = shared_from_this(), ipns, op_id, started]
+                                 (sys::error_code ec, string cid) {
+                                     self->on_resolved(ipns, op_id, started, ec, move(cid));
+                                 }};
+
+    track(*h, OpKind::resolve, 0);
+
+    go_ipfs_cache_resolve( (char*) ipns.data()
+                         , op_id, timeout_ms(opts)
+                         , (void*) Handle<string>::call_data
+                         , (void*) h );
+}
+
+void BackendImpl::on_resolved( const string& ipns
+                             , uint64_t op_id
+                             , ResolveCache::Clock::time_point started
+                             , sys::error_code ec
+                             , string cid)
+{
+    if (!ec) resolve_cache->insert(ipns, cid, started);
+
+    list<pair<uint64_t, OnResolve>> waiters;
+
+    {
+        lock_guard<mutex> lock(resolving_mutex);
+        auto i = resolving.find(ipns);
+        // The lookup may have been cancelled and another one started since.
+        if (i != resolving.end() && i->second.op_id == op_id) {
+            waiters = move(i->second.waiters);
+            resolving.erase(i);
+        }
+    }
+
+    for (auto& w : waiters) w.second(ec, cid);
+}
+
+void BackendImpl::cancel_resolve(const string& ipns, uint64_t waiter_id)
+{
+    OnResolve cb;
+    uint64_t op_id = 0;
+
+    {
+        lock_guard<mutex> lock(resolving_mutex);
+
+        auto i = resolving.find(ipns);
+        if (i == resolving.end()) return;
+
+        auto& waiters = i->second.waiters;
+
+        for (auto j = waiters.begin(); j != waiters.end(); ++j) {
+            if (j->first != waiter_id) continue;
+            cb = move(j->second);
+            waiters.erase(j);
+            break;
+        }
+
+        // Nobody is interested in the result anymore, callers coming
+        // after this start a new lookup.
+        if (cb && waiters.empty()) {
+            op_id = i->second.op_id;
+            resolving.erase(i);
+        }
+    }
+
+    if (op_id) go_ipfs_cache_cancel(op_id);
+
+    if (cb) {
+        ios.post([cb = move(cb)] {
+                cb(asio::error::operation_aborted, string());
+            });
+    }
+}
+
 void Backend::build_( asio::io_service& ios
                     , const string& repo_path
-                    , function<void( const sys::error_code& ec
-                                   , unique_ptr<Backend>)> cb)
+                    , function<void( sys::error_code
+                                   , shared_ptr<BackendImpl>)> cb)
 {
     auto impl = make_shared<BackendImpl>(ios);
 
     auto cb_ = [cb = move(cb), impl] (const sys::error_code& ec) {
-        cb(ec, unique_ptr<Backend>(new Backend(move(impl))));
+        cb(ec, move(impl));
     };
 
     go_ipfs_cache_async_start( (char*) repo_path.data()
@@ -136,57 +659,460 @@ string Backend::ipns_id() const {
     return ret;
 }
 
-void Backend::publish_(const string& cid, Timer::duration d, std::function<void(sys::error_code)> cb)
+void Backend::publish_( const string& cid
+                      , Timer::duration d
+                      , const OpOptions& opts
+                      , std::function<void(sys::error_code)> cb)
 {
     using namespace std::chrono;
 
-    assert(cid.size() == CID_SIZE);
+    assert(!cid.empty());
+
+    // Our own record is known without asking the network.
+    auto cb_ = [ impl    = _impl
+               , ipns    = ipns_id()
+               , cid
+               , started = ResolveCache::Clock::now()
+               , cb      = move(cb)
+               ] (sys::error_code ec) {
+        if (!ec) impl->resolve_cache->insert(ipns, cid, started);
+        cb(ec);
+    };
+
+    auto h  = new Handle<>{_impl, move(cb_)};
+    auto op = start_op(*_impl, opts, *h, OpKind::publish);
 
     go_ipfs_cache_publish( (char*) cid.data()
                          , duration_cast<seconds>(d).count()
+                         , op.id, op.timeout_ms
                          , (void*) Handle<>::call_void
-                         , (void*) new Handle<>{_impl, move(cb)});
+                         , (void*) h);
 }
 
-void Backend::resolve_(const string& ipns_id, function<void(sys::error_code, string)> cb)
+void Backend::resolve_( const string& ipns_id
+                      , const OpOptions& opts
+                      , function<void(sys::error_code, string)> cb)
 {
-    go_ipfs_cache_resolve( (char*) ipns_id.data()
-                         , (void*) Handle<string>::call_data
-                         , (void*) new Handle<string>{_impl, move(cb)} );
+    using State = ResolveCache::State;
+
+    auto entry = _impl->resolve_cache->find(ipns_id, opts.max_cache_age);
+
+    if (entry.state == State::missing) {
+        return _impl->resolve(ipns_id, opts, move(cb));
+    }
+
+    set_no_cancel(opts);
+
+    _impl->ios.post([cb = move(cb), cid = move(entry.cid)] () mutable {
+            cb(sys::error_code(), move(cid));
+        });
+
+    if (entry.state == State::stale) {
+        _impl->resolve(ipns_id, opts, nullptr);
+    }
 }
 
-void Backend::add_(const uint8_t* data, size_t size, function<void(sys::error_code, string)> cb)
+void Backend::add_( vector<string> buffers
+                  , const OpOptions& opts
+                  , function<void(sys::error_code, string)> cb)
 {
-    go_ipfs_cache_add( (void*) data, size
+    auto h  = new AddHandle(_impl, move(cb), move(buffers));
+    auto op = start_op(*_impl, opts, *h, OpKind::add, total_size(h->buffers));
+
+    go_ipfs_cache_add( (void*) h->data.data()
+                     , (void*) h->sizes.data()
+                     , h->data.size()
+                     , op.id, op.timeout_ms
                      , (void*) Handle<string>::call_data
-                     , (void*) new Handle<string>{_impl, move(cb)} );
+                     , (void*) static_cast<Handle<string>*>(h) );
+}
+
+void Backend::add_open_( const OpOptions& opts
+                       , function<void(sys::error_code, uint64_t)> cb)
+{
+    auto h  = new Handle<uint64_t>{_impl, move(cb)};
+    auto op = start_op(*_impl, opts, *h, OpKind::add_open);
+
+    go_ipfs_cache_add_open( op.id, op.timeout_ms
+                          , (void*) Handle<uint64_t>::call_uint64
+                          , (void*) h );
+}
+
+void Backend::write_( uint64_t writer_id
+                    , string chunk
+                    , const OpOptions& opts
+                    , function<void(sys::error_code)> cb)
+{
+    auto h  = new WriteHandle(_impl, move(cb), move(chunk));
+    auto op = start_op(*_impl, opts, *h, OpKind::add_write, h->chunk.size());
+
+    go_ipfs_cache_add_write( writer_id
+                           , (void*) h->chunk.data()
+                           , h->chunk.size()
+                           , op.id, op.timeout_ms
+                           , (void*) Handle<>::call_void
+                           , (void*) static_cast<Handle<>*>(h) );
 }
 
-void Backend::cat_(const string& ipfs_id, function<void(sys::error_code, string)> cb)
+void Backend::add_close_( uint64_t writer_id
+                        , const OpOptions& opts
+                        , function<void(sys::error_code, string)> cb)
 {
-    assert(ipfs_id.size() == CID_SIZE);
+    auto h  = new Handle<string>{_impl, move(cb)};
+    auto op = start_op(*_impl, opts, *h, OpKind::add_close);
+
+    go_ipfs_cache_add_close( writer_id
+                           , op.id, op.timeout_ms
+                           , (void*) Handle<string>::call_data
+                           , (void*) h );
+}
+
+void Backend::add_abort(uint64_t writer_id)
+{
+    go_ipfs_cache_add_abort(writer_id);
+}
+
+void Backend::add_object_( string data
+                         , const vector<string>& links
+                         , const OpOptions& opts
+                         , function<void(sys::error_code, string)> cb)
+{
+    vector<string> buffers;
+    buffers.push_back(move(data));
+
+    auto h  = new AddHandle(_impl, move(cb), move(buffers));
+    auto op = start_op(*_impl, opts, *h, OpKind::add_object, h->sizes[0]);
+
+    with_c_strings(links, [&] (void* c_links, size_t count) {
+        go_ipfs_cache_add_object( (void*) h->data[0]
+                                , h->sizes[0]
+                                , c_links, count
+                                , op.id, op.timeout_ms
+                                , (void*) Handle<string>::call_data
+                                , (void*) static_cast<Handle<string>*>(h) );
+        });
+}
+
+void Backend::block_put_( string data
+                        , const OpOptions& opts
+                        , function<void(sys::error_code, string)> cb)
+{
+    vector<string> buffers;
+    buffers.push_back(move(data));
+
+    auto h  = new AddHandle(_impl, move(cb), move(buffers));
+    auto op = start_op(*_impl, opts, *h, OpKind::block_put, h->sizes[0]);
+
+    go_ipfs_cache_block_put( (void*) h->data[0]
+                           , h->sizes[0]
+                           , op.id, op.timeout_ms
+                           , (void*) Handle<string>::call_data
+                           , (void*) static_cast<Handle<string>*>(h) );
+}
+
+void Backend::block_get_( const string& cid
+                        , const OpOptions& opts
+                        , function<void(sys::error_code, string)> cb)
+{
+    assert(!cid.empty());
+
+    // Only raw blocks read the same as with `cat`, so only those may share
+    // the cache with it.
+    bool cacheable = is_raw_block(cid);
+
+    if (opts.from_cache) *opts.from_cache = false;
+
+    if (cacheable) {
+        if (auto data = _impl->find_cached(cid)) {
+            if (opts.from_cache) *opts.from_cache = true;
+            set_no_cancel(opts);
+            _impl->ios.post([cb = move(cb), data = move(data)] {
+                    cb(sys::error_code(), *data);
+                });
+            return;
+        }
+    }
+
+    auto cb_ = [impl = _impl, cid, cacheable, cb = move(cb)]
+               (sys::error_code ec, string data) {
+        if (!ec && cacheable) impl->insert_cached(cid, data);
+        cb(ec, move(data));
+    };
+
+    auto h  = new Handle<string>{_impl, move(cb_)};
+    auto op = start_op(*_impl, opts, *h, OpKind::block_get);
+
+    go_ipfs_cache_block_get( (char*) cid.data()
+                           , op.id, op.timeout_ms
+                           , (void*) Handle<string>::call_data
+                           , (void*) h );
+}
+
+bool Backend::is_raw_block(const string& cid)
+{
+    // Version 1 CIDs with the raw codec and a sha2-256 hash, in the base58
+    // (what go-ipfs produces) and base32 encodings.
+    return cid.compare(0, 3, "zb2") == 0 || cid.compare(0, 4, "bafk") == 0;
+}
+
+void Backend::cat_( const string& ipfs_id
+                  , const OpOptions& opts
+                  , function<void(sys::error_code, string)> cb)
+{
+    assert(!ipfs_id.empty());
+
+    if (opts.from_cache) *opts.from_cache = false;
+
+    if (auto data = _impl->find_cached(ipfs_id)) {
+        if (opts.from_cache) *opts.from_cache = true;
+        set_no_cancel(opts);
+        _impl->ios.post([cb = move(cb), data = move(data)] {
+                cb(sys::error_code(), *data);
+            });
+        return;
+    }
+
+    auto cb_ = [impl = _impl, ipfs_id, cb = move(cb)]
+               (sys::error_code ec, string data) {
+        if (!ec) impl->insert_cached(ipfs_id, data);
+        cb(ec, move(data));
+    };
+
+    auto h  = new Handle<string>{_impl, move(cb_)};
+    auto op = start_op(*_impl, opts, *h, OpKind::cat);
 
     go_ipfs_cache_cat( (char*) ipfs_id.data()
+                     , op.id, op.timeout_ms
                      , (void*) Handle<string>::call_data
-                     , (void*) new Handle<string>{_impl, move(cb)} );
+                     , (void*) h );
 }
 
-void Backend::pin_(const string& cid, std::function<void(sys::error_code)> cb)
+void Backend::cat_open_( const string& cid
+                       , const OpOptions& opts
+                       , function<void(sys::error_code, uint64_t)> cb)
 {
-    assert(cid.size() == CID_SIZE);
+    assert(!cid.empty());
+
+    auto h  = new Handle<uint64_t>{_impl, move(cb)};
+    auto op = start_op(*_impl, opts, *h, OpKind::cat_open);
+
+    go_ipfs_cache_cat_open( (char*) cid.data()
+                          , op.id, op.timeout_ms
+                          , (void*) Handle<uint64_t>::call_uint64
+                          , (void*) h );
+}
+
+void Backend::read_( uint64_t reader_id
+                   , size_t max_size
+                   , const OpOptions& opts
+                   , function<void(sys::error_code, string)> cb)
+{
+    assert(max_size > 0);
+
+    auto h  = new ReadHandle(_impl, move(cb), max_size);
+    auto op = start_op(*_impl, opts, *h, OpKind::read);
+
+    go_ipfs_cache_read( reader_id
+                      , (void*) &h->buffer[0]
+                      , max_size
+                      , op.id, op.timeout_ms
+                      , (void*) ReadHandle::call_read
+                      , (void*) static_cast<Handle<string>*>(h) );
+}
+
+void Backend::seek_( uint64_t reader_id
+                   , uint64_t offset
+                   , const OpOptions& opts
+                   , function<void(sys::error_code, uint64_t)> cb)
+{
+    auto h  = new Handle<uint64_t>{_impl, move(cb)};
+    auto op = start_op(*_impl, opts, *h, OpKind::seek);
+
+    go_ipfs_cache_seek( reader_id
+                      , offset
+                      , op.id, op.timeout_ms
+                      , (void*) Handle<uint64_t>::call_uint64
+                      , (void*) h );
+}
+
+uint64_t Backend::reader_size(uint64_t reader_id)
+{
+    return go_ipfs_cache_reader_size(reader_id);
+}
+
+void Backend::cat_close(uint64_t reader_id)
+{
+    go_ipfs_cache_cat_close(reader_id);
+}
+
+void Backend::pin_( const string& cid
+                  , const OpOptions& opts
+                  , std::function<void(sys::error_code)> cb)
+{
+    assert(!cid.empty());
+
+    auto h  = new Handle<>{_impl, move(cb)};
+    auto op = start_op(*_impl, opts, *h, OpKind::pin);
 
     go_ipfs_cache_pin( (char*) cid.data()
+                     , op.id, op.timeout_ms
                      , (void*) Handle<>::call_void
-                     , (void*) new Handle<>{_impl, move(cb)});
+                     , (void*) h);
 }
 
-void Backend::unpin_(const string& cid, std::function<void(sys::error_code)> cb)
+void Backend::unpin_( const string& cid
+                    , const OpOptions& opts
+                    , std::function<void(sys::error_code)> cb)
 {
-    assert(cid.size() == CID_SIZE);
+    assert(!cid.empty());
+
+    auto h  = new Handle<>{_impl, move(cb)};
+    auto op = start_op(*_impl, opts, *h, OpKind::unpin);
 
     go_ipfs_cache_unpin( (char*) cid.data()
+                       , op.id, op.timeout_ms
                        , (void*) Handle<>::call_void
-                       , (void*) new Handle<>{_impl, move(cb)});
+                       , (void*) h);
+}
+
+void Backend::cat_many_( const vector<string>& cids
+                       , const OpOptions& opts
+                       , OnItems cb)
+{
+    if (cids.empty()) {
+        return _impl->ios.post([cb = move(cb)] { cb(sys::error_code(), {}); });
+    }
+
+    auto cb_ = [impl = _impl, cids, cb = move(cb)]
+               (sys::error_code ec, vector<ItemResult> items) {
+        for (size_t i = 0; !ec && i < items.size(); ++i) {
+            if (items[i].ec) continue;
+            impl->insert_cached(cids[i], items[i].value);
+        }
+        cb(ec, move(items));
+    };
+
+    using H = BatchHandle<ItemResult>;
+    auto h  = new H(_impl, move(cb_));
+    auto op = start_op(*_impl, opts, *h, OpKind::cat_many);
+
+    with_c_strings(cids, [&] (void* strs, size_t count) {
+            go_ipfs_cache_cat_many( strs, count
+                                  , op.id, op.timeout_ms
+                                  , (void*) H::call_batch
+                                  , (void*) static_cast<H::Base*>(h));
+        });
+}
+
+void Backend::add_many_( vector<string> contents
+                       , const OpOptions& opts
+                       , OnItems cb)
+{
+    if (contents.empty()) {
+        return _impl->ios.post([cb = move(cb)] { cb(sys::error_code(), {}); });
+    }
+
+    using H = BatchHandle<ItemResult>;
+    auto h  = new H(_impl, move(cb), move(contents));
+    auto op = start_op(*_impl, opts, *h, OpKind::add_many, total_size(h->buffers));
+
+    go_ipfs_cache_add_many( (void*) h->data.data()
+                          , (void*) h->sizes.data()
+                          , h->data.size()
+                          , op.id, op.timeout_ms
+                          , (void*) H::call_batch
+                          , (void*) static_cast<H::Base*>(h));
+}
+
+void Backend::pin_many_( const vector<string>& cids
+                       , const OpOptions& opts
+                       , OnErrors cb)
+{
+    if (cids.empty()) {
+        return _impl->ios.post([cb = move(cb)] { cb(sys::error_code(), {}); });
+    }
+
+    using H = BatchHandle<sys::error_code>;
+    auto h  = new H(_impl, move(cb));
+    auto op = start_op(*_impl, opts, *h, OpKind::pin_many);
+
+    with_c_strings(cids, [&] (void* strs, size_t count) {
+            go_ipfs_cache_pin_many( strs, count
+                                  , op.id, op.timeout_ms
+                                  , (void*) H::call_batch
+                                  , (void*) static_cast<H::Base*>(h));
+        });
+}
+
+void Backend::unpin_many_( const vector<string>& cids
+                         , const OpOptions& opts
+                         , OnErrors cb)
+{
+    if (cids.empty()) {
+        return _impl->ios.post([cb = move(cb)] { cb(sys::error_code(), {}); });
+    }
+
+    using H = BatchHandle<sys::error_code>;
+    auto h  = new H(_impl, move(cb));
+    auto op = start_op(*_impl, opts, *h, OpKind::unpin_many);
+
+    with_c_strings(cids, [&] (void* strs, size_t count) {
+            go_ipfs_cache_unpin_many( strs, count
+                                    , op.id, op.timeout_ms
+                                    , (void*) H::call_batch
+                                    , (void*) static_cast<H::Base*>(h));
+        });
+}
+
+void Backend::set_block_cache_size(size_t max_size)
+{
+    lock_guard<mutex> lock(_impl->block_cache_mutex);
+    _impl->block_cache.set_max_size(max_size);
+}
+
+size_t Backend::block_cache_size() const
+{
+    lock_guard<mutex> lock(_impl->block_cache_mutex);
+    return _impl->block_cache.max_size();
+}
+
+shared_ptr<const string> Backend::find_cached(const string& cid)
+{
+    return _impl->find_cached(cid);
+}
+
+void Backend::insert_cached(const string& cid, string data)
+{
+    _impl->insert_cached(cid, make_shared<const string>(move(data)));
+}
+
+size_t Backend::max_cached_size() const
+{
+    lock_guard<mutex> lock(_impl->block_cache_mutex);
+    return _impl->block_cache.max_item_size();
+}
+
+ResolveCache& Backend::resolve_cache()
+{
+    return *_impl->resolve_cache;
+}
+
+Metrics Backend::metrics() const
+{
+    auto m = _impl->metrics.snapshot();
+
+    lock_guard<mutex> lock(_impl->block_cache_mutex);
+    auto& s = _impl->block_cache.stats();
+    auto& c = m.caches["block"];
+
+    c.hits       = s.hits;
+    c.misses     = s.misses;
+    c.insertions = s.insertions;
+    c.evictions  = s.evictions;
+    c.size       = s.size;
+    c.count      = s.count;
+
+    return m;
 }
 
 boost::asio::io_service& Backend::get_io_service()
@@ -198,19 +1124,23 @@ Backend::~Backend()
 {
     if (!_impl) return; // Was moved from.
 
-    lock_guard<mutex> guard(_impl->destruct_mutex);
     _impl->was_destroyed = true;
 
+    // Go threads which didn't notice the above flag may still be pushing
+    // into the completion queue, wait for them so that they don't touch
+    // handles cancelled below.
+    while (_impl->completing) this_thread::yield();
+
+    lock_guard<mutex> lock(_impl->handles_mutex);
+
     // Make sure all handlers get completed.
     for (auto i = _impl->handles.begin(); i != _impl->handles.end();) {
         auto j = std::next(i);
-
-        auto h = &(*i);
-        h->cancel();
-        h->unlink();
-
+        i->cancel();
         i = j;
     }
 
+    _impl->work = boost::none;
+
     go_ipfs_cache_stop();
 }
@@ -3,11 +3,16 @@
 #include <string>
 #include <functional>
 #include <memory>
+#include <vector>
 #include <boost/asio/steady_timer.hpp>
 #include <boost/asio/spawn.hpp>
 #include <boost/system/error_code.hpp>
 
+#include <ipfs_cache/metrics.h>
+
+#include "cid.h"
 #include "namespaces.h"
+#include "dispatch.h"
 
 namespace boost { namespace asio {
     class io_service;
@@ -16,7 +21,12 @@ namespace boost { namespace asio {
 namespace ipfs_cache {
 
 struct BackendImpl;
+class ResolveCache;
 
+// The io_service may be run by any number of threads. Operations may be
+// started from any of them and their completion handlers are invoked
+// through the handlers' asio_handler_invoke hooks, so coroutines are
+// resumed on their own strands.
 class Backend {
     using Timer = boost::asio::steady_timer;
 
@@ -29,7 +39,39 @@ class Backend {
     using Result = typename asio::async_result<Handler<Token, Ret...>>;
 
 public:
-    static const uint32_t CID_SIZE = 46;
+    // See cid.h.
+    static const uint32_t CID_SIZE = CID_V0_SIZE;
+    static const size_t DEFAULT_BLOCK_CACHE_SIZE = 16 * 1024 * 1024;
+
+    // Per item result of a batched operation.
+    struct ItemResult {
+        boost::system::error_code ec;
+        std::string value;
+    };
+
+    // Every operation below may be given these options. Operations which
+    // aren't given any run until IPFS finishes them or until the Backend is
+    // destroyed.
+    struct OpOptions {
+        // If non zero, the operation (including the work IPFS does for it)
+        // is aborted with asio::error::timed_out once this time passes.
+        Timer::duration timeout = Timer::duration(0);
+
+        // If set, the pointed-to function is assigned when the operation
+        // starts. Calling it aborts the operation with
+        // asio::error::operation_aborted, once the operation is over calling
+        // it has no effect.
+        std::function<void()>* cancel = nullptr;
+
+        // If set, `cat` and `block_get` set the pointed-to flag to whether
+        // the result is served from the block cache. This is done before
+        // they return or yield.
+        bool* from_cache = nullptr;
+
+        // `resolve` doesn't use resolutions cached longer than this, e.g.
+        // when polling for new records at this interval.
+        Timer::duration max_cache_age = Timer::duration::max();
+    };
 
 public:
     // This constructor may do repository initialization disk IO and as such
@@ -51,34 +93,256 @@ public:
     // Returns the IPNS CID of the database.
     std::string ipns_id() const;
 
+    // Convenience functions, these copy the data into a std::string which
+    // is then handed over as below.
     template<class Token>
     typename Result<Token, std::string>::type
     add(const uint8_t* data, size_t size, Token&&);
 
     template<class Token>
     typename Result<Token, std::string>::type
-    add(const std::string&, Token&&); // Convenience function.
+    add(const std::string&, Token&&);
+
+    // Only these avoid copying: they take ownership of the data and keep it
+    // alive until the Go side is done with it. The vector ones add the
+    // concatenation of `buffers` as a single piece of content (pass it as
+    // an rvalue, a copied vector copies its buffers).
+    template<class Token>
+    typename Result<Token, std::string>::type
+    add(std::string&&, Token&&);
+
+    template<class Token>
+    typename Result<Token, std::string>::type
+    add(std::vector<std::string> buffers, Token&&);
+
+    template<class Token>
+    typename Result<Token, std::string>::type
+    add(std::string&&, const OpOptions&, Token&&);
+
+    template<class Token>
+    typename Result<Token, std::string>::type
+    add(std::vector<std::string> buffers, const OpOptions&, Token&&);
+
+    // Streaming counterpart of `add`, for content too big to be held in
+    // memory at once. The `add_open` function returns an id of a writer to
+    // which the content is then pushed with `write` in chunks. Each `write`
+    // completes once IPFS has consumed the chunk, so only the chunk being
+    // written needs to be in memory. The `add_close` function ends the
+    // content and returns its CID. A writer which isn't closed must be
+    // released with `add_abort`. A timeout or cancellation of `write` or
+    // `add_close` aborts the whole add.
+    template<class Token>
+    typename Result<Token, uint64_t>::type
+    add_open(Token&&);
+
+    template<class Token>
+    typename Result<Token, uint64_t>::type
+    add_open(const OpOptions&, Token&&);
+
+    template<class Token>
+    void
+    write(uint64_t writer_id, std::string chunk, Token&&);
+
+    template<class Token>
+    void
+    write(uint64_t writer_id, std::string chunk, const OpOptions&, Token&&);
+
+    template<class Token>
+    typename Result<Token, std::string>::type
+    add_close(uint64_t writer_id, Token&&);
+
+    template<class Token>
+    typename Result<Token, std::string>::type
+    add_close(uint64_t writer_id, const OpOptions&, Token&&);
+
+    // This is static so that writers may be released even after the Backend
+    // has been destroyed.
+    static void add_abort(uint64_t writer_id);
+
+    // Stores `data` as an IPFS object which links to the `links` CIDs, so
+    // that pinning the object also pins everything reachable from it. The
+    // data is read back with `cat`.
+    template<class Token>
+    typename Result<Token, std::string>::type
+    add_object( std::string data
+              , const std::vector<std::string>& links
+              , Token&&);
+
+    template<class Token>
+    typename Result<Token, std::string>::type
+    add_object( std::string data
+              , const std::vector<std::string>& links
+              , const OpOptions&
+              , Token&&);
+
+    // Stores `data` as a single raw block, bypassing the UnixFS import. The
+    // returned CID is a hash of the data itself.
+    template<class Token>
+    typename Result<Token, std::string>::type
+    block_put(std::string data, Token&&);
+
+    template<class Token>
+    typename Result<Token, std::string>::type
+    block_put(std::string data, const OpOptions&, Token&&);
+
+    // Returns the content of a block as it is stored. For raw blocks that is
+    // what was given to `block_put` (and what `cat` would return).
+    template<class Token>
+    typename Result<Token, std::string>::type
+    block_get(const std::string& cid, Token&&);
+
+    template<class Token>
+    typename Result<Token, std::string>::type
+    block_get(const std::string& cid, const OpOptions&, Token&&);
+
+    // Whether `cid` is a CID of a raw block as returned by `block_put`.
+    static bool is_raw_block(const std::string& cid);
 
     template<class Token>
     typename Result<Token, std::string>::type
     cat(const std::string& cid, Token&&);
 
+    template<class Token>
+    typename Result<Token, std::string>::type
+    cat(const std::string& cid, const OpOptions&, Token&&);
+
+    // Streaming counterpart of `cat`. The `cat_open` function returns an id
+    // of a reader from which the content is then pulled with `read` in chunks
+    // of at most `max_size` bytes. An empty chunk marks the end of data.
+    // Each opened reader must be released with `cat_close`.
+    template<class Token>
+    typename Result<Token, uint64_t>::type
+    cat_open(const std::string& cid, Token&&);
+
+    template<class Token>
+    typename Result<Token, uint64_t>::type
+    cat_open(const std::string& cid, const OpOptions&, Token&&);
+
+    template<class Token>
+    typename Result<Token, std::string>::type
+    read(uint64_t reader_id, size_t max_size, Token&&);
+
+    template<class Token>
+    typename Result<Token, std::string>::type
+    read(uint64_t reader_id, size_t max_size, const OpOptions&, Token&&);
+
+    // Moves the reader to `offset` bytes from the start of the content and
+    // returns the new offset, which is the size of the content if `offset`
+    // is past its end. Blocks before the offset are not fetched.
+    template<class Token>
+    typename Result<Token, uint64_t>::type
+    seek(uint64_t reader_id, uint64_t offset, Token&&);
+
+    template<class Token>
+    typename Result<Token, uint64_t>::type
+    seek(uint64_t reader_id, uint64_t offset, const OpOptions&, Token&&);
+
+    // Size of the whole content of an opened reader.
+    static uint64_t reader_size(uint64_t reader_id);
+
+    // This is static so that readers may be released even after the Backend
+    // has been destroyed.
+    static void cat_close(uint64_t reader_id);
+
     template<class Token>
     void
     publish( const std::string& cid, Timer::duration, Token&&);
 
+    template<class Token>
+    void
+    publish( const std::string& cid, Timer::duration, const OpOptions&, Token&&);
+
+    // Results are cached in `resolve_cache`, a cached result is returned
+    // right away and if it is stale a new resolution is started in the
+    // background. Concurrent resolutions of the same IPNS id share a single
+    // lookup, which runs with the timeout of the call that started it.
     template<class Token>
     typename Result<Token, std::string>::type
     resolve(const std::string& ipns_id, Token&&);
 
+    template<class Token>
+    typename Result<Token, std::string>::type
+    resolve(const std::string& ipns_id, const OpOptions&, Token&&);
+
     template<class Token>
     void
     pin(const std::string& cid, Token&&);
 
+    template<class Token>
+    void
+    pin(const std::string& cid, const OpOptions&, Token&&);
+
     template<class Token>
     void
     unpin(const std::string& cid, Token&&);
 
+    template<class Token>
+    void
+    unpin(const std::string& cid, const OpOptions&, Token&&);
+
+    // Batched variants of `cat`, `add`, `pin` and `unpin`. The whole batch is
+    // handed over to IPFS at once and completes with a single callback which
+    // carries per item results in the order of the input. The error passed
+    // to the callback itself only signals a failure of the whole batch (e.g.
+    // cancellation), errors of individual items are found in the results.
+    template<class Token>
+    typename Result<Token, std::vector<ItemResult>>::type
+    cat_many(const std::vector<std::string>& cids, Token&&);
+
+    template<class Token>
+    typename Result<Token, std::vector<ItemResult>>::type
+    cat_many(const std::vector<std::string>& cids, const OpOptions&, Token&&);
+
+    // Each of the `contents` is added as a separate piece of content, the
+    // resulting CIDs are in ItemResult::value.
+    template<class Token>
+    typename Result<Token, std::vector<ItemResult>>::type
+    add_many(std::vector<std::string> contents, Token&&);
+
+    template<class Token>
+    typename Result<Token, std::vector<ItemResult>>::type
+    add_many(std::vector<std::string> contents, const OpOptions&, Token&&);
+
+    template<class Token>
+    typename Result<Token, std::vector<boost::system::error_code>>::type
+    pin_many(const std::vector<std::string>& cids, Token&&);
+
+    template<class Token>
+    typename Result<Token, std::vector<boost::system::error_code>>::type
+    pin_many(const std::vector<std::string>& cids, const OpOptions&, Token&&);
+
+    template<class Token>
+    typename Result<Token, std::vector<boost::system::error_code>>::type
+    unpin_many(const std::vector<std::string>& cids, Token&&);
+
+    template<class Token>
+    typename Result<Token, std::vector<boost::system::error_code>>::type
+    unpin_many(const std::vector<std::string>& cids, const OpOptions&, Token&&);
+
+    // Content returned by `cat` and `cat_many` is kept in an in memory cache
+    // (see BlockCache) of at most this many bytes so that repeated fetches
+    // of the same CID (e.g. database nodes or popular content) don't have to
+    // go through IPFS. May be called while operations are in flight. The
+    // statistics of the cache are in `metrics().caches["block"]`.
+    void set_block_cache_size(size_t);
+    size_t block_cache_size() const;
+
+    // Let content streamed with `cat_open` and `read` share the block cache
+    // with `cat`: `find_cached` doesn't go to IPFS and returns nullptr if
+    // the content isn't cached (the data is shared with the cache, not
+    // copied), `insert_cached` keeps content which was read whole. Content
+    // bigger than `max_cached_size()` is not kept.
+    std::shared_ptr<const std::string> find_cached(const std::string& cid);
+    void insert_cached(const std::string& cid, std::string data);
+    size_t max_cached_size() const;
+
+    // By default this is ResolveCache::shared(), i.e. resolutions are shared
+    // with other Backends in the process.
+    ResolveCache& resolve_cache();
+
+    // Statistics of the operations done through this Backend so far.
+    Metrics metrics() const;
+
     boost::asio::io_service& get_io_service();
 
     ~Backend();
@@ -87,30 +351,107 @@ private:
     Backend(std::shared_ptr<BackendImpl>);
 
 private:
+    // Completion handlers are invoked from whichever thread happens to
+    // collect the completions, this makes them run the way asio would run
+    // them (e.g. resume coroutines on their own strands).
+    template<class... Ret, class H>
+    static
+    std::function<void(boost::system::error_code, Ret...)> wrap(H handler) {
+        return wrap_handler<boost::system::error_code, Ret...>(std::move(handler));
+    }
+
+    // Turns the started BackendImpl into a Backend on the handler's side.
+    template<class H>
+    struct BuildHandler {
+        H handler;
+
+        void operator()( boost::system::error_code ec
+                       , std::shared_ptr<BackendImpl> impl) {
+            handler(ec, std::unique_ptr<Backend>(new Backend(std::move(impl))));
+        }
+
+        template<class F>
+        friend void asio_handler_invoke(F& f, BuildHandler* self) {
+            boost_asio_handler_invoke_helpers::invoke(f, self->handler);
+        }
+    };
+
     static
     void build_( boost::asio::io_service& ios
                , const std::string& repo_path
-               , std::function<void( const boost::system::error_code&
-                                   , std::unique_ptr<Backend>)>);
+               , std::function<void( boost::system::error_code
+                                   , std::shared_ptr<BackendImpl>)>);
 
-    void add_( const uint8_t* data, size_t size
+    void add_( std::vector<std::string> buffers
+             , const OpOptions&
              , std::function<void(boost::system::error_code, std::string)>);
 
+    void add_object_( std::string data
+                    , const std::vector<std::string>& links
+                    , const OpOptions&
+                    , std::function<void(boost::system::error_code, std::string)>);
+
+    void block_put_( std::string data
+                   , const OpOptions&
+                   , std::function<void(boost::system::error_code, std::string)>);
+
+    void block_get_( const std::string& cid
+                   , const OpOptions&
+                   , std::function<void(boost::system::error_code, std::string)>);
+
     void cat_( const std::string& cid
+             , const OpOptions&
              , std::function<void(boost::system::error_code, std::string)>);
 
+    void add_open_( const OpOptions&
+                  , std::function<void(boost::system::error_code, uint64_t)>);
+
+    void write_( uint64_t writer_id, std::string chunk
+               , const OpOptions&
+               , std::function<void(boost::system::error_code)>);
+
+    void add_close_( uint64_t writer_id
+                   , const OpOptions&
+                   , std::function<void(boost::system::error_code, std::string)>);
+
+    void cat_open_( const std::string& cid
+                  , const OpOptions&
+                  , std::function<void(boost::system::error_code, uint64_t)>);
+
+    void read_( uint64_t reader_id, size_t max_size
+              , const OpOptions&
+              , std::function<void(boost::system::error_code, std::string)>);
+
+    void seek_( uint64_t reader_id, uint64_t offset
+              , const OpOptions&
+              , std::function<void(boost::system::error_code, uint64_t)>);
+
     void publish_( const std::string& cid, Timer::duration
+                 , const OpOptions&
                  , std::function<void(boost::system::error_code)>);
 
     void resolve_( const std::string& ipns_id
+                 , const OpOptions&
                  , std::function<void(boost::system::error_code, std::string)>);
 
     void pin_( const std::string& cid
+             , const OpOptions&
              , std::function<void(boost::system::error_code)>);
 
     void unpin_( const std::string& cid
+               , const OpOptions&
                , std::function<void(boost::system::error_code)>);
 
+    using OnItems  = std::function<void( boost::system::error_code
+                                       , std::vector<ItemResult>)>;
+    using OnErrors = std::function<void( boost::system::error_code
+                                       , std::vector<boost::system::error_code>)>;
+
+    void cat_many_(const std::vector<std::string>& cids, const OpOptions&, OnItems);
+    void add_many_(std::vector<std::string> contents, const OpOptions&, OnItems);
+    void pin_many_(const std::vector<std::string>& cids, const OpOptions&, OnErrors);
+    void unpin_many_(const std::vector<std::string>& cids, const OpOptions&, OnErrors);
+
 private:
     std::shared_ptr<BackendImpl> _impl;
 };
@@ -124,79 +465,400 @@ Backend::build( boost::asio::io_service& ios
     using BackendP = std::unique_ptr<Backend>;
     Handler<Token, BackendP> handler(std::forward<Token>(token));
     Result<Token, BackendP> result(handler);
-    build_(ios, repo_path, std::move(handler));
+    build_( ios, repo_path
+          , wrap<std::shared_ptr<BackendImpl>>(
+              BuildHandler<Handler<Token, BackendP>>{std::move(handler)}));
     return result.get();
 }
 
 template<class Token>
 typename Backend::Result<Token, std::string>::type
 Backend::add(const uint8_t* data, size_t size, Token&& token)
+{
+    return add( std::string(reinterpret_cast<const char*>(data), size)
+              , std::forward<Token>(token));
+}
+
+template<class Token>
+typename Backend::Result<Token, std::string>::type
+Backend::add(const std::string& data, Token&& token)
+{
+    return add(std::string(data), std::forward<Token>(token));
+}
+
+template<class Token>
+typename Backend::Result<Token, std::string>::type
+Backend::add(std::string&& data, Token&& token)
+{
+    return add(std::move(data), OpOptions(), std::forward<Token>(token));
+}
+
+template<class Token>
+typename Backend::Result<Token, std::string>::type
+Backend::add(std::vector<std::string> buffers, Token&& token)
+{
+    return add(std::move(buffers), OpOptions(), std::forward<Token>(token));
+}
+
+template<class Token>
+typename Backend::Result<Token, std::string>::type
+Backend::add(std::string&& data, const OpOptions& opts, Token&& token)
+{
+    std::vector<std::string> buffers;
+    buffers.push_back(std::move(data));
+    return add(std::move(buffers), opts, std::forward<Token>(token));
+}
+
+template<class Token>
+typename Backend::Result<Token, std::string>::type
+Backend::add( std::vector<std::string> buffers
+            , const OpOptions& opts
+            , Token&& token)
 {
     Handler<Token, std::string> handler(std::forward<Token>(token));
     Result<Token, std::string> result(handler);
-    add_(data, size, std::move(handler));
+    add_(std::move(buffers), opts, wrap<std::string>(std::move(handler)));
     return result.get();
 }
 
 template<class Token>
 typename Backend::Result<Token, std::string>::type
-Backend::add(const std::string& data, Token&& token)
+Backend::add_object( std::string data
+                   , const std::vector<std::string>& links
+                   , Token&& token)
+{
+    return add_object( std::move(data), links, OpOptions()
+                     , std::forward<Token>(token));
+}
+
+template<class Token>
+typename Backend::Result<Token, std::string>::type
+Backend::add_object( std::string data
+                   , const std::vector<std::string>& links
+                   , const OpOptions& opts
+                   , Token&& token)
 {
     Handler<Token, std::string> handler(std::forward<Token>(token));
     Result<Token, std::string> result(handler);
-    add_( reinterpret_cast<const uint8_t*>(data.c_str())
-        , data.size()
-        , std::move(handler));
+    add_object_( std::move(data), links, opts
+               , wrap<std::string>(std::move(handler)));
+    return result.get();
+}
+
+template<class Token>
+typename Backend::Result<Token, std::string>::type
+Backend::block_put(std::string data, Token&& token)
+{
+    return block_put(std::move(data), OpOptions(), std::forward<Token>(token));
+}
+
+template<class Token>
+typename Backend::Result<Token, std::string>::type
+Backend::block_put(std::string data, const OpOptions& opts, Token&& token)
+{
+    Handler<Token, std::string> handler(std::forward<Token>(token));
+    Result<Token, std::string> result(handler);
+    block_put_(std::move(data), opts, wrap<std::string>(std::move(handler)));
+    return result.get();
+}
+
+template<class Token>
+typename Backend::Result<Token, std::string>::type
+Backend::block_get(const std::string& cid, Token&& token)
+{
+    return block_get(cid, OpOptions(), std::forward<Token>(token));
+}
+
+template<class Token>
+typename Backend::Result<Token, std::string>::type
+Backend::block_get( const std::string& cid
+                  , const OpOptions& opts
+                  , Token&& token)
+{
+    Handler<Token, std::string> handler(std::forward<Token>(token));
+    Result<Token, std::string> result(handler);
+    block_get_(cid, opts, wrap<std::string>(std::move(handler)));
     return result.get();
 }
 
 template<class Token>
 typename Backend::Result<Token, std::string>::type
 Backend::cat(const std::string& cid, Token&& token)
+{
+    return cat(cid, OpOptions(), std::forward<Token>(token));
+}
+
+template<class Token>
+typename Backend::Result<Token, std::string>::type
+Backend::cat(const std::string& cid, const OpOptions& opts, Token&& token)
 {
     Handler<Token, std::string> handler(std::forward<Token>(token));
     Result<Token, std::string> result(handler);
-    cat_(cid, std::move(handler));
+    cat_(cid, opts, wrap<std::string>(std::move(handler)));
+    return result.get();
+}
+
+template<class Token>
+typename Backend::Result<Token, uint64_t>::type
+Backend::add_open(Token&& token)
+{
+    return add_open(OpOptions(), std::forward<Token>(token));
+}
+
+template<class Token>
+typename Backend::Result<Token, uint64_t>::type
+Backend::add_open(const OpOptions& opts, Token&& token)
+{
+    Handler<Token, uint64_t> handler(std::forward<Token>(token));
+    Result<Token, uint64_t> result(handler);
+    add_open_(opts, wrap<uint64_t>(std::move(handler)));
+    return result.get();
+}
+
+template<class Token>
+void
+Backend::write(uint64_t writer_id, std::string chunk, Token&& token)
+{
+    return write(writer_id, std::move(chunk), OpOptions(), std::forward<Token>(token));
+}
+
+template<class Token>
+void
+Backend::write( uint64_t writer_id
+              , std::string chunk
+              , const OpOptions& opts
+              , Token&& token)
+{
+    Handler<Token> handler(std::forward<Token>(token));
+    Result<Token> result(handler);
+    write_(writer_id, std::move(chunk), opts, wrap<>(std::move(handler)));
+    return result.get();
+}
+
+template<class Token>
+typename Backend::Result<Token, std::string>::type
+Backend::add_close(uint64_t writer_id, Token&& token)
+{
+    return add_close(writer_id, OpOptions(), std::forward<Token>(token));
+}
+
+template<class Token>
+typename Backend::Result<Token, std::string>::type
+Backend::add_close(uint64_t writer_id, const OpOptions& opts, Token&& token)
+{
+    Handler<Token, std::string> handler(std::forward<Token>(token));
+    Result<Token, std::string> result(handler);
+    add_close_(writer_id, opts, wrap<std::string>(std::move(handler)));
+    return result.get();
+}
+
+template<class Token>
+typename Backend::Result<Token, uint64_t>::type
+Backend::cat_open(const std::string& cid, Token&& token)
+{
+    return cat_open(cid, OpOptions(), std::forward<Token>(token));
+}
+
+template<class Token>
+typename Backend::Result<Token, uint64_t>::type
+Backend::cat_open(const std::string& cid, const OpOptions& opts, Token&& token)
+{
+    Handler<Token, uint64_t> handler(std::forward<Token>(token));
+    Result<Token, uint64_t> result(handler);
+    cat_open_(cid, opts, wrap<uint64_t>(std::move(handler)));
+    return result.get();
+}
+
+template<class Token>
+typename Backend::Result<Token, std::string>::type
+Backend::read(uint64_t reader_id, size_t max_size, Token&& token)
+{
+    return read(reader_id, max_size, OpOptions(), std::forward<Token>(token));
+}
+
+template<class Token>
+typename Backend::Result<Token, std::string>::type
+Backend::read( uint64_t reader_id
+             , size_t max_size
+             , const OpOptions& opts
+             , Token&& token)
+{
+    Handler<Token, std::string> handler(std::forward<Token>(token));
+    Result<Token, std::string> result(handler);
+    read_(reader_id, max_size, opts, wrap<std::string>(std::move(handler)));
+    return result.get();
+}
+
+template<class Token>
+typename Backend::Result<Token, uint64_t>::type
+Backend::seek(uint64_t reader_id, uint64_t offset, Token&& token)
+{
+    return seek(reader_id, offset, OpOptions(), std::forward<Token>(token));
+}
+
+template<class Token>
+typename Backend::Result<Token, uint64_t>::type
+Backend::seek( uint64_t reader_id
+             , uint64_t offset
+             , const OpOptions& opts
+             , Token&& token)
+{
+    Handler<Token, uint64_t> handler(std::forward<Token>(token));
+    Result<Token, uint64_t> result(handler);
+    seek_(reader_id, offset, opts, wrap<uint64_t>(std::move(handler)));
     return result.get();
 }
 
 template<class Token>
 void
 Backend::publish(const std::string& cid, Timer::duration d, Token&& token)
+{
+    return publish(cid, d, OpOptions(), std::forward<Token>(token));
+}
+
+template<class Token>
+void
+Backend::publish( const std::string& cid
+                , Timer::duration d
+                , const OpOptions& opts
+                , Token&& token)
 {
     Handler<Token> handler(std::forward<Token>(token));
     Result<Token> result(handler);
-    publish_(cid, d, std::move(handler));
+    publish_(cid, d, opts, wrap<>(std::move(handler)));
     return result.get();
 }
 
 template<class Token>
 typename Backend::Result<Token, std::string>::type
 Backend::resolve(const std::string& ipns_id, Token&& token)
+{
+    return resolve(ipns_id, OpOptions(), std::forward<Token>(token));
+}
+
+template<class Token>
+typename Backend::Result<Token, std::string>::type
+Backend::resolve( const std::string& ipns_id
+                , const OpOptions& opts
+                , Token&& token)
 {
     Handler<Token, std::string> handler(std::forward<Token>(token));
     Result<Token, std::string> result(handler);
-    resolve_(ipns_id, std::move(handler));
+    resolve_(ipns_id, opts, wrap<std::string>(std::move(handler)));
     return result.get();
 }
 
 template<class Token>
 void
 Backend::pin(const std::string& cid, Token&& token)
+{
+    return pin(cid, OpOptions(), std::forward<Token>(token));
+}
+
+template<class Token>
+void
+Backend::pin(const std::string& cid, const OpOptions& opts, Token&& token)
 {
     Handler<Token> handler(std::forward<Token>(token));
     Result<Token> result(handler);
-    pin_(cid, std::move(handler));
+    pin_(cid, opts, wrap<>(std::move(handler)));
     return result.get();
 }
 
 template<class Token>
 void
 Backend::unpin(const std::string& cid, Token&& token)
+{
+    return unpin(cid, OpOptions(), std::forward<Token>(token));
+}
+
+template<class Token>
+void
+Backend::unpin(const std::string& cid, const OpOptions& opts, Token&& token)
 {
     Handler<Token> handler(std::forward<Token>(token));
     Result<Token> result(handler);
-    unpin_(cid, std::move(handler));
+    unpin_(cid, opts, wrap<>(std::move(handler)));
+    return result.get();
+}
+
+template<class Token>
+typename Backend::Result<Token, std::vector<Backend::ItemResult>>::type
+Backend::cat_many(const std::vector<std::string>& cids, Token&& token)
+{
+    return cat_many(cids, OpOptions(), std::forward<Token>(token));
+}
+
+template<class Token>
+typename Backend::Result<Token, std::vector<Backend::ItemResult>>::type
+Backend::cat_many( const std::vector<std::string>& cids
+                 , const OpOptions& opts
+                 , Token&& token)
+{
+    Handler<Token, std::vector<ItemResult>> handler(std::forward<Token>(token));
+    Result<Token, std::vector<ItemResult>> result(handler);
+    cat_many_( cids, opts
+             , wrap<std::vector<ItemResult>>(std::move(handler)));
+    return result.get();
+}
+
+template<class Token>
+typename Backend::Result<Token, std::vector<Backend::ItemResult>>::type
+Backend::add_many(std::vector<std::string> contents, Token&& token)
+{
+    return add_many(std::move(contents), OpOptions(), std::forward<Token>(token));
+}
+
+template<class Token>
+typename Backend::Result<Token, std::vector<Backend::ItemResult>>::type
+Backend::add_many( std::vector<std::string> contents
+                 , const OpOptions& opts
+                 , Token&& token)
+{
+    Handler<Token, std::vector<ItemResult>> handler(std::forward<Token>(token));
+    Result<Token, std::vector<ItemResult>> result(handler);
+    add_many_( std::move(contents), opts
+             , wrap<std::vector<ItemResult>>(std::move(handler)));
+    return result.get();
+}
+
+template<class Token>
+typename Backend::Result<Token, std::vector<boost::system::error_code>>::type
+Backend::pin_many(const std::vector<std::string>& cids, Token&& token)
+{
+    return pin_many(cids, OpOptions(), std::forward<Token>(token));
+}
+
+template<class Token>
+typename Backend::Result<Token, std::vector<boost::system::error_code>>::type
+Backend::pin_many( const std::vector<std::string>& cids
+                 , const OpOptions& opts
+                 , Token&& token)
+{
+    using Errors = std::vector<boost::system::error_code>;
+    Handler<Token, Errors> handler(std::forward<Token>(token));
+    Result<Token, Errors> result(handler);
+    pin_many_(cids, opts, wrap<Errors>(std::move(handler)));
+    return result.get();
+}
+
+template<class Token>
+typename Backend::Result<Token, std::vector<boost::system::error_code>>::type
+Backend::unpin_many(const std::vector<std::string>& cids, Token&& token)
+{
+    return unpin_many(cids, OpOptions(), std::forward<Token>(token));
+}
+
+template<class Token>
+typename Backend::Result<Token, std::vector<boost::system::error_code>>::type
+Backend::unpin_many( const std::vector<std::string>& cids
+                   , const OpOptions& opts
+                   , Token&& token)
+{
+    using Errors = std::vector<boost::system::error_code>;
+    Handler<Token, Errors> handler(std::forward<Token>(token));
+    Result<Token, Errors> result(handler);
+    unpin_many_(cids, opts, wrap<Errors>(std::move(handler)));
     return result.get();
 }
 
@@ -0,0 +1,105 @@
+#include "block_cache.h"
+
+using namespace std;
+using namespace ipfs_cache;
+
+// Fraction of the cache the protected segment may occupy.
+static const unsigned PROTECTED_PERCENT = 80;
+
+// Items bigger than 1/MAX_ITEM_FRACTION of the cache are not admitted.
+static const unsigned MAX_ITEM_FRACTION = 8;
+
+BlockCache::BlockCache(size_t max_size)
+    : _max_size(max_size)
+{}
+
+size_t BlockCache::max_protected_size() const
+{
+    return _max_size / 100 * PROTECTED_PERCENT;
+}
+
+BlockCache::Data BlockCache::find(const string& cid)
+{
+    auto i = _index.find(cid);
+
+    if (i == _index.end()) {
+        ++_stats.misses;
+        return nullptr;
+    }
+
+    ++_stats.hits;
+
+    auto li = i->second;
+
+    if (li->segment == protect) {
+        _protected.splice(_protected.begin(), _protected, li);
+        return li->data;
+    }
+
+    // Second hit, promote to the protected segment.
+    li->segment = protect;
+    _protected_size += li->data->size();
+    _protected.splice(_protected.begin(), _probation, li);
+
+    // Demote least recently used protected items back to probation.
+    while (_protected_size > max_protected_size() && _protected.size() > 1) {
+        auto last = std::prev(_protected.end());
+        last->segment = probation;
+        _protected_size -= last->data->size();
+        _probation.splice(_probation.begin(), _protected, last);
+    }
+
+    return li->data;
+}
+
+size_t BlockCache::max_item_size() const
+{
+    return _max_size / MAX_ITEM_FRACTION;
+}
+
+void BlockCache::insert(const string& cid, string data)
+{
+    if (data.size() > max_item_size()) return;
+    insert(cid, make_shared<const string>(move(data)));
+}
+
+void BlockCache::insert(const string& cid, Data data)
+{
+    if (data->size() > max_item_size()) return;
+    if (_index.count(cid)) return; // Content under a CID never changes.
+
+    evict_to(_max_size - data->size());
+
+    _stats.size += data->size();
+    ++_stats.count;
+    ++_stats.insertions;
+
+    _probation.push_front(Item{cid, move(data), probation});
+    _index.emplace(cid, _probation.begin());
+}
+
+void BlockCache::set_max_size(size_t max_size)
+{
+    _max_size = max_size;
+    evict_to(max_size);
+}
+
+void BlockCache::evict_to(size_t max_size)
+{
+    while (_stats.size > max_size) {
+        auto& l = _probation.empty() ? _protected : _probation;
+
+        auto last = std::prev(l.end());
+
+        if (last->segment == protect) {
+            _protected_size -= last->data->size();
+        }
+
+        _stats.size -= last->data->size();
+        --_stats.count;
+        ++_stats.evictions;
+
+        _index.erase(last->cid);
+        l.erase(last);
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace ipfs_cache {
+
+/*
+ * In memory cache of immutable IPFS content indexed by its CID. The total
+ * size of cached data is bounded by `max_size` bytes.
+ *
+ * To avoid a single scan over many rarely used items (e.g. a bulk download)
+ * flushing out the popular ones, the cache is a segmented LRU: new items
+ * enter a "probationary" segment and are only promoted to the "protected"
+ * segment once they are hit again. Eviction always starts with the
+ * probationary segment.
+ */
+class BlockCache {
+public:
+    // Shared, so that hits don't copy the data and it stays valid after
+    // the item is evicted.
+    using Data = std::shared_ptr<const std::string>;
+
+    struct Stats {
+        uint64_t hits       = 0;
+        uint64_t misses     = 0;
+        uint64_t insertions = 0;
+        uint64_t evictions  = 0;
+        size_t   size       = 0; // Bytes currently cached.
+        size_t   count      = 0; // Items currently cached.
+    };
+
+public:
+    BlockCache(size_t max_size);
+
+    BlockCache(const BlockCache&) = delete;
+    BlockCache& operator=(const BlockCache&) = delete;
+
+    // Returns nullptr if the item isn't cached.
+    Data find(const std::string& cid);
+
+    // Items bigger than `max_item_size()` are not admitted.
+    void insert(const std::string& cid, Data data);
+    void insert(const std::string& cid, std::string data);
+
+    // A fraction of `max_size`.
+    size_t max_item_size() const;
+
+    void set_max_size(size_t);
+    size_t max_size() const { return _max_size; }
+
+    const Stats& stats() const { return _stats; }
+
+private:
+    enum Segment { probation, protect };
+
+    struct Item {
+        std::string cid;
+        Data data;
+        Segment segment;
+    };
+
+    using List = std::list<Item>;
+
+    size_t max_protected_size() const;
+
+    void evict_to(size_t max_size);
+
+private:
+    size_t _max_size;
+    size_t _protected_size = 0;
+    List _probation;
+    List _protected;
+    std::unordered_map<std::string, List::iterator> _index;
+    Stats _stats;
+};
+
+} // ipfs_cache namespace
@@ -1,7 +1,9 @@
 #include "btree.h"
 #include "or_throw.h"
+#include "encoding.h"
 #include <json.hpp>
 #include <iostream>
+#include <algorithm>
 
 using namespace ipfs_cache;
 
@@ -48,7 +50,7 @@ public:
     void assert_every_node_has_hash() const;
 
     boost::optional<Node> insert(Key, Value, asio::yield_context);
-    Value find(const Key&, const CatOp&, asio::yield_context);
+    Value find(const Key&, const CatOp&, const OnParse&, asio::yield_context);
     boost::optional<Node> split(std::shared_ptr<bool>&, asio::yield_context);
 
     size_t size() const;
@@ -57,7 +59,7 @@ public:
     typename Entries::iterator find_or_create_lower_bound(const Key&);
 
     Hash store(const AddOp&, asio::yield_context);
-    void restore(Hash, const CatOp&, asio::yield_context);
+    void restore(Hash, const CatOp&, const OnParse&, asio::yield_context);
 
     size_t local_node_count() const;
 
@@ -299,6 +301,7 @@ boost::optional<Node> Node::split( std::shared_ptr<bool>& was_destroyed
 
 Value Node::find( const Key& key
                 , const CatOp& cat_op
+                , const OnParse& on_parse
                 , asio::yield_context yield)
 {
     auto i = Entries::lower_bound(key);
@@ -313,7 +316,9 @@ Value Node::find( const Key& key
         return e.value;
     }
     else {
-        if (!e.child) {
+        auto child = _tree->loaded(e.child);
+
+        if (!child) {
             if (e.child_hash.empty()) {
                 return or_throw<Value>(yield, asio::error::not_found);
             }
@@ -322,10 +327,11 @@ Value Node::find( const Key& key
                                    , e.child
                                    , key
                                    , cat_op
+                                   , on_parse
                                    , yield);
         }
 
-        return e.child->find(key, cat_op, yield);
+        return child->find(key, cat_op, on_parse, yield);
     }
 }
 
@@ -387,6 +393,14 @@ bool Node::check_invariants() const {
     return true;
 }
 
+// Whether the string can be stored in JSON without escaping (most of) it.
+static bool is_text(const std::string& s)
+{
+    return std::all_of(s.begin(), s.end(), [] (char c) {
+            return c >= 0x20 && c <= 0x7e;
+        });
+}
+
 Hash Node::store(const AddOp& add_op, asio::yield_context yield)
 {
     assert(add_op);
@@ -394,13 +408,17 @@ Hash Node::store(const AddOp& add_op, asio::yield_context yield)
     auto d = _tree->_was_destroyed;
 
     Json json;
+    std::vector<Hash> children;
 
     for (auto& p : *this) {
         const char* k = p.first ? p.first->c_str() : "";
         auto &e = p.second;
 
         if (p.first) {
-            json[k]["value"] = e.value;
+            // Binary values (see IndexEntry) would be escaped byte by byte
+            // as JSON strings, base64 is much more compact.
+            if (is_text(e.value)) json[k]["value"] = e.value;
+            else                  json[k]["b"]     = base64_encode(e.value);
         }
 
         if (!e.child_hash.empty()) {
@@ -418,13 +436,18 @@ Hash Node::store(const AddOp& add_op, asio::yield_context yield)
 
             json[k]["child"] = e.child_hash;
         }
+
+        if (!e.child_hash.empty()) children.push_back(e.child_hash);
     }
 
     assert_every_node_has_hash();
-    return add_op(json.dump(), yield);
+    return add_op(json.dump(), children, yield);
 }
 
-void Node::restore(Hash hash, const CatOp& cat_op, asio::yield_context yield)
+void Node::restore( Hash hash
+                  , const CatOp& cat_op
+                  , const OnParse& on_parse
+                  , asio::yield_context yield)
 {
     auto d = _tree->_was_destroyed;
 
@@ -434,6 +457,13 @@ void Node::restore(Hash hash, const CatOp& cat_op, asio::yield_context yield)
     if (!ec && *d) ec = asio::error::operation_aborted;
     if (ec) return or_throw(yield, ec);
 
+    auto parse_start = std::chrono::steady_clock::now();
+
+    auto on_exit = defer([&] {
+            if (!on_parse) return;
+            on_parse(hash, std::chrono::steady_clock::now() - parse_start);
+        });
+
     try {
         auto json = Json::parse(data);
 
@@ -461,6 +491,11 @@ void Node::restore(Hash hash, const CatOp& cat_op, asio::yield_context yield)
             if (v["value"].is_string()) {
                 value = move(v["value"]);
             }
+            else if (v["b"].is_string()) {
+                auto decoded = base64_decode(v["b"].get<std::string>());
+                if (!decoded) return or_throw(yield, asio::error::bad_descriptor);
+                value = move(*decoded);
+            }
             Entries::insert(make_pair( key
                                      , Entry{ move(value)
                                             , nullptr
@@ -503,30 +538,61 @@ BTree::lazy_find( const Hash& hash
                 , std::unique_ptr<Node>& n
                 , const Key& key
                 , const CatOp& cat_op
+                , const OnParse& on_parse
                 , asio::yield_context yield)
 {
-    if (!n) {
+    auto node = loaded(n);
+
+    if (!node) {
         if (hash.empty()) {
             return or_throw<Value>(yield, asio::error::not_found);
         }
         else {
-            n.reset(new Node(this));
+            // Restored outside of the lock, so that lookups on other
+            // threads parse their nodes meanwhile.
+            std::unique_ptr<Node> restored(new Node(this));
 
             auto d = _was_destroyed;
 
             sys::error_code ec;
-            n->restore(hash, cat_op, yield[ec]);
+            restored->restore(hash, cat_op, on_parse, yield[ec]);
 
             if (!ec && *d) ec = asio::error::operation_aborted;
             if (ec) return or_throw<Value>(yield, ec);
+
+            node = install(n, std::move(restored));
         }
     }
 
-    return n->find(key, cat_op, yield);
+    return node->find(key, cat_op, on_parse, yield);
+}
+
+Node* BTree::loaded(const std::unique_ptr<Node>& n) const
+{
+    std::lock_guard<std::mutex> lock(_nodes_mutex);
+    return n.get();
+}
+
+// Another lookup may have loaded the same node in the meantime, then that
+// one is kept.
+Node* BTree::install(std::unique_ptr<Node>& n, std::unique_ptr<Node> node)
+{
+    std::lock_guard<std::mutex> lock(_nodes_mutex);
+    if (!n) n = std::move(node);
+    return n.get();
 }
 
 Value
 BTree::find(const Key& key, asio::yield_context yield)
+{
+    return find(key, _cat_op, nullptr, yield);
+}
+
+Value
+BTree::find( const Key& key
+           , CatOp cat_op
+           , OnParse on_parse
+           , asio::yield_context yield)
 {
     auto i = _insert_buffer.find(key);
 
@@ -539,7 +605,7 @@ BTree::find(const Key& key, asio::yield_context yield)
     // Copying `_root` into `root` prevents the _root->hash and _root->node
     // from being destroyed in case the user calls BTree::load
     auto root = _root;
-    return lazy_find(root->hash, root->node, key, CatOp(_cat_op), yield);
+    return lazy_find(root->hash, root->node, key, cat_op, on_parse, yield);
 }
 
 void BTree::raw_insert(Key key, Value value, asio::yield_context yield)
@@ -621,6 +687,49 @@ void BTree::load(Hash hash, asio::yield_context yield) {
     _root->hash = move(hash);
 }
 
+void BTree::warm(unsigned levels, asio::yield_context yield)
+{
+    if (!_root || levels == 0) return;
+
+    // See BTree::find for why the root is copied.
+    auto root = _root;
+    warm(root->hash, root->node, levels, yield);
+}
+
+void BTree::warm( const Hash& hash
+                , std::unique_ptr<Node>& n
+                , unsigned levels
+                , asio::yield_context yield)
+{
+    auto d = _was_destroyed;
+    sys::error_code ec;
+
+    auto node = loaded(n);
+
+    if (!node) {
+        if (hash.empty()) return;
+
+        std::unique_ptr<Node> restored(new Node(this));
+        restored->restore(hash, _cat_op, nullptr, yield[ec]);
+
+        if (!ec && *d) ec = asio::error::operation_aborted;
+        if (ec) return or_throw(yield, ec);
+
+        node = install(n, std::move(restored));
+    }
+
+    if (levels <= 1) return;
+
+    for (auto& kv : *node) {
+        auto& e = kv.second;
+
+        warm(e.child_hash, e.child, levels - 1, yield[ec]);
+
+        if (!ec && *d) ec = asio::error::operation_aborted;
+        if (ec) return or_throw(yield, ec);
+    }
+}
+
 void BTree::try_remove(Hash& h, asio::yield_context yield)
 {
     if (h.empty()) return;
@@ -2,8 +2,11 @@
 
 #include <boost/optional.hpp>
 #include <boost/asio/spawn.hpp>
+#include <chrono>
 #include <memory>
 #include <map>
+#include <mutex>
+#include <vector>
 #include <iostream>
 #include "namespaces.h"
 #include "defer.h"
@@ -17,9 +20,17 @@ public:
     using Hash  = std::string;
 
     using CatOp    = std::function<Value(const Hash&,  asio::yield_context)>;
-    using AddOp    = std::function<Hash (const Value&, asio::yield_context)>;
+    // Besides the serialized node, AddOp is given the hashes of the node's
+    // children so that the storage may link the node to them.
+    using AddOp    = std::function<Hash ( const Value&
+                                        , const std::vector<Hash>& children
+                                        , asio::yield_context)>;
     using RemoveOp = std::function<void (const Hash&,  asio::yield_context)>;
 
+    // Told how long parsing of a node loaded from storage took.
+    using OnParse  = std::function<void( const Hash&
+                                       , std::chrono::steady_clock::duration)>;
+
     struct Node; // public, but opaque
 
 public:
@@ -28,8 +39,15 @@ public:
          , RemoveOp = nullptr
          , size_t max_node_size = 512);
 
+    // Lookups (and `warm`) may run on several threads at once as long as
+    // nothing is inserted into the tree meanwhile.
     Value find(const Key&, asio::yield_context);
 
+    // Same as above, but nodes which aren't loaded yet are fetched with
+    // `cat_op` instead of the one the tree was constructed with, and
+    // `on_parse` (if set) is called for each of them. Used for tracing.
+    Value find(const Key&, CatOp cat_op, OnParse on_parse, asio::yield_context);
+
     void insert(Key, Value, asio::yield_context);
 
     bool check_invariants() const;
@@ -41,6 +59,11 @@ public:
 
     void load(Hash, asio::yield_context);
 
+    // Fetches the nodes of the top `levels` levels of the tree (the root
+    // being the first level) which aren't loaded yet, so that lookups don't
+    // wait for them. Fails if any of them can't be fetched or parsed.
+    void warm(unsigned levels, asio::yield_context);
+
     ~BTree();
 
     void debug(bool v) { _debug = v; }
@@ -54,10 +77,21 @@ private:
                    , std::unique_ptr<Node>&
                    , const Key&
                    , const CatOp&
+                   , const OnParse&
                    , asio::yield_context);
 
+    void warm( const Hash&
+             , std::unique_ptr<Node>&
+             , unsigned levels
+             , asio::yield_context);
+
     void try_remove(Hash&, asio::yield_context);
 
+    // Nodes loaded by lookups are installed under `_nodes_mutex`, once there
+    // they don't change until the next insert.
+    Node* loaded(const std::unique_ptr<Node>&) const;
+    Node* install(std::unique_ptr<Node>&, std::unique_ptr<Node>);
+
 private:
     size_t _max_node_size;
 
@@ -77,6 +111,8 @@ private:
 
     std::shared_ptr<bool> _was_destroyed;
 
+    mutable std::mutex _nodes_mutex;
+
     bool _debug = false;
 };
 
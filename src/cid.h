@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+
+namespace ipfs_cache {
+
+// Size of version 0 CIDs (those of UnixFS content and objects). CIDs of raw
+// blocks (see Backend::block_put) are longer.
+static const uint32_t CID_V0_SIZE = 46;
+
+} // ipfs_cache namespace
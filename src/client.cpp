@@ -2,9 +2,11 @@
 #include <ipfs_cache/error.h>
 
 #include "backend.h"
+#include "content_cache.h"
 #include "db.h"
 #include "get_content.h"
 #include "or_throw.h"
+#include "single_flight.h"
 
 using namespace std;
 using namespace ipfs_cache;
@@ -12,6 +14,21 @@ using namespace ipfs_cache;
 namespace asio = boost::asio;
 namespace sys  = boost::system;
 
+const size_t Client::DEFAULT_CONTENT_CACHE_SIZE;
+
+static string content_cache_dir(const string& path_to_repo)
+{
+    return path_to_repo + "/ipfs_cache_content";
+}
+
+// Lookups and fetches in progress, see `get_shared_content`.
+struct Client::Flights {
+    SingleFlight<string, shared_ptr<CachedContent>> by_url;
+    SingleFlight<string, shared_ptr<string>>        by_cid;
+
+    Flights(asio::io_service& ios) : by_url(ios), by_cid(ios) {}
+};
+
 unique_ptr<Client> Client::build( asio::io_service& ios
                                 , string ipns
                                 , string path_to_repo
@@ -47,6 +64,9 @@ Client::Client(Backend backend, string ipns, string path_to_repo)
     : _path_to_repo(move(path_to_repo))
     , _backend(new Backend(move(backend)))
     , _db(new ClientDb(*_backend, _path_to_repo, ipns))
+    , _content_cache(new ContentCache( content_cache_dir(_path_to_repo)
+                                     , DEFAULT_CONTENT_CACHE_SIZE))
+    , _flights(new Flights(_backend->get_io_service()))
 {
 }
 
@@ -54,6 +74,9 @@ Client::Client(boost::asio::io_service& ios, string ipns, string path_to_repo)
     : _path_to_repo(move(path_to_repo))
     , _backend(new Backend(ios, _path_to_repo))
     , _db(new ClientDb(*_backend, _path_to_repo, ipns))
+    , _content_cache(new ContentCache( content_cache_dir(_path_to_repo)
+                                     , DEFAULT_CONTENT_CACHE_SIZE))
+    , _flights(new Flights(_backend->get_io_service()))
 {
 }
 
@@ -64,7 +87,105 @@ string Client::ipfs_add(const string& data, asio::yield_context yield)
 
 CachedContent Client::get_content(string url, asio::yield_context yield)
 {
-    return ipfs_cache::get_content(*_db, url, yield);
+    sys::error_code ec;
+
+    auto content = fetch_shared_content(move(url), yield[ec]);
+
+    if (ec) return or_throw<CachedContent>(yield, ec);
+
+    // No concurrent caller got it too.
+    if (content.use_count() == 1) return move(*content);
+
+    return *content;
+}
+
+shared_ptr<const CachedContent>
+Client::get_shared_content(string url, asio::yield_context yield)
+{
+    return fetch_shared_content(move(url), yield);
+}
+
+shared_ptr<CachedContent>
+Client::fetch_shared_content(string url, asio::yield_context yield)
+{
+    using Content = shared_ptr<CachedContent>;
+
+    auto& flights = *_flights;
+    auto& db      = *_db;
+    auto  cache   = _content_cache.get();
+
+    return flights.by_url.run(url, [&] (asio::yield_context yield) {
+            sys::error_code ec;
+
+            auto entry = query_content_entry(db, url, nullptr, yield[ec]);
+
+            if (ec) return or_throw<Content>(yield, ec);
+
+            auto data = flights.by_cid.run(entry.cid, [&] (asio::yield_context yield) {
+                    sys::error_code ec;
+                    string s = cat_content( db, entry.cid, cache, nullptr
+                                          , yield[ec]);
+                    return or_throw(yield, ec, make_shared<string>(move(s)));
+                }
+                , yield[ec]);
+
+            if (ec) return or_throw<Content>(yield, ec);
+
+            auto content = make_shared<CachedContent>();
+
+            content->ts           = entry.ts;
+            content->content_type = move(entry.content_type);
+            content->size         = data->size();
+
+            // Other URLs of the same content may be fetched concurrently.
+            if (data.use_count() == 1) content->data = move(*data);
+            else                       content->data = *data;
+
+            return content;
+        }
+        , yield);
+}
+
+CachedContent Client::get_content( string url
+                                 , const OnChunk& on_chunk
+                                 , asio::yield_context yield)
+{
+    return ipfs_cache::get_content(*_db, url, on_chunk, nullptr, yield);
+}
+
+CachedContent Client::get_content( string url
+                                 , LookupTrace& trace
+                                 , asio::yield_context yield)
+{
+    return ipfs_cache::get_content( *_db, url, &trace
+                                  , _content_cache.get(), yield);
+}
+
+CachedContent Client::get_content( string url
+                                 , const OnChunk& on_chunk
+                                 , LookupTrace& trace
+                                 , asio::yield_context yield)
+{
+    return ipfs_cache::get_content(*_db, url, on_chunk, &trace, yield);
+}
+
+CachedContent Client::get_content_range( string url
+                                       , uint64_t offset
+                                       , uint64_t length
+                                       , asio::yield_context yield)
+{
+    return ipfs_cache::get_content_range( *_db, url, offset, length
+                                        , nullptr, yield);
+}
+
+CachedContent Client::get_content_range( string url
+                                       , uint64_t offset
+                                       , uint64_t length
+                                       , const OnChunk& on_chunk
+                                       , asio::yield_context yield)
+{
+    return ipfs_cache::get_content_range( *_db, url, offset, length
+                                        , on_chunk, nullptr, yield);
 }
 
 void Client::wait_for_db_update(boost::asio::yield_context yield)
@@ -72,9 +193,24 @@ void Client::wait_for_db_update(boost::asio::yield_context yield)
     _db->wait_for_db_update(yield);
 }
 
-void Client::set_ipns(std::string ipns)
+void Client::wait_for_db(boost::asio::yield_context yield)
+{
+    _db->wait_for_stage(Stage::local_snapshot, yield);
+}
+
+void Client::wait_for_stage(Stage stage, boost::asio::yield_context yield)
 {
-    _db.reset(new ClientDb(*_backend, _path_to_repo, move(ipns)));
+    _db->wait_for_stage(stage, yield);
+}
+
+Client::Stage Client::stage() const
+{
+    return _db->stage();
+}
+
+void Client::set_ipns(std::string ipns, boost::asio::yield_context yield)
+{
+    _db->set_ipns(move(ipns), yield);
 }
 
 std::string Client::id() const
@@ -82,12 +218,35 @@ std::string Client::id() const
     return _backend->ipns_id();
 }
 
-const string& Client::ipns() const
+void Client::set_content_cache_size(size_t size)
+{
+    _content_cache->set_max_size(size);
+}
+
+Metrics Client::metrics() const
+{
+    auto m = _backend->metrics();
+
+    auto s = _content_cache->stats();
+    auto& c = m.caches["content"];
+
+    c.hits       = s.hits;
+    c.misses     = s.misses;
+    c.insertions = s.insertions;
+    c.rejections = s.rejections;
+    c.evictions  = s.evictions;
+    c.size       = s.size;
+    c.count      = s.count;
+
+    return m;
+}
+
+string Client::ipns() const
 {
     return _db->ipns();
 }
 
-const string& Client::ipfs() const
+string Client::ipfs() const
 {
     return _db->ipfs();
 }
@@ -100,12 +259,16 @@ const string& Client::ipfs() const
 Client::Client(Client&& other)
     : _backend(move(other._backend))
     , _db(move(other._db))
+    , _content_cache(move(other._content_cache))
+    , _flights(move(other._flights))
 {}
 
 Client& Client::operator=(Client&& other)
 {
     _backend = move(other._backend);
     _db = move(other._db);
+    _content_cache = move(other._content_cache);
+    _flights = move(other._flights);
     return *this;
 }
 
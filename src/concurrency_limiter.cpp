@@ -0,0 +1,73 @@
+#include "concurrency_limiter.h"
+
+#include <algorithm>
+
+using namespace std;
+using namespace ipfs_cache;
+
+ConcurrencyLimiter::ConcurrencyLimiter()
+    : ConcurrencyLimiter(Options())
+{
+}
+
+ConcurrencyLimiter::ConcurrencyLimiter(Options options)
+    : _options(options)
+{
+    _options.min = max(1u, _options.min);
+    _options.max = max(_options.min, _options.max);
+    _limit = min(max(_options.initial, _options.min), _options.max);
+}
+
+ConcurrencyLimiter::Op ConcurrencyLimiter::start(size_t bytes, Clock::time_point now)
+{
+    ++_in_flight;
+    return Op{now, bytes, _in_flight * 2 >= limit()};
+}
+
+void ConcurrencyLimiter::finish(const Op& op, Outcome outcome, Clock::time_point now)
+{
+    using namespace std::chrono;
+
+    --_in_flight;
+
+    if (outcome == Outcome::ignored) return;
+    if (outcome == Outcome::overloaded) return decrease(op, now);
+
+    double us = max<double>(1, duration_cast<microseconds>(now - op.started).count());
+
+    auto& baseline = _baseline_us[size_class(op.bytes)];
+
+    if (baseline == 0 || us < baseline) {
+        baseline = us;
+    }
+    else {
+        baseline += (us - baseline) / 64;
+    }
+
+    if (us > baseline * _options.tolerance) {
+        return decrease(op, now);
+    }
+
+    if (!op.at_limit || limit() >= _options.max) return;
+
+    auto old = limit();
+    _limit = min<double>(_options.max, _limit + 1 / _limit);
+    if (limit() != old) ++_increases;
+}
+
+void ConcurrencyLimiter::decrease(const Op& op, Clock::time_point now)
+{
+    // This round was already answered for.
+    if (op.started < _last_decrease) return;
+
+    _last_decrease = now;
+
+    auto old = limit();
+    _limit = max<double>(_options.min, _limit * _options.backoff);
+    if (limit() != old) ++_decreases;
+}
+
+unsigned ConcurrencyLimiter::size_class(size_t bytes)
+{
+    return bytes ? 64 - __builtin_clzll(bytes) - 1 : 0;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+namespace ipfs_cache {
+
+/*
+ * Adaptive limit on the number of concurrent operations (AIMD, as in TCP
+ * congestion control). While operations complete in about the time they
+ * take on an idle node the limit grows by one per limit's worth of such
+ * completions; once they take more than `tolerance` times that, or fail
+ * with a timeout, the limit is multiplied by `backoff`. At most one
+ * decrease is made per round of operations, i.e. operations started before
+ * the last decrease don't cause another one.
+ *
+ * The idle time (baseline) is tracked separately for each power of two
+ * range of operation sizes, so that large operations don't make the small
+ * ones look fast (and vice versa). It follows the fastest samples and
+ * slowly drifts towards the others, so that a node which became lastingly
+ * slower doesn't keep the limit at the floor.
+ *
+ * The limiter is not thread safe.
+ */
+class ConcurrencyLimiter {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        unsigned min      = 1;
+        unsigned max      = 64;
+        unsigned initial  = 8;
+        double tolerance  = 2;
+        double backoff    = 0.75;
+    };
+
+    // Returned from `start` and passed back to `finish`.
+    struct Op {
+        Clock::time_point started;
+        size_t bytes;
+        // Whether the operation was started with at least half of the
+        // limit in use, only such operations show whether the limit may
+        // grow.
+        bool at_limit;
+    };
+
+    enum class Outcome {
+        // Completed (successfully or not) in a time saying something about
+        // the load of the node.
+        done,
+        // Failed because the node is overloaded (e.g. timed out).
+        overloaded,
+        // Says nothing about the load (e.g. canceled).
+        ignored
+    };
+
+public:
+    ConcurrencyLimiter();
+    explicit ConcurrencyLimiter(Options);
+
+    bool can_start() const { return _in_flight < limit(); }
+
+    Op start(size_t bytes, Clock::time_point now = Clock::now());
+
+    void finish(const Op&, Outcome, Clock::time_point now = Clock::now());
+
+    unsigned limit() const { return unsigned(_limit); }
+    unsigned in_flight() const { return _in_flight; }
+
+    uint64_t increases() const { return _increases; }
+    uint64_t decreases() const { return _decreases; }
+
+    const Options& options() const { return _options; }
+
+private:
+    void decrease(const Op&, Clock::time_point now);
+
+    static unsigned size_class(size_t bytes);
+
+private:
+    Options _options;
+    double _limit;
+    unsigned _in_flight = 0;
+    Clock::time_point _last_decrease;
+    // Baseline latency in microseconds by size class, zero if unknown.
+    std::array<double, 64> _baseline_us{};
+    uint64_t _increases = 0;
+    uint64_t _decreases = 0;
+};
+
+} // ipfs_cache namespace
@@ -0,0 +1,364 @@
+#include "content_cache.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <functional>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace ipfs_cache;
+
+const unsigned FrequencySketch::DEPTH;
+const uint8_t  FrequencySketch::MAX_COUNT;
+
+// Items bigger than 1/MAX_ITEM_FRACTION of the cache are not admitted.
+static const unsigned MAX_ITEM_FRACTION = 8;
+
+// Counters per row of the frequency sketch.
+static const size_t SKETCH_WIDTH = 16 * 1024;
+
+// Files being written are given names with this prefix, leftovers of
+// writes interrupted by a crash are removed on load.
+static const char TMP_PREFIX[] = ".tmp.";
+
+FrequencySketch::FrequencySketch(size_t width)
+{
+    size_t w = 1;
+    while (w < width) w <<= 1;
+
+    _mask = w - 1;
+    _sample_size = 10 * w;
+
+    for (auto& row : _rows) row.assign(w, 0);
+}
+
+size_t FrequencySketch::index(size_t hash, unsigned row) const
+{
+    static const uint64_t SEEDS[DEPTH] = { 0xc3a5c85c97cb3127ull
+                                         , 0xb492b66fbe98f273ull
+                                         , 0x9ae16a3b2f90404full
+                                         , 0xcbf29ce484222325ull };
+
+    uint64_t h = (uint64_t(hash) + row) * SEEDS[row];
+    return size_t(h ^ (h >> 32)) & _mask;
+}
+
+void FrequencySketch::record(const string& key)
+{
+    auto hash = std::hash<string>()(key);
+
+    for (unsigned r = 0; r < DEPTH; ++r) {
+        auto& c = _rows[r][index(hash, r)];
+        if (c < MAX_COUNT) ++c;
+    }
+
+    if (++_recorded >= _sample_size) age();
+}
+
+unsigned FrequencySketch::estimate(const string& key) const
+{
+    auto hash = std::hash<string>()(key);
+    unsigned result = MAX_COUNT;
+
+    for (unsigned r = 0; r < DEPTH; ++r) {
+        result = min<unsigned>(result, _rows[r][index(hash, r)]);
+    }
+
+    return result;
+}
+
+void FrequencySketch::age()
+{
+    for (auto& row : _rows) {
+        for (auto& c : row) c >>= 1;
+    }
+
+    _recorded /= 2;
+}
+
+ContentCache::ContentCache(string dir, size_t max_size)
+    : _dir(move(dir))
+    , _max_size(max_size)
+    , _sketch(SKETCH_WIDTH)
+{
+    load();
+}
+
+string ContentCache::path(const string& cid) const
+{
+    return _dir + "/" + cid;
+}
+
+// Reads the whole file, which must be `data.size()` bytes long.
+static bool read_file(int fd, string& data)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || uint64_t(st.st_size) != data.size()) {
+        return false;
+    }
+
+    size_t done = 0;
+
+    while (done < data.size()) {
+        auto n = ::read(fd, &data[done], data.size() - done);
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+
+        done += n;
+    }
+
+    return true;
+}
+
+// The data is on the disk once this returns true, so that a crash can't
+// leave a truncated file behind the name it's renamed to.
+static bool write_file(const string& path, boost::string_view data)
+{
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) return false;
+
+    bool ok = true;
+    size_t done = 0;
+
+    while (ok && done < data.size()) {
+        auto n = ::write(fd, data.data() + done, data.size() - done);
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) ok = false;
+        else done += n;
+    }
+
+    if (ok) ok = (fsync(fd) == 0);
+    if (::close(fd) != 0) ok = false;
+
+    return ok;
+}
+
+boost::optional<string> ContentCache::find(const string& cid)
+{
+    int fd = -1;
+    size_t size = 0;
+
+    {
+        lock_guard<mutex> lock(_mutex);
+
+        _sketch.record(cid);
+
+        auto i = _index.find(cid);
+
+        if (i != _index.end()) {
+            // Opened under the lock so that the file isn't evicted in
+            // between, once opened it stays readable even if it is.
+            fd = ::open(path(cid).c_str(), O_RDONLY);
+
+            if (fd == -1) {
+                // Removed by someone else.
+                drop(cid);
+            }
+            else {
+                size = i->second->size;
+                _lru.splice(_lru.begin(), _lru, i->second);
+            }
+        }
+
+        if (fd == -1) {
+            ++_stats.misses;
+            return boost::none;
+        }
+    }
+
+    string data(size, '\0');
+    bool ok = read_file(fd, data);
+
+    // The eviction order is restored from the modification times on load.
+    if (ok) futimens(fd, nullptr);
+
+    ::close(fd);
+
+    lock_guard<mutex> lock(_mutex);
+
+    if (!ok) {
+        if (_index.count(cid)) {
+            remove(path(cid).c_str());
+            drop(cid);
+        }
+
+        ++_stats.misses;
+        return boost::none;
+    }
+
+    ++_stats.hits;
+
+    return data;
+}
+
+bool ContentCache::admit(const string& cid, size_t size)
+{
+    if (_stats.size + size <= _max_size) return true;
+
+    auto freq = _sketch.estimate(cid);
+    size_t freed = 0;
+
+    for (auto i = _lru.rbegin(); i != _lru.rend(); ++i) {
+        if (_stats.size - freed + size <= _max_size) break;
+        if (_sketch.estimate(i->cid) >= freq) return false;
+        freed += i->size;
+    }
+
+    return true;
+}
+
+bool ContentCache::insert(const string& cid, boost::string_view data)
+{
+    string tmp_path;
+
+    {
+        lock_guard<mutex> lock(_mutex);
+
+        // Content under a CID never changes.
+        if (_index.count(cid)) return false;
+
+        bool valid_name = !cid.empty() && cid[0] != '.'
+                       && cid.find('/') == string::npos;
+
+        if (!valid_name || data.size() > _max_size / MAX_ITEM_FRACTION
+            || !admit(cid, data.size())) {
+            ++_stats.rejections;
+            return false;
+        }
+
+        tmp_path = _dir + "/" + TMP_PREFIX + to_string(_next_tmp++);
+    }
+
+    if (!write_file(tmp_path, data)) {
+        remove(tmp_path.c_str());
+        return false;
+    }
+
+    lock_guard<mutex> lock(_mutex);
+
+    if (_index.count(cid) || data.size() > _max_size) {
+        remove(tmp_path.c_str());
+        return false;
+    }
+
+    evict_to(_max_size - data.size());
+
+    if (rename(tmp_path.c_str(), path(cid).c_str()) != 0) {
+        remove(tmp_path.c_str());
+        return false;
+    }
+
+    _stats.size += data.size();
+    ++_stats.count;
+    ++_stats.insertions;
+
+    _lru.push_front(Item{cid, data.size()});
+    _index.emplace(cid, _lru.begin());
+
+    return true;
+}
+
+// Forgets about the content, whose file is already gone.
+void ContentCache::drop(const string& cid)
+{
+    auto i = _index.find(cid);
+    if (i == _index.end()) return;
+
+    _stats.size -= i->second->size;
+    --_stats.count;
+
+    _lru.erase(i->second);
+    _index.erase(i);
+}
+
+void ContentCache::set_max_size(size_t max_size)
+{
+    lock_guard<mutex> lock(_mutex);
+    _max_size = max_size;
+    evict_to(max_size);
+}
+
+size_t ContentCache::max_size() const
+{
+    lock_guard<mutex> lock(_mutex);
+    return _max_size;
+}
+
+ContentCache::Stats ContentCache::stats() const
+{
+    lock_guard<mutex> lock(_mutex);
+    return _stats;
+}
+
+void ContentCache::evict_to(size_t max_size)
+{
+    while (_stats.size > max_size && !_lru.empty()) {
+        auto& item = _lru.back();
+
+        remove(path(item.cid).c_str());
+
+        _stats.size -= item.size;
+        --_stats.count;
+        ++_stats.evictions;
+
+        _index.erase(item.cid);
+        _lru.pop_back();
+    }
+}
+
+void ContentCache::load()
+{
+    mkdir(_dir.c_str(), 0755);
+
+    DIR* dir = opendir(_dir.c_str());
+    if (!dir) return;
+
+    struct File {
+        time_t mtime;
+        string cid;
+        size_t size;
+    };
+
+    vector<File> files;
+
+    while (auto entry = readdir(dir)) {
+        string name = entry->d_name;
+
+        if (name.compare(0, sizeof(TMP_PREFIX) - 1, TMP_PREFIX) == 0) {
+            remove(path(name).c_str());
+            continue;
+        }
+
+        if (name.empty() || name[0] == '.') continue;
+
+        struct stat st;
+
+        if (stat(path(name).c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+
+        files.push_back(File{st.st_mtime, move(name), size_t(st.st_size)});
+    }
+
+    closedir(dir);
+
+    sort(files.begin(), files.end(), [] (const File& a, const File& b) {
+            return a.mtime > b.mtime;
+        });
+
+    for (auto& f : files) {
+        _lru.push_back(Item{f.cid, f.size});
+        _index.emplace(move(f.cid), prev(_lru.end()));
+        _stats.size += f.size;
+        ++_stats.count;
+    }
+
+    evict_to(_max_size);
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/optional.hpp>
+#include <boost/utility/string_view.hpp>
+
+#include "work_thread.h"
+
+namespace ipfs_cache {
+
+/*
+ * Approximate counts of how often keys were seen recently (a count-min
+ * sketch of 4 bit counters). Once `sample_size` keys have been recorded all
+ * counts are halved, so that keys popular a long time ago fade out.
+ */
+class FrequencySketch {
+public:
+    static const unsigned DEPTH     = 4;
+    static const uint8_t  MAX_COUNT = 15;
+
+public:
+    // `width` is rounded up to a power of two.
+    FrequencySketch(size_t width);
+
+    void record(const std::string& key);
+    unsigned estimate(const std::string& key) const;
+
+private:
+    size_t index(size_t hash, unsigned row) const;
+    void age();
+
+private:
+    size_t _mask;
+    size_t _sample_size;
+    size_t _recorded = 0;
+    std::array<std::vector<uint8_t>, DEPTH> _rows;
+};
+
+/*
+ * Persistent cache of immutable IPFS content indexed by its CID, each
+ * content stored in a file of its own in `dir`. The total size of the files
+ * is bounded by `max_size` bytes, least recently used contents are evicted
+ * first. Files are written out to disk before they are renamed into place,
+ * and one which doesn't have the size recorded for its content (e.g. left
+ * truncated by a crash) is dropped instead of being served.
+ *
+ * Admission is frequency aware (as in TinyLFU): both hits and misses are
+ * recorded in a FrequencySketch, and a new content which would evict others
+ * is only admitted if it was asked for more often than each of them. This
+ * keeps one-off fetches (e.g. a bulk download) from flushing out the
+ * popular contents.
+ *
+ * The contents found in `dir` on construction are kept, those least
+ * recently found or inserted first in the eviction order. The cache is
+ * thread safe, file IO is done outside of its lock. Since `find` and
+ * `insert` block on file IO, coroutines call them on `io_thread()` (see
+ * `run_in_thread`).
+ */
+class ContentCache {
+public:
+    struct Stats {
+        uint64_t hits       = 0;
+        uint64_t misses     = 0;
+        uint64_t insertions = 0;
+        uint64_t rejections = 0; // Not admitted.
+        uint64_t evictions  = 0;
+        size_t   size       = 0; // Bytes currently cached.
+        size_t   count      = 0; // Items currently cached.
+    };
+
+public:
+    ContentCache(std::string dir, size_t max_size);
+
+    ContentCache(const ContentCache&) = delete;
+    ContentCache& operator=(const ContentCache&) = delete;
+
+    boost::optional<std::string> find(const std::string& cid);
+
+    // Items bigger than a fraction of `max_size` are not admitted. Returns
+    // whether the content was stored.
+    bool insert(const std::string& cid, boost::string_view data);
+
+    void set_max_size(size_t);
+    size_t max_size() const;
+
+    Stats stats() const;
+
+    WorkThread& io_thread() { return _io_thread; }
+
+private:
+    struct Item {
+        std::string cid;
+        size_t size;
+    };
+
+    using List = std::list<Item>;
+
+    std::string path(const std::string& cid) const;
+    bool admit(const std::string& cid, size_t size);
+    void drop(const std::string& cid);
+    void evict_to(size_t max_size);
+    void load();
+
+private:
+    const std::string _dir;
+    mutable std::mutex _mutex;
+    size_t _max_size;
+    // Most recently used first.
+    List _lru;
+    std::unordered_map<std::string, List::iterator> _index;
+    FrequencySketch _sketch;
+    uint64_t _next_tmp = 0;
+    Stats _stats;
+    // Last, so that jobs still posted to it are done before the rest goes.
+    WorkThread _io_thread;
+};
+
+} // ipfs_cache namespace
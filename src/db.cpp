@@ -3,6 +3,8 @@
 #include "republisher.h"
 #include "btree.h"
 #include "or_throw.h"
+#include "dispatch.h"
+#include "defer.h"
 
 #include <boost/asio/io_service.hpp>
 
@@ -15,17 +17,64 @@ using namespace std;
 using namespace ipfs_cache;
 
 static const unsigned int BTREE_NODE_SIZE=64;
+// Levels of a newly downloaded client database loaded before it replaces
+// the current one.
+static const unsigned WARM_LEVELS = 2;
+// A resolution which takes longer than this is given up and retried.
+static const chrono::seconds RESOLVE_TIMEOUT(60);
+// How often the client looks for a new database.
+static const chrono::seconds DOWNLOAD_INTERVAL(5);
+
+static string cat_node( Backend& backend
+                      , const BTree::Hash& hash
+                      , const Backend::OpOptions& opts
+                      , asio::yield_context yield)
+{
+    // Nodes stored as raw blocks are read as such, without UnixFS.
+    if (Backend::is_raw_block(hash)) {
+        return backend.block_get(hash, opts, yield);
+    }
+
+    return backend.cat(hash, opts, yield);
+}
 
 static BTree::CatOp make_cat_operation(Backend& backend)
 {
     return [&backend] (const BTree::Hash& hash, asio::yield_context yield) {
-        return backend.cat(hash, yield);
+        return cat_node(backend, hash, Backend::OpOptions(), yield);
+    };
+}
+
+// Same as above, but records the fetches in `trace`.
+static BTree::CatOp make_traced_cat_operation( Backend& backend
+                                             , LookupTrace& trace)
+{
+    return [&backend, &trace] ( const BTree::Hash& hash
+                              , asio::yield_context yield) {
+        auto span = trace.begin(LookupTrace::Step::node_fetch);
+
+        bool cached = false;
+        Backend::OpOptions opts;
+        opts.from_cache = &cached;
+
+        sys::error_code ec;
+        auto data = cat_node(backend, hash, opts, yield[ec]);
+
+        auto& s = trace.end(span);
+        s.cid       = hash;
+        s.bytes     = data.size();
+        s.cache_hit = cached;
+        s.ec        = ec;
+
+        return or_throw(yield, ec, move(data));
     };
 }
 
 static BTree::AddOp make_add_operation(Backend& backend)
 {
-    return [&backend] (const BTree::Value& value, asio::yield_context yield) {
+    return [&backend] ( const BTree::Value& value
+                      , const vector<BTree::Hash>&
+                      , asio::yield_context yield) {
         sys::error_code ec;
 
         auto ret = backend.add(value, yield[ec]);
@@ -38,6 +87,34 @@ static BTree::AddOp make_add_operation(Backend& backend)
     };
 }
 
+static BTree::AddOp make_raw_add_operation(Backend& backend)
+{
+    return [&backend] ( const BTree::Value& value
+                      , const vector<BTree::Hash>&
+                      , asio::yield_context yield) {
+        sys::error_code ec;
+
+        auto ret = backend.block_put(value, yield[ec]);
+        if (ec) return or_throw(yield, ec, move(ret));
+
+        backend.pin(ret, yield[ec]);
+        if (ec) return or_throw(yield, ec, move(ret));
+
+        return ret;
+    };
+}
+
+// Nodes stored this way are not pinned, they are kept by the recursive pin
+// of the root (see InjectorDb::pin_root).
+static BTree::AddOp make_linked_add_operation(Backend& backend)
+{
+    return [&backend] ( const BTree::Value& value
+                      , const vector<BTree::Hash>& children
+                      , asio::yield_context yield) {
+        return backend.add_object(value, children, yield);
+    };
+}
+
 static BTree::RemoveOp make_remove_operation(Backend& backend)
 {
     return [&backend] (const BTree::Value& hash, asio::yield_context yield) {
@@ -50,10 +127,9 @@ static string path_to_db(const string& path_to_repo, const string& ipns)
     return path_to_repo + "/ipfs_cache_db." + ipns;
 }
 
-static void load_db( BTree& db_map
-                   , const string& path_to_repo
-                   , const string& ipns
-                   , asio::yield_context yield)
+// Returns the root of the database last saved by `save_db`, or an empty
+// string if there is none.
+static string saved_root(const string& path_to_repo, const string& ipns)
 {
     string path = path_to_db(path_to_repo, ipns);
 
@@ -61,27 +137,43 @@ static void load_db( BTree& db_map
 
     if (!file.is_open()) {
         cerr << "Warning: Couldn't open " << path << endl;
-        return;
+        return {};
     }
 
     try {
         string ipfs;
         file >> ipfs;
 
-        if (ipfs.substr(0, 2) != "Qm") {
-            throw runtime_error("Content doesn't start with 'Qm'");
-        }
+        if (!Backend::is_raw_block(ipfs)) {
+            if (ipfs.substr(0, 2) != "Qm") {
+                throw runtime_error("Content doesn't start with 'Qm'");
+            }
 
-        if (ipfs.size() != Backend::CID_SIZE) {
-            throw runtime_error("Content doesn't appear to be a CID hash");
+            if (ipfs.size() != Backend::CID_SIZE) {
+                throw runtime_error("Content doesn't appear to be a CID hash");
+            }
         }
 
-        sys::error_code ec;
-        db_map.load(ipfs, yield[ec]);
+        return ipfs;
     }
     catch (const std::exception& e) {
         cerr << "ERROR: parsing " << path << ": " << e.what() << endl;
     }
+
+    return {};
+}
+
+static void load_db( BTree& db_map
+                   , const string& path_to_repo
+                   , const string& ipns
+                   , asio::yield_context yield)
+{
+    string ipfs = saved_root(path_to_repo, ipns);
+
+    if (ipfs.empty()) return;
+
+    sys::error_code ec;
+    db_map.load(ipfs, yield[ec]);
 }
 
 static void save_db( const string& path_to_repo
@@ -107,45 +199,81 @@ ClientDb::ClientDb(Backend& backend, string path_to_repo, string ipns)
     , _ipns(move(ipns))
     , _backend(backend)
     , _was_destroyed(make_shared<bool>(false))
+    , _strand(_backend.get_io_service())
     , _download_timer(_backend.get_io_service())
-    , _db_map(make_unique<BTree>( make_cat_operation(backend)
+    , _stage(Stage::started)
+    , _db_map(make_shared<BTree>( make_cat_operation(backend)
                                 , nullptr
                                 , nullptr
                                 , BTREE_NODE_SIZE))
 {
     auto d = _was_destroyed;
 
-    asio::spawn(get_io_service(), [=](asio::yield_context yield) {
-            if (*d) return;
-            load_db(*_db_map, _path_to_repo, _ipns, yield);
+    // The last known database is loaded from local storage while the IPNS
+    // name (which may take long) is being resolved.
+    load_saved_db();
+
+    asio::spawn(_strand, [=](asio::yield_context yield) {
             if (*d) return;
             continuously_download_db(yield);
         });
 }
 
-InjectorDb::InjectorDb(Backend& backend, string path_to_repo)
+InjectorDb::InjectorDb(Backend& backend, string path_to_repo, NodeStorage storage)
     : _path_to_repo(move(path_to_repo))
     , _ipns(backend.ipns_id())
     , _backend(backend)
+    , _strand(_backend.get_io_service())
+    , _coroutines(_backend.get_io_service(), _strand)
     , _republisher(new Republisher(_backend))
     , _has_callbacks(_backend.get_io_service())
     , _was_destroyed(make_shared<bool>(false))
-    , _db_map(make_unique<BTree>( make_cat_operation(backend)
-                                , make_add_operation(backend)
-                                , make_remove_operation(backend)
-                                , BTREE_NODE_SIZE))
+    , _storage(storage)
 {
+    BTree::AddOp add_op;
+    BTree::RemoveOp remove_op = make_remove_operation(backend);
+
+    switch (_storage) {
+        case NodeStorage::files:
+            add_op = make_add_operation(backend);
+            break;
+        case NodeStorage::linked_objects:
+            add_op = make_linked_add_operation(backend);
+            remove_op = nullptr;
+            break;
+        case NodeStorage::raw_blocks:
+            add_op = make_raw_add_operation(backend);
+            break;
+    }
+
+    _db_map = make_shared<BTree>( make_cat_operation(backend)
+                                , move(add_op)
+                                , move(remove_op)
+                                , BTREE_NODE_SIZE);
+
     auto d = _was_destroyed;
 
-    asio::spawn(get_io_service(), [=](asio::yield_context yield) {
+    asio::spawn(_strand, [=](asio::yield_context yield) {
             if (*d) return;
             load_db(*_db_map, _path_to_repo, _ipns, yield);
+            if (*d) return;
+            // Normally already pinned by the previous run, this takes care
+            // of databases previously stored in another way.
+            sys::error_code ec;
+            pin_root(yield[ec]);
         });
 }
 
 const string ipfs_uri_prefix = "ipfs:/ipfs/";
 
 void InjectorDb::update(string key, string value, asio::yield_context yield)
+{
+    _coroutines.run([&] (asio::yield_context yield) {
+            update_(move(key), move(value), yield);
+        }, yield);
+}
+
+void InjectorDb::update_(string key, string value, asio::yield_context yield)
 {
     auto wd = _was_destroyed;
     sys::error_code ec;
@@ -155,12 +283,53 @@ void InjectorDb::update(string key, string value, asio::yield_context yield)
     if (!ec && *wd) ec = asio::error::operation_aborted;
     if (ec) return or_throw(yield, ec);
 
+    pin_root(yield[ec]);
+
+    if (!ec && *wd) ec = asio::error::operation_aborted;
+    if (ec) return or_throw(yield, ec);
+
     upload_database(yield[ec]);
 
     if (!ec && *wd) ec = asio::error::operation_aborted;
     return or_throw(yield, ec);
 }
 
+// With NodeStorage::linked_objects, pins the current root and unpins the previously
+// pinned one. Only one coroutine does this at a time, it keeps going until
+// the current root is pinned, other coroutines return right away.
+void InjectorDb::pin_root(asio::yield_context yield)
+{
+    if (_storage != NodeStorage::linked_objects || _is_pinning_root) return;
+
+    auto wd = _was_destroyed;
+
+    _is_pinning_root = true;
+    auto on_exit = defer([&] { if (!*wd) _is_pinning_root = false; });
+
+    while (true) {
+        auto root = _db_map->root_hash();
+
+        if (root.empty() || root == _pinned_root) return;
+
+        sys::error_code ec;
+        _backend.pin(root, yield[ec]);
+
+        if (!ec && *wd) ec = asio::error::operation_aborted;
+        if (ec) return or_throw(yield, ec);
+
+        auto old_root = move(_pinned_root);
+        _pinned_root = move(root);
+
+        if (old_root.empty()) continue;
+
+        // Errors are ignored, the worst outcome is a node which won't get
+        // garbage collected.
+        _backend.unpin(old_root, yield[ec]);
+
+        if (*wd) return or_throw(yield, asio::error::operation_aborted);
+    }
+}
+
 void InjectorDb::upload_database(asio::yield_context yield)
 {
     string db_ipfs_id = _db_map->root_hash();
@@ -174,57 +343,263 @@ void InjectorDb::upload_database(asio::yield_context yield)
     _republisher->publish(move(db_ipfs_id), yield);
 }
 
-static string query_(string key, BTree& db, asio::yield_context yield)
+static string query_( string key
+                    , BTree& db
+                    , Backend& backend
+                    , LookupTrace* trace
+                    , asio::yield_context yield)
 {
     sys::error_code ec;
+    string val;
 
-    auto val = db.find(key, yield[ec]);
+    if (!trace) {
+        val = db.find(key, yield[ec]);
+    }
+    else {
+        auto on_parse = [trace] ( const BTree::Hash& hash
+                                , LookupTrace::Clock::duration d) {
+            using Clock = LookupTrace::Clock;
+
+            LookupTrace::Span span{ LookupTrace::Step::node_parse
+                                  , Clock::now() - trace->started - d
+                                  , d };
+            span.cid = hash;
+            trace->spans.push_back(move(span));
+        };
+
+        val = db.find( key
+                     , make_traced_cat_operation(backend, *trace)
+                     , move(on_parse)
+                     , yield[ec]);
+    }
 
     if (ec) return or_throw<string>(yield, ec);
 
     return val;
 }
 
+// Runs `query(yield)`, the query span of `trace` includes getting onto the
+// strand.
+template<class Query>
+static string traced_query( LookupTrace* trace
+                          , Query&& query
+                          , asio::yield_context yield)
+{
+    size_t span = trace ? trace->begin(LookupTrace::Step::query) : 0;
+
+    sys::error_code ec;
+
+    auto val = query(yield[ec]);
+
+    if (trace) {
+        auto& s = trace->end(span);
+        s.bytes = val.size();
+        s.ec    = ec;
+    }
+
+    return or_throw(yield, ec, move(val));
+}
+
 string InjectorDb::query(string key, asio::yield_context yield)
 {
-    return query_(move(key), *_db_map, yield);
+    return query(move(key), nullptr, yield);
+}
+
+// The tree is inserted into on the strand, so queries run there as well.
+string InjectorDb::query( string key
+                        , LookupTrace* trace
+                        , asio::yield_context yield)
+{
+    return traced_query(trace, [&] (asio::yield_context yield) {
+            return _coroutines.run([&] (asio::yield_context yield) {
+                    return query_(move(key), *_db_map, _backend, trace, yield);
+                }, yield);
+        }, yield);
 }
 
 string ClientDb::query(string key, asio::yield_context yield)
 {
-    return query_(move(key), *_db_map, yield);
+    return query(move(key), nullptr, yield);
+}
+
+// Trees are only ever switched as a whole, so just getting the current one
+// needs the strand. The lookup (fetching and parsing of nodes included) then
+// runs in the calling coroutine, so that queries are spread over all the
+// threads running the io_service.
+string ClientDb::query( string key
+                      , LookupTrace* trace
+                      , asio::yield_context yield)
+{
+    return traced_query(trace, [&] (asio::yield_context yield) {
+            sys::error_code ec;
+
+            auto db = call_on(_strand, get_io_service(), [this] {
+                    return _db_map;
+                }, yield[ec]);
+
+            if (ec) return or_throw<string>(yield, ec);
+
+            return query_(move(key), *db, _backend, trace, yield);
+        }, yield);
+}
+
+void ClientDb::load_saved_db()
+{
+    string ipfs = saved_root(_path_to_repo, _ipns);
+
+    if (ipfs.empty()) return;
+
+    auto d = _was_destroyed;
+
+    asio::spawn(_strand, [=](asio::yield_context yield) {
+            if (*d) return;
+            sys::error_code ec;
+            switch_to(ipfs, Stage::local_snapshot, yield[ec]);
+        });
+}
+
+string ClientDb::ipns() const
+{
+    lock_guard<mutex> lock(_names_mutex);
+    return _ipns;
+}
+
+string ClientDb::ipfs() const
+{
+    lock_guard<mutex> lock(_names_mutex);
+    return _ipfs;
+}
+
+void ClientDb::set_ipns(string ipns, asio::yield_context yield)
+{
+    call_on(_strand, get_io_service(), [&] {
+            if (ipns == _ipns) return;
+
+            {
+                lock_guard<mutex> lock(_names_mutex);
+                _ipns = move(ipns);
+            }
+
+            // The current database is kept for answering queries, but it's
+            // no longer the latest one of the name being followed.
+            if (_stage == Stage::up_to_date) _stage = Stage::local_snapshot;
+
+            load_saved_db();
+
+            // Have the download loop resolve the new name right away.
+            if (_cancel_resolve) _cancel_resolve();
+            _download_timer.cancel();
+        }, yield);
+}
+
+void ClientDb::switch_to( const string& ipfs_id
+                        , Stage stage
+                        , asio::yield_context yield)
+{
+    if (ipfs_id == _ipfs) return advance_to(stage);
+
+    auto d = _was_destroyed;
+    auto n = ++_switches_started;
+    auto ipns = _ipns;
+    sys::error_code ec;
+
+    auto db = make_shared<BTree>( make_cat_operation(_backend)
+                                , nullptr
+                                , nullptr
+                                , BTREE_NODE_SIZE);
+
+    db->load(ipfs_id, yield[ec]);
+
+    if (!ec && *d) ec = asio::error::operation_aborted;
+    if (ec) return or_throw(yield, ec);
+
+    // With no database answering queries yet, the new one is used right
+    // away and its top levels are loaded in the background. Otherwise they
+    // are loaded first, so that queries don't slow down on switching. If
+    // that fails (e.g. while offline) the new one is still switched to, its
+    // nodes are then fetched as queries need them.
+    bool serving = !_ipfs.empty();
+
+    if (serving) {
+        sys::error_code warm_ec;
+        db->warm(WARM_LEVELS, yield[warm_ec]);
+
+        if (*d) return or_throw(yield, asio::error::operation_aborted);
+    }
+
+    if (n < _switch_done || ipns != _ipns) return; // Superseded.
+
+    {
+        lock_guard<mutex> lock(_names_mutex);
+        _ipfs = ipfs_id;
+    }
+
+    _db_map      = db;
+    _switch_done = n;
+
+    advance_to(stage);
+
+    if (serving) return;
+
+    asio::spawn(_strand, [d, db = move(db)] (asio::yield_context yield) {
+            if (*d) return;
+            sys::error_code ec;
+            db->warm(WARM_LEVELS, yield[ec]);
+        });
+}
+
+void ClientDb::advance_to(Stage stage)
+{
+    if (stage <= _stage) return;
+
+    _stage = stage;
+
+    auto& cbs = _on_stage_callbacks;
+
+    for (auto i = cbs.begin(); i != cbs.end();) {
+        if (i->first > stage) { ++i; continue; }
+        get_io_service().post([c = move(i->second)] { c(sys::error_code()); });
+        i = cbs.erase(i);
+    }
 }
 
 void ClientDb::continuously_download_db(asio::yield_context yield)
 {
     auto d = _was_destroyed;
 
+    Backend::OpOptions opts;
+    opts.timeout = RESOLVE_TIMEOUT;
+    opts.cancel  = &_cancel_resolve;
+    // Resolutions cached for longer would hide new databases from the poll.
+    opts.max_cache_age = DOWNLOAD_INTERVAL;
+
     while(true) {
         sys::error_code ec;
 
-        auto ipfs_id = _backend.resolve(_ipns, yield[ec]);
+        auto ipns = _ipns;
+        auto ipfs_id = _backend.resolve(ipns, opts, yield[ec]);
         if (*d) return;
 
         if (!ec) {
-            _ipfs = ipfs_id;
-
-            _db_map->load(ipfs_id, yield[ec]);
-
+            switch_to(ipfs_id, Stage::up_to_date, yield[ec]);
             if (*d) return;
         }
 
-        save_db(_path_to_repo, _ipns, ipfs_id);
+        // Switched to another name in the meantime (see `set_ipns`).
+        if (ipns != _ipns) continue;
 
         if (ec) {
-            _download_timer.expires_from_now(chrono::seconds(5));
+            _download_timer.expires_from_now(DOWNLOAD_INTERVAL);
             _download_timer.async_wait(yield[ec]);
             if (*d) return;
             continue;
         }
 
-        flush_db_update_callbacks(sys::error_code());
+        save_db(_path_to_repo, ipns, ipfs_id);
+
+        flush_callbacks(_on_db_update_callbacks, sys::error_code());
 
-        _download_timer.expires_from_now(chrono::seconds(5));
+        _download_timer.expires_from_now(DOWNLOAD_INTERVAL);
         _download_timer.async_wait(yield[ec]);
         if (*d) return;
     }
@@ -237,16 +612,48 @@ void ClientDb::wait_for_db_update(asio::yield_context yield)
 
     Handler h(yield);
     asio::async_result<Handler> result(h);
-    _on_db_update_callbacks.push([ h = move(h)
-                                 , w = asio::io_service::work(get_io_service())
-                                 ] (auto ec) mutable { h(ec); });
+
+    _strand.dispatch([ this
+                     , h = wrap_handler<sys::error_code>(move(h))
+                     , w = asio::io_service::work(get_io_service())
+                     ] () mutable {
+            _on_db_update_callbacks.push([h = move(h), w = move(w)]
+                                         (auto ec) { h(ec); });
+        });
+
     result.get();
 }
 
-void ClientDb::flush_db_update_callbacks(const sys::error_code& ec)
+void ClientDb::wait_for_stage(Stage stage, asio::yield_context yield)
 {
-    auto& q = _on_db_update_callbacks;
+    using Handler = asio::handler_type<asio::yield_context,
+          void(sys::error_code)>::type;
+
+    Handler h(yield);
+    asio::async_result<Handler> result(h);
+
+    _strand.dispatch([ this
+                     , stage
+                     , h = wrap_handler<sys::error_code>(move(h))
+                     , w = asio::io_service::work(get_io_service())
+                     ] () mutable {
+            auto cb = [h = move(h), w = move(w)] (auto ec) { h(ec); };
 
+            if (stage <= _stage) {
+                return get_io_service().post([cb = move(cb)] {
+                        cb(sys::error_code());
+                    });
+            }
+
+            _on_stage_callbacks.emplace_back(stage, move(cb));
+        });
+
+    result.get();
+}
+
+void ClientDb::flush_callbacks( queue<OnDbUpdate>& q
+                              , const sys::error_code& ec)
+{
     while (!q.empty()) {
         auto c = move(q.front());
         q.pop();
@@ -264,7 +671,14 @@ asio::io_service& InjectorDb::get_io_service() {
 
 ClientDb::~ClientDb() {
     *_was_destroyed = true;
-    flush_db_update_callbacks(asio::error::operation_aborted);
+    if (_cancel_resolve) _cancel_resolve();
+    flush_callbacks(_on_db_update_callbacks, asio::error::operation_aborted);
+
+    for (auto& cb : _on_stage_callbacks) {
+        get_io_service().post([c = move(cb.second)] {
+                c(asio::error::operation_aborted);
+            });
+    }
 }
 
 InjectorDb::~InjectorDb() {
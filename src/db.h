@@ -3,14 +3,22 @@
 #include <boost/system/error_code.hpp>
 #include <boost/asio/spawn.hpp>
 #include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <atomic>
 #include <string>
 #include <queue>
 #include <list>
+#include <mutex>
 #include <json.hpp>
 
+#include <ipfs_cache/client.h>
+#include <ipfs_cache/injector.h>
+#include <ipfs_cache/lookup_trace.h>
+
 #include "namespaces.h"
 #include "condition_variable.h"
+#include "dispatch.h"
 
 namespace boost { namespace asio {
     class io_service;
@@ -23,21 +31,45 @@ class Backend;
 class Republisher;
 using Json = nlohmann::json;
 
+// The state of the databases lives on a strand. Their public member
+// functions may be called from coroutines running on any thread of the
+// io_service, but the databases must not be destroyed concurrently with
+// those calls.
 class ClientDb {
     using OnDbUpdate = std::function<void(const sys::error_code&)>;
 
 public:
+    using Stage = Client::Stage;
+
     ClientDb(Backend&, std::string path_to_repo, std::string ipns);
 
     std::string query(std::string key, asio::yield_context);
 
+    // The `trace` may be null.
+    std::string query(std::string key, LookupTrace*, asio::yield_context);
+
     boost::asio::io_service& get_io_service();
 
-    const std::string& ipns() const { return _ipns; }
-    const std::string& ipfs() const { return _ipfs; }
+    // These may change on the strand at any time, so copies are returned.
+    std::string ipns() const;
+    std::string ipfs() const;
 
+    // Waits for the next database downloaded after the call.
     void wait_for_db_update(boost::asio::yield_context);
 
+    // See Client::Stage.
+    void wait_for_stage(Stage, boost::asio::yield_context);
+
+    Stage stage() const { return _stage; }
+
+    // Follows the database published under `ipns` from now on. Queries keep
+    // being answered from the current database until the top levels of the
+    // new one (the last one known for `ipns` if any, otherwise the one it
+    // resolves to) are loaded, see `switch_to`. Nodes and contents fetched
+    // so far stay in the caches of the backend and the client, so those the
+    // databases share aren't fetched again.
+    void set_ipns(std::string ipns, asio::yield_context);
+
     Backend& backend() { return _backend; }
 
     ~ClientDb();
@@ -45,30 +77,69 @@ public:
 private:
     void merge(const Json&);
 
+    // Loads the database with the root `ipfs_id` and its top levels in the
+    // background, queries are answered from the current one until then (or
+    // until loading the top levels fails). If there is no current one, the
+    // new one is used as soon as its root is loaded and the top levels
+    // follow.
+    // Once switched (or if already there) the client is at least at
+    // `stage`. Switches may run concurrently, one which finishes after a
+    // later started one has switched, or after the IPNS name changed, is
+    // dropped.
+    void switch_to( const std::string& ipfs_id
+                  , Stage stage
+                  , asio::yield_context);
+
+    void advance_to(Stage);
+
     Json download_database(const std::string& ipns, sys::error_code&, asio::yield_context);
     void continuously_download_db(asio::yield_context);
 
-    void flush_db_update_callbacks(const sys::error_code&);
+    // Switches to the database last saved for the current IPNS name (if
+    // any) in the background.
+    void load_saved_db();
+
+    void flush_callbacks(std::queue<OnDbUpdate>&, const sys::error_code&);
 
 private:
     const std::string _path_to_repo;
+    // Changed on the strand, with the mutex held so that `ipns()` and
+    // `ipfs()` can read them from elsewhere.
     std::string _ipns;
     std::string _ipfs; // Last known
+    mutable std::mutex _names_mutex;
     Backend& _backend;
     std::shared_ptr<bool> _was_destroyed;
+    asio::io_service::strand _strand;
+    // Aborts the IPNS resolution in progress (if any).
+    std::function<void()> _cancel_resolve;
     asio::steady_timer _download_timer;
     std::queue<OnDbUpdate> _on_db_update_callbacks;
-    std::unique_ptr<BTree> _db_map;
+    std::atomic<Stage> _stage;
+    std::list<std::pair<Stage, OnDbUpdate>> _on_stage_callbacks;
+    // Switches started and the one last done, see `switch_to`.
+    uint64_t _switches_started = 0;
+    uint64_t _switch_done = 0;
+    // Replaced as a whole on switching to a new root, queries in progress
+    // keep the one they started with.
+    std::shared_ptr<BTree> _db_map;
 };
 
 class InjectorDb {
 public:
-    InjectorDb(Backend&, std::string path_to_repo);
+    using NodeStorage = Injector::NodeStorage;
+
+    InjectorDb( Backend&
+              , std::string path_to_repo
+              , NodeStorage = NodeStorage::files);
 
     void update(std::string key, std::string content_hash, asio::yield_context);
 
     std::string query(std::string key, asio::yield_context);
 
+    // The `trace` may be null.
+    std::string query(std::string key, LookupTrace*, asio::yield_context);
+
     boost::asio::io_service& get_io_service();
 
     const std::string& ipns() const { return _ipns; }
@@ -78,6 +149,8 @@ public:
     ~InjectorDb();
 
 private:
+    void update_(std::string key, std::string content_hash, asio::yield_context);
+    void pin_root(asio::yield_context);
     void upload_database(asio::yield_context);
     void continuously_upload_db(asio::yield_context);
 
@@ -85,11 +158,18 @@ private:
     const std::string _path_to_repo;
     std::string _ipns;
     Backend& _backend;
+    asio::io_service::strand _strand;
+    // Runs the queries and updates on the strand.
+    CoroutinePool _coroutines;
     std::unique_ptr<Republisher> _republisher;
     ConditionVariable _has_callbacks;
     std::list<std::function<void(sys::error_code)>> _upload_callbacks;
     std::shared_ptr<bool> _was_destroyed;
-    std::unique_ptr<BTree> _db_map;
+    const NodeStorage _storage;
+    // With NodeStorage::linked_objects, the root which is currently pinned.
+    std::string _pinned_root;
+    bool _is_pinning_root = false;
+    std::shared_ptr<BTree> _db_map;
 };
 
 } // ipfs_cache namespace
@@ -0,0 +1,174 @@
+#include "dedup_cache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+using namespace std;
+using namespace ipfs_cache;
+
+// The log is not rewritten while it has fewer entries than this.
+static const size_t MIN_COMPACT_ENTRIES = 1024;
+
+// Written in place of the CID by `erase`.
+static const char ERASED[] = "-";
+
+DedupCache::DedupCache(string path, size_t max_entries)
+    : _path(move(path))
+    , _max_entries(max(size_t(1), max_entries))
+{
+    bool intact = load();
+
+    if (!intact || _log_entries > max(MIN_COMPACT_ENTRIES, 2 * _index.size())) {
+        compact();
+    }
+    else {
+        open_log();
+    }
+}
+
+const string* DedupCache::find(const string& digest)
+{
+    auto i = _index.find(digest);
+
+    if (i == _index.end()) {
+        ++_stats.misses;
+        return nullptr;
+    }
+
+    ++_stats.hits;
+
+    _lru.splice(_lru.begin(), _lru, i->second);
+
+    return &i->second->cid;
+}
+
+bool DedupCache::put(const string& digest, string cid)
+{
+    auto i = _index.find(digest);
+
+    if (i != _index.end()) {
+        _lru.splice(_lru.begin(), _lru, i->second);
+        if (i->second->cid == cid) return false;
+        i->second->cid = move(cid);
+        return true;
+    }
+
+    _lru.push_front(Item{digest, move(cid)});
+    _index.emplace(digest, _lru.begin());
+
+    while (_index.size() > _max_entries) {
+        _index.erase(_lru.back().digest);
+        _lru.pop_back();
+    }
+
+    return true;
+}
+
+void DedupCache::insert(const string& digest, string cid)
+{
+    if (digest.empty() || cid.empty() || cid == ERASED) return;
+
+    if (!put(digest, cid)) return;
+
+    if (_log.is_open()) {
+        _log << digest << ' ' << cid << '\n' << flush;
+        ++_log_entries;
+    }
+
+    if (_log_entries > max(MIN_COMPACT_ENTRIES, 2 * _index.size())) {
+        compact();
+    }
+}
+
+void DedupCache::erase(const string& digest)
+{
+    auto i = _index.find(digest);
+
+    if (i == _index.end()) return;
+
+    _lru.erase(i->second);
+    _index.erase(i);
+
+    if (_log.is_open()) {
+        _log << digest << ' ' << ERASED << '\n' << flush;
+        ++_log_entries;
+    }
+}
+
+bool DedupCache::load()
+{
+    ifstream file(_path);
+
+    if (!file.is_open()) return true;
+
+    string line;
+
+    while (getline(file, line)) {
+        // The last line wasn't terminated.
+        if (file.eof()) return false;
+
+        ++_log_entries;
+
+        auto sp = line.find(' ');
+
+        if (sp == string::npos || sp == 0 || sp + 1 == line.size()
+                || line.find(' ', sp + 1) != string::npos) {
+            continue;
+        }
+
+        auto digest = line.substr(0, sp);
+        auto cid    = line.substr(sp + 1);
+
+        // The log isn't open yet, so nothing is appended to it.
+        if (cid == ERASED) erase(digest);
+        else               put(digest, move(cid));
+    }
+
+    return true;
+}
+
+void DedupCache::open_log()
+{
+    _log.open(_path, ofstream::app);
+
+    if (!_log.is_open()) {
+        cerr << "ERROR: Opening " << _path << endl;
+    }
+}
+
+void DedupCache::compact()
+{
+    _log.close();
+
+    // Also postpones another attempt if this one fails.
+    _log_entries = _index.size();
+
+    string tmp_path = _path + ".tmp";
+
+    {
+        ofstream tmp(tmp_path, ofstream::trunc);
+
+        if (!tmp.is_open()) {
+            cerr << "ERROR: Saving " << tmp_path << endl;
+            return open_log();
+        }
+
+        // Least recently used first so that replaying keeps the order.
+        for (auto i = _lru.rbegin(); i != _lru.rend(); ++i) {
+            tmp << i->digest << ' ' << i->cid << '\n';
+        }
+
+        if (!tmp.flush()) {
+            cerr << "ERROR: Saving " << tmp_path << endl;
+            return open_log();
+        }
+    }
+
+    if (rename(tmp_path.c_str(), _path.c_str()) != 0) {
+        cerr << "ERROR: Renaming " << tmp_path << " to " << _path << endl;
+        return open_log();
+    }
+
+    open_log();
+}
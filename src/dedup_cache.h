@@ -0,0 +1,75 @@
+#pragma once
+
+#include <fstream>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+namespace ipfs_cache {
+
+/*
+ * Persistent map from digests of contents to the CIDs they were stored in
+ * IPFS under, used to skip adding content that IPFS already has. At most
+ * `max_entries` least recently used entries are kept.
+ *
+ * Insertions (and erasures, as lines with a "-" for the CID) are appended
+ * to a log file at `path`, which is replayed on
+ * construction and rewritten once it grows to twice the number of live
+ * entries (lookups only reorder the entries in the log when it's
+ * rewritten). A line torn by a crash is skipped on replay and the log is
+ * rewritten before anything is appended to it.
+ *
+ * The cache is not thread safe.
+ */
+class DedupCache {
+public:
+    struct Stats {
+        uint64_t hits   = 0;
+        uint64_t misses = 0;
+    };
+
+public:
+    DedupCache(std::string path, size_t max_entries);
+
+    DedupCache(const DedupCache&) = delete;
+    DedupCache& operator=(const DedupCache&) = delete;
+
+    // Returns nullptr if the digest isn't known. The returned pointer is
+    // only valid until the next modification of the cache.
+    const std::string* find(const std::string& digest);
+
+    void insert(const std::string& digest, std::string cid);
+
+    // Forgets the digest, e.g. once its content turns out to be gone.
+    void erase(const std::string& digest);
+
+    size_t size() const { return _index.size(); }
+
+    const Stats& stats() const { return _stats; }
+
+private:
+    struct Item {
+        std::string digest;
+        std::string cid;
+    };
+
+    using List = std::list<Item>;
+
+    // Returns whether the entry was new or changed.
+    bool put(const std::string& digest, std::string cid);
+    // Returns false if the log ends with a torn line.
+    bool load();
+    void compact();
+    void open_log();
+
+private:
+    const std::string _path;
+    const size_t _max_entries;
+    List _lru;
+    std::unordered_map<std::string, List::iterator> _index;
+    std::ofstream _log;
+    size_t _log_entries = 0;
+    Stats _stats;
+};
+
+} // ipfs_cache namespace
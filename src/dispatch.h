@@ -0,0 +1,306 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <boost/asio/detail/handler_invoke_helpers.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/system/error_code.hpp>
+
+#include "namespaces.h"
+#include "work_thread.h"
+
+namespace ipfs_cache {
+
+// A completion handler with its arguments bound to it.
+template<class Handler, class... Args>
+struct BoundHandler {
+    Handler handler;
+    std::tuple<Args...> args;
+
+    void operator()() {
+        call(std::index_sequence_for<Args...>());
+    }
+
+    template<std::size_t... I>
+    void call(std::index_sequence<I...>) {
+        handler(std::move(std::get<I>(args))...);
+    }
+};
+
+// Type erases `handler` into a std::function which, no matter which thread
+// calls it, runs the handler through the handler's asio_handler_invoke hook
+// (i.e. the way asio itself would). For handlers of coroutines spawned on a
+// strand this means the coroutine is resumed on that strand, calling such
+// handler directly would resume the coroutine right on the calling thread.
+template<class... Args, class Handler>
+std::function<void(Args...)> wrap_handler(Handler handler)
+{
+    return [h = std::move(handler)] (Args... args) {
+        BoundHandler<Handler, Args...> b{h, std::make_tuple(std::move(args)...)};
+        boost_asio_handler_invoke_helpers::invoke(b, b.handler);
+    };
+}
+
+namespace detail {
+    // The handler is invoked through `ios`, so that the caller isn't resumed
+    // right inside the coroutine which produced the result.
+    template<class R> struct RunOn {
+        using Signature = void(sys::error_code, R);
+
+        template<class Handler>
+        static auto wrap(Handler h, asio::io_service& ios) {
+            auto w = wrap_handler<sys::error_code, R>(std::move(h));
+
+            return [w, &ios] (sys::error_code ec, R r) {
+                ios.post([w, ec, r = std::move(r)] () mutable {
+                        w(ec, std::move(r));
+                    });
+            };
+        }
+
+        template<class F, class Cb>
+        static void run(F& f, Cb& cb, asio::yield_context yield) {
+            sys::error_code ec;
+            R r = f(yield[ec]);
+            cb(ec, std::move(r));
+        }
+
+        template<class F, class Cb>
+        static void call(F& f, Cb& cb) {
+            R r = f();
+            cb(sys::error_code(), std::move(r));
+        }
+    };
+
+    template<> struct RunOn<void> {
+        using Signature = void(sys::error_code);
+
+        template<class Handler>
+        static auto wrap(Handler h, asio::io_service& ios) {
+            auto w = wrap_handler<sys::error_code>(std::move(h));
+
+            return [w, &ios] (sys::error_code ec) {
+                ios.post([w, ec] { w(ec); });
+            };
+        }
+
+        template<class F, class Cb>
+        static void run(F& f, Cb& cb, asio::yield_context yield) {
+            sys::error_code ec;
+            f(yield[ec]);
+            cb(ec);
+        }
+
+        template<class F, class Cb>
+        static void call(F& f, Cb& cb) {
+            f();
+            cb(sys::error_code());
+        }
+    };
+} // detail namespace
+
+// Runs `f()`, which must not do IO, on `strand` and hands its result back
+// to the calling coroutine, which is resumed through `ios` (on its own
+// strand). No coroutine is spawned for it.
+template<class F>
+auto call_on( asio::io_service::strand& strand
+            , asio::io_service& ios
+            , F&& f
+            , asio::yield_context yield) -> decltype(f())
+{
+    using R       = decltype(f());
+    using Handler = typename asio::handler_type
+                        < asio::yield_context
+                        , typename detail::RunOn<R>::Signature>::type;
+
+    Handler handler(yield);
+    asio::async_result<Handler> result(handler);
+
+    strand.dispatch([ f  = std::forward<F>(f)
+                    , cb = detail::RunOn<R>::wrap(std::move(handler), ios)
+                    ] () mutable {
+            detail::RunOn<R>::call(f, cb);
+        });
+
+    return result.get();
+}
+
+/*
+ * Runs functions which do IO in coroutines on a strand, for objects which
+ * keep their state on the strand and serve calls made from coroutines
+ * running elsewhere. A coroutine done with a call waits for the next one
+ * (up to `max_idle` of them wait), so that calls don't each spawn one.
+ */
+class CoroutinePool {
+public:
+    // Results are handed back through `ios`, which runs `strand`.
+    CoroutinePool( asio::io_service& ios
+                 , asio::io_service::strand
+                 , size_t max_idle = 16);
+
+    CoroutinePool(const CoroutinePool&) = delete;
+    CoroutinePool& operator=(const CoroutinePool&) = delete;
+
+    // Runs `f(yield)` on the strand and hands the result back to the
+    // calling coroutine, which is resumed on its own strand.
+    template<class F>
+    auto run(F&& f, asio::yield_context yield) -> decltype(f(yield));
+
+    // The waiting coroutines end, calls in progress are finished.
+    ~CoroutinePool();
+
+private:
+    using Job = std::function<void(asio::yield_context)>;
+
+    // Shared with the coroutines, which may outlive the pool.
+    struct State {
+        State( asio::io_service& ios
+             , asio::io_service::strand strand
+             , size_t max_idle)
+            : ios(ios)
+            , strand(std::move(strand))
+            , max_idle(max_idle)
+        {}
+
+        asio::io_service& ios;
+        asio::io_service::strand strand;
+        size_t max_idle;
+        std::deque<Job> jobs;
+        // Each resumes a waiting coroutine.
+        std::vector<std::function<void()>> idle;
+        bool stopped = false;
+    };
+
+    static void push(std::shared_ptr<State>, Job);
+    static void work(std::shared_ptr<State>, asio::yield_context);
+
+private:
+    std::shared_ptr<State> _state;
+};
+
+inline
+CoroutinePool::CoroutinePool( asio::io_service& ios
+                            , asio::io_service::strand strand
+                            , size_t max_idle)
+    : _state(std::make_shared<State>(ios, std::move(strand), max_idle))
+{}
+
+template<class F>
+auto CoroutinePool::run(F&& f, asio::yield_context yield) -> decltype(f(yield))
+{
+    using R       = decltype(f(yield));
+    using Handler = typename asio::handler_type
+                        < asio::yield_context
+                        , typename detail::RunOn<R>::Signature>::type;
+
+    Handler handler(yield);
+    asio::async_result<Handler> result(handler);
+
+    Job job = [ f  = std::forward<F>(f)
+              , cb = detail::RunOn<R>::wrap(std::move(handler), _state->ios)
+              ] (asio::yield_context yield) mutable {
+            detail::RunOn<R>::run(f, cb, yield);
+        };
+
+    auto s = _state;
+
+    s->strand.dispatch([s, job = std::move(job)] () mutable {
+            push(std::move(s), std::move(job));
+        });
+
+    return result.get();
+}
+
+// Runs on the strand.
+inline
+void CoroutinePool::push(std::shared_ptr<State> s, Job job)
+{
+    s->jobs.push_back(std::move(job));
+
+    if (!s->idle.empty()) {
+        auto resume = std::move(s->idle.back());
+        s->idle.pop_back();
+        return s->strand.post(std::move(resume));
+    }
+
+    asio::spawn(s->strand, [s] (asio::yield_context yield) {
+            work(s, yield);
+        });
+}
+
+inline
+void CoroutinePool::work(std::shared_ptr<State> s, asio::yield_context yield)
+{
+    using Handler = typename asio::handler_type< asio::yield_context
+                                               , void()>::type;
+
+    for (;;) {
+        while (!s->jobs.empty()) {
+            auto job = std::move(s->jobs.front());
+            s->jobs.pop_front();
+            job(yield);
+        }
+
+        if (s->stopped || s->idle.size() >= s->max_idle) return;
+
+        Handler handler(yield);
+        asio::async_result<Handler> result(handler);
+
+        s->idle.push_back([handler] () mutable { handler(); });
+
+        result.get();
+    }
+}
+
+inline
+CoroutinePool::~CoroutinePool()
+{
+    auto s = _state;
+
+    s->strand.dispatch([s] {
+            s->stopped = true;
+            for (auto& resume : s->idle) s->strand.post(std::move(resume));
+            s->idle.clear();
+        });
+}
+
+// Runs `f()` (which returns a value) on `thread` and hands the result back
+// to the calling coroutine, which is resumed through `ios` on its own
+// strand. Used for blocking work which must not hold up the io_service.
+template<class F>
+auto run_in_thread( WorkThread& thread
+                  , asio::io_service& ios
+                  , F&& f
+                  , asio::yield_context yield) -> decltype(f())
+{
+    using R       = decltype(f());
+    using Handler = typename asio::handler_type
+                        < asio::yield_context
+                        , void(sys::error_code, R)>::type;
+
+    Handler handler(yield);
+    asio::async_result<Handler> result(handler);
+
+    auto cb = wrap_handler<sys::error_code, R>(std::move(handler));
+
+    // Keeps the io_service running while the job is away.
+    asio::io_service::work work(ios);
+
+    thread.post([f = std::forward<F>(f), cb, &ios, work] () mutable {
+            R r = f();
+
+            ios.post([cb, r = std::move(r), work] () mutable {
+                    cb(sys::error_code(), std::move(r));
+                });
+        });
+
+    return result.get();
+}
+
+} // ipfs_cache namespace
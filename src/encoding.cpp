@@ -0,0 +1,156 @@
+#include "encoding.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+using namespace ipfs_cache;
+
+static const char b58_digits[]
+    = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+
+static const char b64_digits[]
+    = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Value of each character in `digits`, -1 for characters not in it.
+static array<int8_t, 256> reverse(const char* digits)
+{
+    array<int8_t, 256> r;
+    r.fill(-1);
+    for (int i = 0; digits[i]; ++i) r[uint8_t(digits[i])] = i;
+    return r;
+}
+
+string ipfs_cache::base58_encode(boost::string_view in)
+{
+    size_t zeros = 0;
+    while (zeros < in.size() && in[zeros] == 0) ++zeros;
+
+    // Base 58 digits in little endian, log(256)/log(58) < 1.37.
+    vector<uint8_t> digits;
+    digits.reserve(in.size() * 137 / 100 + 1);
+
+    for (size_t i = zeros; i < in.size(); ++i) {
+        unsigned carry = uint8_t(in[i]);
+
+        for (auto& d : digits) {
+            carry += unsigned(d) << 8;
+            d = carry % 58;
+            carry /= 58;
+        }
+
+        for (; carry; carry /= 58) digits.push_back(carry % 58);
+    }
+
+    string out(zeros, '1');
+    out.reserve(zeros + digits.size());
+
+    for (auto i = digits.rbegin(); i != digits.rend(); ++i) {
+        out += b58_digits[*i];
+    }
+
+    return out;
+}
+
+boost::optional<string> ipfs_cache::base58_decode(boost::string_view in)
+{
+    static const auto values = reverse(b58_digits);
+
+    size_t ones = 0;
+    while (ones < in.size() && in[ones] == '1') ++ones;
+
+    // Bytes in little endian.
+    vector<uint8_t> bytes;
+    bytes.reserve(in.size() * 733 / 1000 + 1);
+
+    for (size_t i = ones; i < in.size(); ++i) {
+        int v = values[uint8_t(in[i])];
+        if (v < 0) return boost::none;
+
+        unsigned carry = v;
+
+        for (auto& b : bytes) {
+            carry += unsigned(b) * 58;
+            b = carry & 0xff;
+            carry >>= 8;
+        }
+
+        for (; carry; carry >>= 8) bytes.push_back(carry & 0xff);
+    }
+
+    string out(ones, '\0');
+    out.append(bytes.rbegin(), bytes.rend());
+    return out;
+}
+
+string ipfs_cache::base64_encode(boost::string_view in)
+{
+    string out;
+    out.reserve((in.size() + 2) / 3 * 4);
+
+    size_t i = 0;
+
+    for (; i + 3 <= in.size(); i += 3) {
+        uint32_t n = uint8_t(in[i]) << 16 | uint8_t(in[i+1]) << 8 | uint8_t(in[i+2]);
+        out += b64_digits[n >> 18];
+        out += b64_digits[(n >> 12) & 63];
+        out += b64_digits[(n >> 6) & 63];
+        out += b64_digits[n & 63];
+    }
+
+    if (i + 1 == in.size()) {
+        uint32_t n = uint8_t(in[i]) << 16;
+        out += b64_digits[n >> 18];
+        out += b64_digits[(n >> 12) & 63];
+        out += "==";
+    }
+    else if (i + 2 == in.size()) {
+        uint32_t n = uint8_t(in[i]) << 16 | uint8_t(in[i+1]) << 8;
+        out += b64_digits[n >> 18];
+        out += b64_digits[(n >> 12) & 63];
+        out += b64_digits[(n >> 6) & 63];
+        out += '=';
+    }
+
+    return out;
+}
+
+boost::optional<string> ipfs_cache::base64_decode(boost::string_view in)
+{
+    static const auto values = reverse(b64_digits);
+
+    if (in.size() % 4) return boost::none;
+
+    size_t pad = 0;
+    if (!in.empty() && in[in.size() - 1] == '=') ++pad;
+    if (in.size() > 1 && in[in.size() - 2] == '=') ++pad;
+
+    string out;
+    out.reserve(in.size() / 4 * 3);
+
+    for (size_t i = 0; i < in.size(); i += 4) {
+        bool last = i + 4 == in.size();
+        uint32_t n = 0;
+
+        for (size_t j = 0; j < 4; ++j) {
+            char c = in[i + j];
+
+            if (c == '=' && last && j >= 4 - pad) {
+                n <<= 6;
+                continue;
+            }
+
+            int v = values[uint8_t(c)];
+            if (v < 0) return boost::none;
+            n = n << 6 | v;
+        }
+
+        out += char(n >> 16);
+        if (!last || pad < 2) out += char((n >> 8) & 0xff);
+        if (!last || pad < 1) out += char(n & 0xff);
+    }
+
+    return out;
+}
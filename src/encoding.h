@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+#include <boost/optional.hpp>
+#include <boost/utility/string_view.hpp>
+
+namespace ipfs_cache {
+
+// Base58 with the Bitcoin alphabet, as used by IPFS for version 0 CIDs.
+std::string base58_encode(boost::string_view);
+boost::optional<std::string> base58_decode(boost::string_view);
+
+// Standard base64 (RFC 4648) with padding.
+std::string base64_encode(boost::string_view);
+boost::optional<std::string> base64_decode(boost::string_view);
+
+} // ipfs_cache namespace
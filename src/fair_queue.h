@@ -0,0 +1,131 @@
+#pragma once
+
+#include <chrono>
+#include <list>
+#include <map>
+#include <vector>
+#include <assert.h>
+
+namespace ipfs_cache {
+
+/*
+ * Queue of entries in a number of classes, popped in weighted round robin
+ * order: each round pops up to `weights[i]` entries of class `i`, lower
+ * classes first, so no class starves while the ones with higher weights
+ * get a proportionally bigger share. Within a class entries are FIFO.
+ *
+ * Entries may have a deadline, `expire` removes the ones past it.
+ */
+template<class T>
+class FairQueue {
+public:
+    using Clock = std::chrono::steady_clock;
+
+public:
+    FairQueue(std::vector<unsigned> weights)
+        : _weights(std::move(weights))
+        , _classes(_weights.size())
+    {
+        for (auto& w : _weights) if (w == 0) w = 1;
+        _credits = _weights;
+    }
+
+    void push( size_t cls
+             , T value
+             , Clock::time_point deadline = Clock::time_point::max())
+    {
+        assert(cls < _classes.size());
+
+        auto& q = _classes[cls];
+
+        q.push_back(Entry{std::move(value), _deadlines.end()});
+
+        if (deadline != Clock::time_point::max()) {
+            q.back().deadline = _deadlines.emplace(deadline, Ref{cls, std::prev(q.end())});
+        }
+
+        ++_size;
+    }
+
+    bool   empty() const { return _size == 0; }
+    size_t size()  const { return _size; }
+    size_t size(size_t cls) const { return _classes[cls].size(); }
+
+    // Must not be called on an empty queue.
+    T pop()
+    {
+        assert(!empty());
+
+        while (true) {
+            auto& q = _classes[_current];
+
+            if (!q.empty() && _credits[_current] > 0) {
+                --_credits[_current];
+                return take(_current, q.begin());
+            }
+
+            if (++_current == _classes.size()) {
+                _current = 0;
+                _credits = _weights;
+            }
+        }
+    }
+
+    // Removes and returns the entries with deadlines up to `now`.
+    std::vector<T> expire(Clock::time_point now)
+    {
+        std::vector<T> ret;
+
+        while (!_deadlines.empty() && _deadlines.begin()->first <= now) {
+            auto ref = _deadlines.begin()->second;
+            ret.push_back(take(ref.cls, ref.entry));
+        }
+
+        return ret;
+    }
+
+    // Clock::time_point::max() if no entry has a deadline.
+    Clock::time_point next_deadline() const
+    {
+        if (_deadlines.empty()) return Clock::time_point::max();
+        return _deadlines.begin()->first;
+    }
+
+private:
+    struct Entry;
+    using List = std::list<Entry>;
+
+    struct Ref {
+        size_t cls;
+        typename List::iterator entry;
+    };
+
+    using Deadlines = std::multimap<Clock::time_point, Ref>;
+
+    struct Entry {
+        T value;
+        typename Deadlines::iterator deadline;
+    };
+
+    T take(size_t cls, typename List::iterator i)
+    {
+        T value = std::move(i->value);
+
+        if (i->deadline != _deadlines.end()) _deadlines.erase(i->deadline);
+
+        _classes[cls].erase(i);
+        --_size;
+
+        return value;
+    }
+
+private:
+    std::vector<unsigned> _weights;
+    std::vector<unsigned> _credits;
+    std::vector<List> _classes;
+    Deadlines _deadlines;
+    size_t _current = 0;
+    size_t _size = 0;
+};
+
+} // ipfs_cache namespace
@@ -1,46 +1,310 @@
 #pragma once
 
+#include <algorithm>
+#include <limits>
+#include <boost/asio/buffer.hpp>
 #include <ipfs_cache/cached_content.h>
+#include <ipfs_cache/lookup_trace.h>
+#include "backend.h"
+#include "content_cache.h"
+#include "dispatch.h"
+#include "index_entry.h"
 #include "or_throw.h"
+#include "defer.h"
 
 namespace ipfs_cache {
 
+// Size of chunks in which content is delivered by the streaming
+// `get_content` below.
+static const size_t CONTENT_CHUNK_SIZE = 64 * 1024;
+
+using OnContentChunk = std::function<void( asio::const_buffer
+                                         , asio::yield_context)>;
+
+// Look up the database entry under `url` and return it. The `trace`
+// argument of this and the functions below may be null.
 template<class Db>
 inline
-CachedContent get_content(Db& db, std::string url, asio::yield_context yield)
+IndexEntry query_content_entry( Db& db
+                              , const std::string& url
+                              , LookupTrace* trace
+                              , asio::yield_context yield)
 {
     sys::error_code ec;
 
-    std::string raw_json = db.query(url, yield[ec]);
+    std::string raw = db.query(url, trace, yield[ec]);
 
     if (ec) {
-        return or_throw<CachedContent>(yield, ec);
+        return or_throw<IndexEntry>(yield, ec);
     }
 
-    std::string content_hash;
-    boost::posix_time::ptime ts;
+    size_t span = trace ? trace->begin(LookupTrace::Step::entry_parse) : 0;
 
-    try {
-        auto json = Json::parse(raw_json);
+    auto on_exit = defer([&] {
+            if (!trace) return;
+            auto& s = trace->end(span);
+            s.bytes = raw.size();
+            s.ec    = ec;
+        });
 
-        ts           = boost::posix_time::from_iso_extended_string(json["ts"]);
-        content_hash = json["value"];
-    }
-    catch(const std::exception& e) {
-        std::cerr << "Problem parsing data from cache: " << e.what()
-                  << std::endl << "  \"" << raw_json << "\""
+    // Binary entries are read in place, only older JSON ones go through
+    // the parser.
+    IndexEntryView view;
+
+    if (view.parse(raw)) return IndexEntry::from(view);
+
+    auto entry = IndexEntry::parse(raw);
+
+    if (!entry) {
+        std::cerr << "Problem parsing data from cache:"
+                  << std::endl << "  \"" << raw << "\""
                   << std::endl;
 
         ec = asio::error::not_found;
+        return or_throw<IndexEntry>(yield, ec);
+    }
+
+    return std::move(*entry);
+}
+
+// Fetch the content under `cid`, from `cache` if it's there (and `cache`
+// isn't null), adding it there otherwise. Whether the content came from the
+// cache or the block cache of the backend is stored in `from_cache` (if
+// not null). The file IO of the cache is done on its own thread.
+template<class Db>
+inline
+std::string cat_content( Db& db
+                       , const std::string& cid
+                       , ContentCache* cache
+                       , bool* from_cache
+                       , asio::yield_context yield)
+{
+    auto& ios = db.get_io_service();
+
+    if (cache) {
+        auto data = run_in_thread( cache->io_thread(), ios
+                                 , [&] { return cache->find(cid); }
+                                 , yield);
+
+        if (data) {
+            if (from_cache) *from_cache = true;
+            return std::move(*data);
+        }
+    }
+
+    sys::error_code ec;
+
+    Backend::OpOptions opts;
+    opts.from_cache = from_cache;
+
+    std::string data = db.backend().cat(cid, opts, yield[ec]);
+
+    if (!ec && cache) {
+        run_in_thread( cache->io_thread(), ios
+                     , [&] { return cache->insert(cid, data); }
+                     , yield);
+    }
+
+    return or_throw(yield, ec, std::move(data));
+}
+
+template<class Db>
+inline
+CachedContent get_content( Db& db
+                         , std::string url
+                         , LookupTrace* trace
+                         , ContentCache* cache
+                         , asio::yield_context yield)
+{
+    sys::error_code ec;
+
+    auto entry = query_content_entry(db, url, trace, yield[ec]);
+
+    if (ec) {
+        return or_throw<CachedContent>(yield, ec);
+    }
+
+    size_t span = trace ? trace->begin(LookupTrace::Step::cat) : 0;
+
+    bool cached = false;
+
+    std::string s = cat_content(db, entry.cid, cache, &cached, yield[ec]);
+
+    if (trace) {
+        auto& sp = trace->end(span);
+        sp.cid       = entry.cid;
+        sp.bytes     = s.size();
+        sp.cache_hit = cached;
+        sp.ec        = ec;
+    }
+
+    CachedContent content{entry.ts, move(s), entry.content_type};
+    content.size = content.data.size();
+
+    return or_throw(yield, ec, std::move(content));
+}
+
+template<class Db>
+inline
+CachedContent get_content( Db& db
+                         , std::string url
+                         , LookupTrace* trace
+                         , asio::yield_context yield)
+{
+    return get_content(db, move(url), trace, nullptr, yield);
+}
+
+// Passes `length` bytes of the content starting at `offset` (fewer if the
+// content ends before that) to `on_chunk` piece by piece as they arrive from
+// IPFS. Only the blocks holding the range are fetched. Content in the block
+// cache of the backend is served from there and small content read whole is
+// added to it. Errors the `on_chunk` handler reports through its yield
+// argument stop the transfer. The `data` member of the returned
+// CachedContent is left empty, its `size` is that of the whole content.
+template<class Db>
+inline
+CachedContent get_content_range( Db& db
+                               , std::string url
+                               , uint64_t offset
+                               , uint64_t length
+                               , const OnContentChunk& on_chunk
+                               , LookupTrace* trace
+                               , asio::yield_context yield)
+{
+    sys::error_code ec;
+
+    auto entry = query_content_entry(db, url, trace, yield[ec]);
+
+    if (ec) {
+        return or_throw<CachedContent>(yield, ec);
+    }
+
+    // Spans the whole transfer, including the time `on_chunk` takes.
+    size_t span = trace ? trace->begin(LookupTrace::Step::cat) : 0;
+    size_t bytes = 0;
+
+    auto end_span = defer([&] {
+            if (!trace) return;
+            auto& s = trace->end(span);
+            s.cid   = entry.cid;
+            s.bytes = bytes;
+            s.ec    = ec;
+        });
+
+    CachedContent content{entry.ts, {}, entry.content_type};
+
+    if (auto data = db.backend().find_cached(entry.cid)) {
+        content.size = data->size();
+
+        if (offset >= content.size) {
+            return content;
+        }
+
+        length = std::min(length, content.size - offset);
+
+        while (!ec && bytes < length) {
+            size_t size = std::min<uint64_t>(CONTENT_CHUNK_SIZE, length - bytes);
+
+            auto chunk = asio::buffer(data->data() + offset + bytes, size);
+
+            bytes += size;
+
+            on_chunk(chunk, yield[ec]);
+        }
+
+        return or_throw(yield, ec, std::move(content));
     }
 
+    uint64_t reader = db.backend().cat_open(entry.cid, yield[ec]);
+
     if (ec) {
         return or_throw<CachedContent>(yield, ec);
     }
 
-    std::string s = db.backend().cat(content_hash, yield[ec]);
+    auto on_exit = defer([reader] { Backend::cat_close(reader); });
+
+    content.size = Backend::reader_size(reader);
+
+    if (offset >= content.size) {
+        return content;
+    }
+
+    if (offset) {
+        db.backend().seek(reader, offset, yield[ec]);
+    }
+
+    length = std::min(length, content.size - offset);
+
+    // Content read whole which fits in the block cache is kept there.
+    bool cache = offset == 0
+              && length == content.size
+              && content.size <= db.backend().max_cached_size();
 
-    return or_throw(yield, ec, CachedContent{ts, move(s)});
+    std::string whole;
+
+    while (!ec && bytes < length) {
+        size_t max_size = std::min<uint64_t>(CONTENT_CHUNK_SIZE, length - bytes);
+
+        std::string chunk = db.backend().read(reader, max_size, yield[ec]);
+
+        if (ec || chunk.empty()) break;
+
+        bytes += chunk.size();
+
+        if (cache) whole += chunk;
+
+        on_chunk(asio::buffer(chunk), yield[ec]);
+    }
+
+    if (!ec && cache && whole.size() == content.size) {
+        db.backend().insert_cached(entry.cid, std::move(whole));
+    }
+
+    return or_throw(yield, ec, std::move(content));
+}
+
+// Same as above, buffering the range in the `data` member of the returned
+// CachedContent.
+template<class Db>
+inline
+CachedContent get_content_range( Db& db
+                               , std::string url
+                               , uint64_t offset
+                               , uint64_t length
+                               , LookupTrace* trace
+                               , asio::yield_context yield)
+{
+    sys::error_code ec;
+    std::string data;
+
+    auto on_chunk = [&data] (asio::const_buffer b, asio::yield_context) {
+        data.append( asio::buffer_cast<const char*>(b)
+                   , asio::buffer_size(b));
+    };
+
+    auto content = get_content_range( db, move(url), offset, length
+                                    , on_chunk, trace, yield[ec]);
+
+    content.data = move(data);
+
+    return or_throw(yield, ec, std::move(content));
+}
+
+// Same as the buffering `get_content` above, but instead of buffering the
+// whole content in memory it is passed to `on_chunk` piece by piece as it
+// arrives from IPFS. The `data` member of the returned CachedContent is
+// left empty.
+template<class Db>
+inline
+CachedContent get_content( Db& db
+                         , std::string url
+                         , const OnContentChunk& on_chunk
+                         , LookupTrace* trace
+                         , asio::yield_context yield)
+{
+    return get_content_range( db, move(url)
+                            , 0, std::numeric_limits<uint64_t>::max()
+                            , on_chunk, trace, yield);
 }
 
 } // ipfs_cache namespace
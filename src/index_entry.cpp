@@ -0,0 +1,166 @@
+#include "index_entry.h"
+#include "cid.h"
+#include "encoding.h"
+
+#include <assert.h>
+#include <json.hpp>
+
+using namespace std;
+using namespace ipfs_cache;
+
+namespace pt = boost::posix_time;
+
+using Json = nlohmann::json;
+
+const uint8_t IndexEntry::VERSION;
+
+static const pt::ptime epoch(boost::gregorian::date(1970, 1, 1));
+
+// Multihash prefix of sha2-256 hashes, which all version 0 CIDs are.
+static const char SHA2_256_PREFIX[] = { 0x12, 0x20 };
+
+static void put_u64(string& out, uint64_t v)
+{
+    for (int i = 7; i >= 0; --i) out += char((v >> (8*i)) & 0xff);
+}
+
+static uint64_t get_u64(const char* p)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v = v << 8 | uint8_t(p[i]);
+    return v;
+}
+
+string IndexEntry::encode() const
+{
+    uint8_t flags = 0;
+
+    // Only version 0 CIDs are stored in binary, with the prefix checked so
+    // that they convert back to the same text.
+    boost::optional<string> mh;
+
+    if (cid.size() == CID_V0_SIZE && cid.compare(0, 2, "Qm") == 0) {
+        mh = base58_decode(cid);
+        if (mh && (mh->size() != 34
+                   || mh->compare(0, 2, SHA2_256_PREFIX, 2) != 0)) {
+            mh = boost::none;
+        }
+    }
+
+    const string& cid_bytes = mh ? *mh : cid;
+
+    auto ct = boost::string_view(content_type).substr(0, 255);
+
+    if (!mh)                  flags |= cid_is_text;
+    if (size)                 flags |= has_size;
+    if (!ct.empty())          flags |= has_content_type;
+
+    assert(cid_bytes.size() <= 255);
+
+    string out;
+    out.reserve(2 + 8 + 1 + cid_bytes.size() + 8 + 1 + ct.size());
+
+    out += char(VERSION);
+    out += char(flags);
+    put_u64(out, uint64_t((ts - epoch).total_microseconds()));
+    out += char(cid_bytes.size());
+    out += cid_bytes;
+
+    if (size) put_u64(out, *size);
+
+    if (!ct.empty()) {
+        out += char(ct.size());
+        out.append(ct.data(), ct.size());
+    }
+
+    return out;
+}
+
+boost::optional<IndexEntry> IndexEntry::parse(const string& data)
+{
+    IndexEntryView view;
+
+    if (view.parse(data)) return from(view);
+
+    if (data.empty() || data[0] != '{') return boost::none;
+
+    try {
+        auto json = Json::parse(data);
+
+        IndexEntry e;
+        e.ts  = pt::from_iso_extended_string(json["ts"]);
+        e.cid = json["value"];
+        return e;
+    }
+    catch (const std::exception&) {
+        return boost::none;
+    }
+}
+
+IndexEntry IndexEntry::from(const IndexEntryView& view)
+{
+    IndexEntry e;
+
+    e.ts  = view.ts();
+    e.cid = view.cid();
+    if (view.has_size()) e.size = view.size();
+    e.content_type = view.content_type().to_string();
+
+    return e;
+}
+
+bool IndexEntryView::parse(boost::string_view d)
+{
+    size_t pos = 0;
+
+    auto take = [&] (size_t n) -> const char* {
+        if (d.size() - pos < n) return nullptr;
+        auto p = d.data() + pos;
+        pos += n;
+        return p;
+    };
+
+    auto version = take(1);
+    if (!version || uint8_t(*version) != IndexEntry::VERSION) return false;
+
+    auto flags = take(1);
+    auto ts    = take(8);
+    auto len   = take(1);
+    if (!flags || !ts || !len) return false;
+
+    auto cid = take(uint8_t(*len));
+    if (!cid) return false;
+
+    _flags = uint8_t(*flags);
+    _ts_us = int64_t(get_u64(ts));
+    _cid   = boost::string_view(cid, uint8_t(*len));
+    _size  = 0;
+    _content_type = boost::string_view();
+
+    if (has_size()) {
+        auto size = take(8);
+        if (!size) return false;
+        _size = get_u64(size);
+    }
+
+    if (_flags & IndexEntry::has_content_type) {
+        auto len = take(1);
+        if (!len) return false;
+        auto ct = take(uint8_t(*len));
+        if (!ct) return false;
+        _content_type = boost::string_view(ct, uint8_t(*len));
+    }
+
+    return true;
+}
+
+pt::ptime IndexEntryView::ts() const
+{
+    return epoch + pt::microseconds(_ts_us);
+}
+
+string IndexEntryView::cid() const
+{
+    if (cid_is_text()) return _cid.to_string();
+    return base58_encode(_cid);
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/optional.hpp>
+#include <boost/utility/string_view.hpp>
+
+namespace ipfs_cache {
+
+class IndexEntryView;
+
+/*
+ * The database value stored under the URL of a content. The binary layout
+ * (all integers big endian) is:
+ *
+ *   u8  version (1)
+ *   u8  flags (see below)
+ *   i64 time stamp in microseconds since the Unix epoch
+ *   u8  length of the CID, followed by the CID: the binary multihash of
+ *       a version 0 CID ("Qm...") or, with `cid_is_text`, any CID as text
+ *   u64 size of the content, if `has_size`
+ *   u8  length of the content type, followed by it, if `has_content_type`
+ *
+ * Older databases store entries as JSON ({"value": <CID>, "ts": <ISO time>}),
+ * these are still read by `parse`.
+ */
+struct IndexEntry {
+    enum Flags : uint8_t {
+        cid_is_text      = 1 << 0,
+        has_size         = 1 << 1,
+        has_content_type = 1 << 2,
+    };
+
+    static const uint8_t VERSION = 1;
+
+    boost::posix_time::ptime ts;
+    std::string cid;
+    boost::optional<uint64_t> size;
+    std::string content_type;
+
+    std::string encode() const;
+
+    // Reads entries of both the binary and the JSON format.
+    static boost::optional<IndexEntry> parse(const std::string&);
+
+    // Copies out what the view points to.
+    static IndexEntry from(const IndexEntryView&);
+};
+
+/*
+ * Reads a binary IndexEntry in place, without allocating. The viewed data
+ * must outlive the view.
+ */
+class IndexEntryView {
+public:
+    // Returns false if `data` isn't a well formed binary entry.
+    bool parse(boost::string_view data);
+
+    int64_t ts_us() const { return _ts_us; }
+    boost::posix_time::ptime ts() const;
+
+    // The binary multihash, or the textual CID if `cid_is_text()`.
+    boost::string_view cid_bytes() const { return _cid; }
+    bool cid_is_text() const { return _flags & IndexEntry::cid_is_text; }
+    // The textual CID (this one allocates).
+    std::string cid() const;
+
+    bool has_size() const { return _flags & IndexEntry::has_size; }
+    uint64_t size() const { return _size; }
+
+    // Empty if the content type isn't known.
+    boost::string_view content_type() const { return _content_type; }
+
+private:
+    uint8_t _flags = 0;
+    int64_t _ts_us = 0;
+    boost::string_view _cid;
+    uint64_t _size = 0;
+    boost::string_view _content_type;
+};
+
+} // ipfs_cache namespace
@@ -1,13 +1,24 @@
 #include <boost/asio/io_service.hpp>
 #include <assert.h>
 #include <iostream>
+#include <fstream>
 #include <chrono>
 
 #include <ipfs_cache/injector.h>
+#include <ipfs_cache/error.h>
 
 #include "backend.h"
+#include "concurrency_limiter.h"
 #include "db.h"
+#include "dedup_cache.h"
+#include "defer.h"
+#include "fair_queue.h"
 #include "get_content.h"
+#include "index_entry.h"
+#include "dispatch.h"
+#include "or_throw.h"
+#include "sha256.h"
+#include "work_thread.h"
 
 using namespace std;
 using namespace ipfs_cache;
@@ -15,11 +26,107 @@ using namespace ipfs_cache;
 namespace asio = boost::asio;
 namespace sys  = boost::system;
 
-Injector::Injector(asio::io_service& ios, string path_to_repo)
+// About 20MB of memory.
+static const size_t MAX_DEDUP_ENTRIES = 100000;
+
+// Round robin weights of the insert priorities, see Injector::Priority.
+static const vector<unsigned> PRIORITY_WEIGHTS = { 16, 4, 1 };
+
+// Size of the pieces in which streamed content is handed over to IPFS, the
+// same as the size of the blocks IPFS splits content into.
+static const size_t STREAM_CHUNK_SIZE = 256 * 1024;
+
+// Contents are hashed in steps of this size, see `insert_content`.
+static const size_t HASH_STEP = 1024 * 1024;
+
+// For pinning a content found in the dedup cache, see `insert_known`.
+static const chrono::seconds KNOWN_PIN_TIMEOUT(10);
+
+// With InsertOptions::add_timeout set, the IPFS operations of an insert
+// are aborted after it plus ADD_TIMEOUT_PER_MB for each MiB they hand over.
+// Taking that long means IPFS is overloaded (see `outcome_of`).
+static const chrono::seconds ADD_TIMEOUT_PER_MB(1);
+
+static Backend::OpOptions add_options( chrono::steady_clock::duration timeout
+                                     , size_t bytes)
+{
+    Backend::OpOptions opts;
+
+    if (timeout.count()) {
+        opts.timeout = timeout + ADD_TIMEOUT_PER_MB * (bytes / (1024 * 1024));
+    }
+
+    return opts;
+}
+
+// Lets the other handlers waiting for the io_service run.
+static void yield_thread(asio::io_service& ios, asio::yield_context yield)
+{
+    using Handler = asio::handler_type< asio::yield_context
+                                      , void(sys::error_code)>::type;
+
+    Handler handler(yield);
+    asio::async_result<Handler> result(handler);
+
+    ios.post([h = wrap_handler<sys::error_code>(move(handler))] {
+            h(sys::error_code());
+        });
+
+    result.get();
+}
+
+static string digest_in_steps( asio::io_service& ios
+                             , const string& value
+                             , asio::yield_context yield)
+{
+    Sha256 hash;
+
+    for (size_t i = 0; i < value.size(); i += HASH_STEP) {
+        if (i) yield_thread(ios, yield);
+        hash.update(value.data() + i, min(HASH_STEP, value.size() - i));
+    }
+
+    return Sha256::to_hex(hash.close());
+}
+
+static ConcurrencyLimiter::Outcome outcome_of(const sys::error_code& ec)
+{
+    using Outcome = ConcurrencyLimiter::Outcome;
+
+    return ec == asio::error::operation_aborted ? Outcome::ignored
+         : ec == asio::error::timed_out         ? Outcome::overloaded
+         :                                        Outcome::done;
+}
+
+Injector::Injector(asio::io_service& ios, string path_to_repo, NodeStorage storage)
+    : Injector(ios, move(path_to_repo), storage, Concurrency())
+{
+}
+
+Injector::Injector( asio::io_service& ios
+                  , string path_to_repo
+                  , NodeStorage storage
+                  , Concurrency concurrency)
     : _backend(new Backend(ios, path_to_repo))
-    , _db(new InjectorDb(*_backend, path_to_repo))
+    , _db(new InjectorDb(*_backend, path_to_repo, storage))
+    , _strand(ios)
+    , _insert_queue(new FairQueue<InsertEntry>(PRIORITY_WEIGHTS))
+    , _waiting(PRIORITY_WEIGHTS.size())
+    , _expiry_timer(ios)
+    , _expiry_at(chrono::steady_clock::time_point::max())
+    , _dedup(new DedupCache(path_to_repo + "/ipfs_cache_dedup", MAX_DEDUP_ENTRIES))
     , _was_destroyed(make_shared<bool>(false))
+    , _file_thread(new WorkThread())
 {
+    ConcurrencyLimiter::Options opts;
+
+    opts.min     = concurrency.min;
+    opts.max     = concurrency.max;
+    opts.initial = concurrency.initial;
+
+    _limiter.reset(new ConcurrencyLimiter(opts));
+
+    update_queue_metrics();
 }
 
 string Injector::ipns_id() const
@@ -27,72 +134,542 @@ string Injector::ipns_id() const
     return _backend->ipns_id();
 }
 
+Metrics Injector::metrics() const
+{
+    auto m = _backend->metrics();
+
+    lock_guard<mutex> lock(_queue_metrics_mutex);
+    m.queues["insert"] = _queue_metrics;
+
+    return m;
+}
+
+void Injector::update_queue_metrics()
+{
+    lock_guard<mutex> lock(_queue_metrics_mutex);
+
+    _queue_metrics.queued          = _insert_queue->size();
+    _queue_metrics.bytes           = _queued_bytes;
+    _queue_metrics.waiting         = _waiting_entries;
+    _queue_metrics.in_flight       = _limiter->in_flight();
+    _queue_metrics.limit           = _limiter->limit();
+    _queue_metrics.limit_increases = _limiter->increases();
+    _queue_metrics.limit_decreases = _limiter->decreases();
+}
+
+void Injector::set_queue_limits(QueueLimits limits)
+{
+    _strand.dispatch([this, wd = _was_destroyed, limits] {
+            if (*wd) return;
+            _queue_limits = limits;
+            start_inserts();
+        });
+}
+
+void Injector::start_inserts()
+{
+    expire_inserts();
+    admit_waiting();
+
+    while (_limiter->can_start()
+           && (!_slot_waiters.empty() || !_insert_queue->empty())) {
+        // Streams in progress first.
+        if (!_slot_waiters.empty()) {
+            auto w = move(_slot_waiters.front());
+            _slot_waiters.pop_front();
+            w(sys::error_code());
+        }
+        else {
+            insert_content_from_queue();
+        }
+
+        admit_waiting();
+    }
+
+    update_queue_metrics();
+}
+
+bool Injector::has_room(const InsertEntry& e) const
+{
+    if (_insert_queue->empty()) return true;
+    if (_insert_queue->size() >= _queue_limits.max_entries) return false;
+    return _queued_bytes + e.value.size() <= _queue_limits.max_bytes;
+}
+
+void Injector::push( InsertEntry e
+                   , Priority priority
+                   , chrono::steady_clock::time_point deadline)
+{
+    _queued_bytes += e.value.size();
+    _insert_queue->push(size_t(priority), move(e), deadline);
+}
+
+bool Injector::has_waiting_room(const InsertEntry& e) const
+{
+    if (_waiting_entries >= _queue_limits.max_waiting_entries) return false;
+    return _waiting_bytes + e.value.size() <= _queue_limits.max_waiting_bytes;
+}
+
+// Higher priorities first. One which doesn't fit into the queue holds back
+// the lower ones, so that big contents don't starve.
+void Injector::admit_waiting()
+{
+    for (auto& waiting : _waiting) {
+        while (!waiting.empty()) {
+            if (!has_room(waiting.front().entry)) return;
+
+            auto w = move(waiting.front());
+            waiting.pop_front();
+
+            --_waiting_entries;
+            _waiting_bytes -= w.entry.value.size();
+
+            push(move(w.entry), w.priority, w.deadline);
+        }
+    }
+}
+
+void Injector::expire_inserts()
+{
+    auto now = chrono::steady_clock::now();
+    auto expired = _insert_queue->expire(now);
+
+    for (auto& e : expired) _queued_bytes -= e.value.size();
+
+    for (auto& waiting : _waiting) {
+        for (auto i = waiting.begin(); i != waiting.end();) {
+            if (i->deadline > now) { ++i; continue; }
+            --_waiting_entries;
+            _waiting_bytes -= i->entry.value.size();
+            expired.push_back(move(i->entry));
+            i = waiting.erase(i);
+        }
+    }
+
+    if (expired.empty()) return;
+
+    {
+        lock_guard<mutex> lock(_queue_metrics_mutex);
+        _queue_metrics.expired += expired.size();
+    }
+
+    for (auto& e : expired) {
+        e.on_insert(asio::error::timed_out, "");
+    }
+}
+
+// Makes sure the expiry timer fires no later than `deadline`.
+void Injector::schedule_expiry(chrono::steady_clock::time_point deadline)
+{
+    // The timer is already set to fire early enough.
+    if (deadline >= _expiry_at) return;
+
+    _expiry_at = deadline;
+    _expiry_timer.expires_at(deadline);
+
+    _expiry_timer.async_wait(_strand.wrap(
+        [this, wd = _was_destroyed] (sys::error_code ec) {
+            if (*wd || ec == asio::error::operation_aborted) return;
+
+            _expiry_at = chrono::steady_clock::time_point::max();
+
+            start_inserts();
+
+            auto next = _insert_queue->next_deadline();
+            for (auto& waiting : _waiting) {
+                for (auto& w : waiting) next = min(next, w.deadline);
+            }
+
+            schedule_expiry(next);
+        }));
+}
+
 void Injector::insert_content_from_queue()
 {
-    if (_insert_queue.empty()) return;
+    if (_insert_queue->empty()) return;
 
-    ++_job_count;
+    auto e = _insert_queue->pop();
+    _queued_bytes -= e.value.size();
 
-    auto e = move(_insert_queue.front());
-    _insert_queue.pop();
+    if (e.source) return insert_stream(move(e));
 
     auto wd = _was_destroyed;
 
     auto value = move(e.value);
+    auto op = _limiter->start(value.size());
+    auto opts = add_options(e.add_timeout, value.size());
 
-    _backend->add( value
-                 , [this, e = move(e), wd]
+    _backend->add( move(value)
+                 , opts
+                 , _strand.wrap([this, e = move(e), op, wd]
                    (sys::error_code eca, string ipfs_id) {
                         if (*wd) return;
 
-                        --_job_count;
-                        insert_content_from_queue();
+                        _limiter->finish(op, outcome_of(eca));
+                        start_inserts();
+
+                        on_added(move(e), eca, move(ipfs_id));
+                   }));
+}
+
+// Streams in progress get a slot of the limiter for each IPFS operation
+// they do and give it back right after, so that the time spent waiting for
+// their source neither holds back other inserts nor is taken for IPFS
+// latency.
+void Injector::insert_stream(InsertEntry e)
+{
+    // Taken when popped from the queue, for opening the add.
+    auto op = _limiter->start(0);
+
+    asio::spawn( _backend->get_io_service()
+               , [this, e = move(e), op, wd = _was_destroyed]
+                 (asio::yield_context yield) mutable {
+        if (*wd) return;
+
+        using Op = ConcurrencyLimiter::Op;
+
+        auto acquire_slot = [&] (size_t bytes, asio::yield_context yield) {
+            using Handler = asio::handler_type< asio::yield_context
+                                              , void(sys::error_code, Op)>::type;
+
+            Handler handler(yield);
+            asio::async_result<Handler> result(handler);
 
-                        if (eca) {
-                            return e.on_insert(eca, move(ipfs_id));
-                        }
+            auto& ios = _backend->get_io_service();
+            auto  h   = wrap_handler<sys::error_code, Op>(move(handler));
 
-                        asio::spawn( _backend->get_io_service()
-                                   , [ key     = move(e.key)
-                                     , ipfs_id = move(ipfs_id)
-                                     , ts      = e.ts
-                                     , cb      = move(e.on_insert)
-                                     , wd      = move(wd)
-                                     , this
-                                     ]
-                                     (asio::yield_context yield) {
-                                         if (*wd) return;
+            _strand.dispatch([this, bytes, &ios, wd, h] {
+                    if (*wd) {
+                        return ios.post([h] {
+                                h(asio::error::operation_aborted, Op());
+                            });
+                    }
 
-                                         sys::error_code ec;
-                                         Json json;
+                    // Streams in progress get slots before new inserts.
+                    _slot_waiters.push_back([this, bytes, &ios, h]
+                                            (sys::error_code ec) {
+                            Op op;
+                            if (!ec) op = _limiter->start(bytes);
+                            ios.post([h, ec, op] { h(ec, op); });
+                        });
 
-                                         json["value"] = ipfs_id;
-                                         json["ts"]    = boost::posix_time::to_iso_extended_string(ts) + 'Z';
+                    start_inserts();
+                });
 
-                                         _db->update(move(key), json.dump(), yield[ec]);
-                                         cb(ec, ipfs_id);
-                                     });
-                   });
+            return result.get();
+        };
+
+        auto release_slot = [&] (Op op, sys::error_code ec) {
+            _strand.dispatch([this, op, ec, wd] {
+                    if (*wd) return;
+
+                    _limiter->finish(op, outcome_of(ec));
+                    start_inserts();
+                });
+        };
+
+        sys::error_code ec;
+        string ipfs_id;
+        Sha256 hash;
+        uint64_t size = 0;
+
+        uint64_t writer = _backend->add_open(add_options(e.add_timeout, 0), yield[ec]);
+
+        if (*wd) return;
+
+        release_slot(op, ec);
+
+        // Released by `add_close`, or here if that isn't reached.
+        auto abort = defer([&] { if (writer) Backend::add_abort(writer); });
+
+        while (!ec) {
+            string chunk(STREAM_CHUNK_SIZE, '\0');
+
+            size_t n = e.source(asio::buffer(&chunk[0], chunk.size()), yield[ec]);
+
+            if (*wd) return;
+            if (ec || n == 0) break;
+
+            chunk.resize(min(n, chunk.size()));
+            hash.update(chunk);
+            size += chunk.size();
+
+            op = acquire_slot(chunk.size(), yield[ec]);
+            if (*wd) return;
+            if (ec) break;
+
+            auto opts = add_options(e.add_timeout, chunk.size());
+            _backend->write(writer, move(chunk), opts, yield[ec]);
+
+            if (*wd) return;
+
+            release_slot(op, ec);
+        }
+
+        if (!ec) op = acquire_slot(0, yield[ec]);
+        if (*wd) return;
+
+        if (!ec) {
+            auto w = writer;
+            writer = 0;
+            ipfs_id = _backend->add_close(w, add_options(e.add_timeout, 0), yield[ec]);
+            if (*wd) return;
+
+            release_slot(op, ec);
+        }
+
+        e.source = nullptr;
+        e.digest = Sha256::to_hex(hash.close());
+        e.size   = size;
+
+        _strand.dispatch([this, e = move(e), ec, ipfs_id = move(ipfs_id), wd]
+                         () mutable {
+                if (*wd) return;
+                on_added(move(e), ec, move(ipfs_id));
+            });
+    });
+}
+
+// Added content is pinned, otherwise a garbage collection of the IPFS
+// repository would remove it while the database (and the dedup cache)
+// still refer to it.
+void Injector::on_added(InsertEntry e, sys::error_code ec, string ipfs_id)
+{
+    if (ec) {
+        return e.on_insert(ec, move(ipfs_id));
+    }
+
+    asio::spawn( _backend->get_io_service()
+               , [ this, e = move(e), ipfs_id = move(ipfs_id)
+                 , wd = _was_destroyed]
+                 (asio::yield_context yield) mutable {
+        sys::error_code ec;
+        _backend->pin(ipfs_id, yield[ec]);
+
+        if (*wd) return;
+        if (ec) return e.on_insert(ec, "");
+
+        _strand.dispatch([this, e = move(e), ipfs_id = move(ipfs_id), wd]
+                         () mutable {
+                if (*wd) return;
+
+                _dedup->insert(e.digest, ipfs_id);
+                update_db(move(e), move(ipfs_id));
+            });
+    });
+}
+
+// Content found in the dedup cache is pinned again rather than added. That
+// is cheap for content which is still pinned, and content which is gone
+// (e.g. added by an older version of the injector which didn't pin it and
+// garbage collected since) is added anew.
+void Injector::insert_known( InsertEntry e
+                           , InsertOptions opts
+                           , string ipfs_id)
+{
+    asio::spawn( _backend->get_io_service()
+               , [ this, e = move(e), opts, ipfs_id = move(ipfs_id)
+                 , wd = _was_destroyed]
+                 (asio::yield_context yield) mutable {
+        Backend::OpOptions pin_opts;
+        pin_opts.timeout = KNOWN_PIN_TIMEOUT;
+
+        sys::error_code ec;
+        _backend->pin(ipfs_id, pin_opts, yield[ec]);
+
+        if (*wd) return;
+
+        _strand.dispatch([ this, e = move(e), opts, ec
+                         , ipfs_id = move(ipfs_id), wd] () mutable {
+                if (*wd) return;
+
+                if (!ec) return update_db(move(e), move(ipfs_id));
+
+                _dedup->erase(e.digest);
+                enqueue(move(e), opts);
+            });
+    });
+}
+
+void Injector::update_db(InsertEntry e, string ipfs_id)
+{
+    asio::spawn( _backend->get_io_service()
+               , [ key   = move(e.key)
+                 , entry = IndexEntry{e.ts, ipfs_id, e.size, move(e.content_type)}
+                 , cb    = move(e.on_insert)
+                 , wd    = _was_destroyed
+                 , this
+                 ]
+                 (asio::yield_context yield) {
+                     if (*wd) return;
+
+                     sys::error_code ec;
+                     _db->update(move(key), entry.encode(), yield[ec]);
+                     cb(ec, entry.cid);
+                 });
 }
 
 void Injector::insert_content( string key
-                             , const string& value
+                             , string value
+                             , function<void(sys::error_code, string)> cb)
+{
+    insert_content(move(key), move(value), InsertOptions(), move(cb));
+}
+
+void Injector::insert_content( string key
+                             , string value
+                             , InsertOptions opts
                              , function<void(sys::error_code, string)> cb)
 {
-    _insert_queue.push(
-            InsertEntry{ move(key)
-                       , move(value)
-                       , boost::posix_time::microsec_clock::universal_time()
-                       , move(cb)});
+    InsertEntry e{ move(key)
+                 , move(value)
+                 , {}
+                 , boost::posix_time::microsec_clock::universal_time()
+                 , move(cb)
+                 , nullptr};
+
+    e.size         = e.value.size();
+    e.content_type = move(opts.content_type);
+    e.add_timeout  = opts.add_timeout;
+
+    // Hashed here rather than on the strand so that inserts from many
+    // threads are hashed in parallel. Big contents are hashed in a
+    // coroutine which lets other handlers run in between its steps.
+    if (e.value.size() <= HASH_STEP) {
+        e.digest = Sha256::to_hex(Sha256::digest(e.value));
+        return insert_hashed(move(e), move(opts));
+    }
+
+    auto& ios = _backend->get_io_service();
+
+    asio::spawn(ios, [this, &ios, wd = _was_destroyed, e = move(e), opts]
+                     (asio::yield_context yield) mutable {
+            e.digest = digest_in_steps(ios, e.value, yield);
+            if (*wd) return;
+            insert_hashed(move(e), move(opts));
+        });
+}
+
+void Injector::insert_hashed(InsertEntry e, InsertOptions opts)
+{
+    _strand.dispatch([this, wd = _was_destroyed, e = move(e), opts] () mutable {
+            if (*wd) return;
+
+            if (auto cid = _dedup->find(e.digest)) {
+                string ipfs_id = *cid;
+                return insert_known(move(e), move(opts), move(ipfs_id));
+            }
+
+            enqueue(move(e), opts);
+        });
+}
+
+void Injector::insert_content( string key
+                             , ReadContent source
+                             , InsertOptions opts
+                             , OnInsert cb)
+{
+    InsertEntry e{ move(key)
+                 , {}
+                 , {}
+                 , boost::posix_time::microsec_clock::universal_time()
+                 , move(cb)
+                 , move(source)};
+
+    e.content_type = move(opts.content_type);
+    e.add_timeout  = opts.add_timeout;
+
+    _strand.dispatch([this, wd = _was_destroyed, e = move(e), opts] () mutable {
+            if (*wd) return;
+            enqueue(move(e), opts);
+        });
+}
+
+void Injector::insert_file( string key
+                          , string path
+                          , InsertOptions opts
+                          , OnInsert cb)
+{
+    auto  file   = make_shared<ifstream>();
+    auto& ios    = _backend->get_io_service();
+    auto& thread = *_file_thread;
+
+    // The file is opened on the first read.
+    auto read = [file, path] (asio::mutable_buffer b) {
+        if (!file->is_open()) {
+            file->open(path, ifstream::binary);
+
+            if (!file->is_open()) {
+                auto ec = errno
+                        ? sys::error_code(errno, sys::system_category())
+                        : make_error_code(sys::errc::no_such_file_or_directory);
+
+                return make_pair(ec, size_t(0));
+            }
+        }
+
+        file->read(asio::buffer_cast<char*>(b), asio::buffer_size(b));
+
+        if (file->bad()) {
+            return make_pair( make_error_code(sys::errc::io_error)
+                            , size_t(0));
+        }
+
+        return make_pair(sys::error_code(), size_t(file->gcount()));
+    };
+
+    // Only called while the injector (and so the thread) exists, see
+    // `insert_stream`.
+    auto source = [read, &ios, &thread] ( asio::mutable_buffer b
+                                        , asio::yield_context yield) {
+        auto r = run_in_thread(thread, ios, [read, b] { return read(b); }, yield);
+        return or_throw(yield, r.first, r.second);
+    };
+
+    insert_content(move(key), move(source), opts, move(cb));
+}
+
+void Injector::enqueue(InsertEntry e, InsertOptions opts)
+{
+    auto deadline = opts.timeout.count()
+                  ? chrono::steady_clock::now() + opts.timeout
+                  : chrono::steady_clock::time_point::max();
 
-    if (_job_count >= _concurrency) {
-        return;
+    // Those waiting for room with the same or a higher priority go first.
+    bool ahead = false;
+    for (size_t p = 0; p <= size_t(opts.priority); ++p) {
+        if (!_waiting[p].empty()) ahead = true;
     }
 
-    insert_content_from_queue();
+    if (ahead || !has_room(e)) {
+        if (!opts.wait_for_room || !has_waiting_room(e)) {
+            {
+                lock_guard<mutex> lock(_queue_metrics_mutex);
+                ++_queue_metrics.rejected;
+            }
+            return e.on_insert(error::queue_full, "");
+        }
+
+        ++_waiting_entries;
+        _waiting_bytes += e.value.size();
+
+        _waiting[size_t(opts.priority)]
+            .push_back(WaitingEntry{move(e), opts.priority, deadline});
+    }
+    else {
+        push(move(e), opts.priority, deadline);
+    }
+
+    start_inserts();
+
+    if (deadline != chrono::steady_clock::time_point::max()) {
+        schedule_expiry(deadline);
+    }
 }
 
-string Injector::insert_content(string key, const string& value, asio::yield_context yield)
+// Runs the callback taking insert function `f` in the calling coroutine.
+template<class F>
+static string insert_in_coro(F&& f, asio::yield_context yield)
 {
     using handler_type = typename asio::handler_type
                            < asio::yield_context
@@ -101,19 +678,54 @@ string Injector::insert_content(string key, const string& value, asio::yield_con
     handler_type handler(yield);
     asio::async_result<handler_type> result(handler);
 
-    insert_content(move(key), value, [h = move(handler)] (sys::error_code ec, string v) mutable {
-            h(ec, move(v));
-        });
+    f(wrap_handler<sys::error_code, string>(move(handler)));
 
     return result.get();
 }
 
+string Injector::insert_content(string key, string value, asio::yield_context yield)
+{
+    return insert_content(move(key), move(value), InsertOptions(), yield);
+}
+
+string Injector::insert_content( string key
+                               , string value
+                               , InsertOptions opts
+                               , asio::yield_context yield)
+{
+    return insert_in_coro([&] (OnInsert cb) {
+            insert_content(move(key), move(value), opts, move(cb));
+        }, yield);
+}
+
+string Injector::insert_content( string key
+                               , ReadContent source
+                               , InsertOptions opts
+                               , asio::yield_context yield)
+{
+    return insert_in_coro([&] (OnInsert cb) {
+            insert_content(move(key), move(source), opts, move(cb));
+        }, yield);
+}
+
+string Injector::insert_file( string key
+                            , string path
+                            , InsertOptions opts
+                            , asio::yield_context yield)
+{
+    return insert_in_coro([&] (OnInsert cb) {
+            insert_file(move(key), move(path), opts, move(cb));
+        }, yield);
+}
+
 CachedContent Injector::get_content(string url, asio::yield_context yield)
 {
-    return ipfs_cache::get_content(*_db, url, yield);
+    return ipfs_cache::get_content(*_db, url, nullptr, yield);
 }
 
 Injector::~Injector()
 {
     *_was_destroyed = true;
+
+    for (auto& w : _slot_waiters) w(asio::error::operation_aborted);
 }
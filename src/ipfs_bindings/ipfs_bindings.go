@@ -11,17 +11,25 @@ import (
 	"bytes"
 	"sort"
 	"unsafe"
+	"reflect"
 	"time"
 	"io"
 	"strings"
+	"strconv"
+	"sync"
 	"io/ioutil"
+	"encoding/json"
 	core "github.com/ipfs/go-ipfs/core"
 	coreapi "github.com/ipfs/go-ipfs/core/coreapi"
 	coreiface "github.com/ipfs/go-ipfs/core/coreapi/interface"
+	caopts "github.com/ipfs/go-ipfs/core/coreapi/interface/options"
 	repo "github.com/ipfs/go-ipfs/repo"
 	fsrepo "github.com/ipfs/go-ipfs/repo/fsrepo"
 	config "github.com/ipfs/go-ipfs/repo/config"
 	path "github.com/ipfs/go-ipfs/path"
+	dag "github.com/ipfs/go-ipfs/merkledag"
+	ft "github.com/ipfs/go-ipfs/unixfs"
+	uio "github.com/ipfs/go-ipfs/unixfs/io"
 	"github.com/ipfs/go-ipfs/core/coreunix"
 
 	peer "gx/ipfs/QmZoWKhxUmZ2seW4BzX6fJkNR8hh9PsGModr7q171yq2SS/go-libp2p-peer"
@@ -46,6 +54,14 @@ import (
 //{
 //    ((void(*)(int, char*, size_t, void*)) func)(err, data, size, arg);
 //}
+//static void execute_uint64_cb(void* func, int err, uint64_t value, void* arg)
+//{
+//    ((void(*)(int, uint64_t, void*)) func)(err, value, arg);
+//}
+//static void execute_batch_cb(void* func, int* errs, void** data, size_t* sizes, size_t count, void* arg)
+//{
+//    ((void(*)(int*, void**, size_t*, size_t, void*)) func)(errs, data, sizes, count, arg);
+//}
 //#endif // if IN_GO
 import "C"
 
@@ -149,6 +165,224 @@ type Cache struct {
 
 var g Cache
 
+// Readers opened with go_ipfs_cache_cat_open, indexed by the id handed over
+// to the C++ side. Reads, seeks and the close of a reader run in goroutines
+// of their own, the mutex keeps them from using the reader at the same time
+// and `closed` keeps the ones which got the reader before it was removed
+// from using it after the close.
+type catReader struct {
+	sync.Mutex
+	reader uio.DagReader
+	cancel context.CancelFunc
+	closed bool
+}
+
+type readerRegistry struct {
+	sync.Mutex
+	next    uint64
+	readers map[uint64]*catReader
+}
+
+var readers = readerRegistry{readers: make(map[uint64]*catReader)}
+
+func (r *readerRegistry) add(reader *catReader) uint64 {
+	r.Lock()
+	defer r.Unlock()
+	r.next++
+	r.readers[r.next] = reader
+	return r.next
+}
+
+func (r *readerRegistry) get(id uint64) (*catReader, bool) {
+	r.Lock()
+	defer r.Unlock()
+	reader, ok := r.readers[id]
+	return reader, ok
+}
+
+func (r *readerRegistry) remove(id uint64) (*catReader, bool) {
+	r.Lock()
+	defer r.Unlock()
+	reader, ok := r.readers[id]
+	delete(r.readers, id)
+	return reader, ok
+}
+
+// Streaming adds opened with go_ipfs_cache_add_open, indexed by the id
+// handed over to the C++ side. The add reads the content from the pipe the
+// C++ side writes into.
+type addWriter struct {
+	writer *io.PipeWriter
+	result chan addResult
+	cancel context.CancelFunc
+}
+
+type addResult struct {
+	cid string
+	err C.int
+}
+
+type writerRegistry struct {
+	sync.Mutex
+	next    uint64
+	writers map[uint64]addWriter
+}
+
+var writers = writerRegistry{writers: make(map[uint64]addWriter)}
+
+func (r *writerRegistry) add(writer addWriter) uint64 {
+	r.Lock()
+	defer r.Unlock()
+	r.next++
+	r.writers[r.next] = writer
+	return r.next
+}
+
+func (r *writerRegistry) get(id uint64) (addWriter, bool) {
+	r.Lock()
+	defer r.Unlock()
+	writer, ok := r.writers[id]
+	return writer, ok
+}
+
+func (r *writerRegistry) remove(id uint64) (addWriter, bool) {
+	r.Lock()
+	defer r.Unlock()
+	writer, ok := r.writers[id]
+	delete(r.writers, id)
+	return writer, ok
+}
+
+// Cancel functions of operations in progress, indexed by ids chosen by the
+// C++ side. Operations started with a zero id can't be cancelled.
+type opRegistry struct {
+	sync.Mutex
+	cancels map[uint64]context.CancelFunc
+}
+
+var ops = opRegistry{cancels: make(map[uint64]context.CancelFunc)}
+
+func (r *opRegistry) get(id uint64) context.CancelFunc {
+	r.Lock()
+	defer r.Unlock()
+	return r.cancels[id]
+}
+
+// Returns the context of a single operation and a function to be called
+// once the operation is done. This must be called before the exported
+// function returns, otherwise a cancellation from the C++ side could
+// arrive before the operation is registered.
+func opContext(id C.uint64_t, timeout_ms C.int64_t) (context.Context, func()) {
+	var ctx context.Context
+	var cancel context.CancelFunc
+
+	if timeout_ms > 0 {
+		ctx, cancel = context.WithTimeout(g.ctx, time.Duration(timeout_ms) * time.Millisecond)
+	} else {
+		ctx, cancel = context.WithCancel(g.ctx)
+	}
+
+	if id == 0 {
+		return ctx, cancel
+	}
+
+	ops.Lock()
+	ops.cancels[uint64(id)] = cancel
+	ops.Unlock()
+
+	return ctx, func() {
+		ops.Lock()
+		delete(ops.cancels, uint64(id))
+		ops.Unlock()
+		cancel()
+	}
+}
+
+// If the operation failed because its context was cancelled or timed out,
+// returns the corresponding error code instead of `err`.
+func opError(ctx context.Context, err C.int) C.int {
+	switch ctx.Err() {
+	case context.Canceled:
+		return C.IPFS_CANCELED
+	case context.DeadlineExceeded:
+		return C.IPFS_TIMED_OUT
+	}
+	return err
+}
+
+// Points the header of the slice at `p` with `n` elements. Unlike slicing a
+// pointer to a big array type this works for any `n`, whereas the array type
+// would make the runtime panic past its size.
+func setSlice(slice unsafe.Pointer, p unsafe.Pointer, n C.size_t) {
+	h := (*reflect.SliceHeader)(slice)
+	h.Data = uintptr(p)
+	h.Len  = int(n)
+	h.Cap  = int(n)
+}
+
+// Returns a slice backed by C memory of the given size (no copying is done).
+// The C side is responsible for keeping the memory alive while it is in use.
+func cBytes(p unsafe.Pointer, size C.size_t) []byte {
+	var b []byte
+	setSlice(unsafe.Pointer(&b), p, size)
+	return b
+}
+
+// Same as cBytes, for the arrays of buffers and sizes of the add functions.
+func cPointers(p unsafe.Pointer, count C.size_t) []unsafe.Pointer {
+	var ps []unsafe.Pointer
+	setSlice(unsafe.Pointer(&ps), p, count)
+	return ps
+}
+
+func cSizes(p unsafe.Pointer, count C.size_t) []C.size_t {
+	var ss []C.size_t
+	setSlice(unsafe.Pointer(&ss), p, count)
+	return ss
+}
+
+// Converts an array of `count` C strings into Go strings.
+func cStrings(c_strs unsafe.Pointer, count C.size_t) []string {
+	var ptrs []*C.char
+	setSlice(unsafe.Pointer(&ptrs), c_strs, count)
+	ret  := make([]string, len(ptrs))
+
+	for i, p := range ptrs {
+		ret[i] = C.GoString(p)
+	}
+
+	return ret
+}
+
+// Hands per item results of a batch operation over to the C side with a
+// single callback. The `data` argument may be nil for operations which
+// don't produce any.
+func executeBatchCb(fn unsafe.Pointer, fn_arg unsafe.Pointer, errs []C.int, data [][]byte) {
+	count := len(errs)
+
+	if count == 0 {
+		C.execute_batch_cb(fn, nil, nil, nil, C.size_t(0), fn_arg)
+		return
+	}
+
+	cdata := make([]unsafe.Pointer, count)
+	sizes := make([]C.size_t, count)
+
+	for i := range data {
+		if len(data[i]) == 0 { continue }
+		cdata[i] = C.CBytes(data[i])
+		sizes[i] = C.size_t(len(data[i]))
+	}
+
+	defer func() {
+		for _, d := range cdata {
+			if d != nil { C.free(d) }
+		}
+	}()
+
+	C.execute_batch_cb(fn, &errs[0], &cdata[0], &sizes[0], C.size_t(count), fn_arg)
+}
+
 func start_cache(repoRoot string) C.int {
 	g.ctx, g.cancel = context.WithCancel(context.Background())
 
@@ -197,24 +431,35 @@ func go_ipfs_cache_stop() {
 	g.cancel()
 }
 
+// Aborts the operation started with the given `op_id`. Does nothing if the
+// operation has already finished.
+//export go_ipfs_cache_cancel
+func go_ipfs_cache_cancel(op_id C.uint64_t) {
+	if cancel := ops.get(uint64(op_id)); cancel != nil {
+		cancel()
+	}
+}
+
 //export go_ipfs_cache_resolve
-func go_ipfs_cache_resolve(c_ipns_id *C.char, fn unsafe.Pointer, fn_arg unsafe.Pointer) {
+func go_ipfs_cache_resolve(c_ipns_id *C.char, op_id C.uint64_t, timeout_ms C.int64_t, fn unsafe.Pointer, fn_arg unsafe.Pointer) {
 	ipns_id := C.GoString(c_ipns_id)
+	ctx, done := opContext(op_id, timeout_ms)
 
 	go func() {
+		defer done()
+
 		if debug {
 			fmt.Println("go_ipfs_cache_resolve start");
 			defer fmt.Println("go_ipfs_cache_resolve end");
 		}
 
-		ctx := g.ctx
 		n := g.node
 		p := path.Path("/ipns/" + ipns_id)
 
 		node, err := core.Resolve(ctx, n.Namesys, n.Resolver, p)
 
 		if err != nil {
-			C.execute_data_cb(fn, C.IPFS_RESOLVE_FAILED, nil, C.size_t(0), fn_arg)
+			C.execute_data_cb(fn, opError(ctx, C.IPFS_RESOLVE_FAILED), nil, C.size_t(0), fn_arg)
 			return
 		}
 
@@ -261,20 +506,23 @@ func publish(ctx context.Context, duration time.Duration, n *core.IpfsNode, cid
 }
 
 //export go_ipfs_cache_publish
-func go_ipfs_cache_publish(cid *C.char, seconds C.int64_t, fn unsafe.Pointer, fn_arg unsafe.Pointer) {
+func go_ipfs_cache_publish(cid *C.char, seconds C.int64_t, op_id C.uint64_t, timeout_ms C.int64_t, fn unsafe.Pointer, fn_arg unsafe.Pointer) {
 	id := C.GoString(cid)
+	ctx, done := opContext(op_id, timeout_ms)
 
 	go func() {
+		defer done()
+
 		if debug {
 			fmt.Println("go_ipfs_cache_publish start");
 			defer fmt.Println("go_ipfs_cache_publish end");
 		}
 
 		// https://stackoverflow.com/questions/17573190/how-to-multiply-duration-by-integer
-		err := publish(g.ctx, time.Duration(seconds) * time.Second, g.node, id);
+		err := publish(ctx, time.Duration(seconds) * time.Second, g.node, id);
 
 		if err != nil {
-			C.execute_void_cb(fn, C.IPFS_PUBLISH_FAILED, fn_arg)
+			C.execute_void_cb(fn, opError(ctx, C.IPFS_PUBLISH_FAILED), fn_arg)
 			return
 		}
 
@@ -282,21 +530,33 @@ func go_ipfs_cache_publish(cid *C.char, seconds C.int64_t, fn unsafe.Pointer, fn
 	}()
 }
 
+// Adds the concatenation of `count` buffers as a single piece of content.
+// The buffers are read in place, the C side must keep them alive until the
+// callback is called.
 //export go_ipfs_cache_add
-func go_ipfs_cache_add(data unsafe.Pointer, size C.size_t, fn unsafe.Pointer, fn_arg unsafe.Pointer) {
-	msg := C.GoBytes(data, C.int(size))
+func go_ipfs_cache_add(c_bufs unsafe.Pointer, c_sizes unsafe.Pointer, count C.size_t, op_id C.uint64_t, timeout_ms C.int64_t, fn unsafe.Pointer, fn_arg unsafe.Pointer) {
+	bufs  := cPointers(c_bufs, count)
+	sizes := cSizes(c_sizes, count)
+	ctx, done := opContext(op_id, timeout_ms)
 
 	go func() {
+		defer done()
+
 		if debug {
 			fmt.Println("go_ipfs_cache_add start");
 			defer fmt.Println("go_ipfs_cache_add end");
 		}
 
-		cid, err := coreunix.Add(g.node, bytes.NewReader(msg))
+		readers := make([]io.Reader, len(bufs))
 
-		if err != nil {
-			fmt.Println("Error: failed to insert content ", err)
-			C.execute_data_cb(fn, C.IPFS_ADD_FAILED, nil, C.size_t(0), fn_arg)
+		for i := range bufs {
+			readers[i] = bytes.NewReader(cBytes(bufs[i], sizes[i]))
+		}
+
+		cid, err := add(ctx, io.MultiReader(readers...))
+
+		if err != C.IPFS_SUCCESS {
+			C.execute_data_cb(fn, err, nil, C.size_t(0), fn_arg)
 			return;
 		}
 
@@ -307,28 +567,262 @@ func go_ipfs_cache_add(data unsafe.Pointer, size C.size_t, fn unsafe.Pointer, fn
 	}()
 }
 
-//export go_ipfs_cache_cat
-func go_ipfs_cache_cat(c_cid *C.char, fn unsafe.Pointer, fn_arg unsafe.Pointer) {
-	cid := C.GoString(c_cid)
+func add(ctx context.Context, r io.Reader) (string, C.int) {
+	cid, err := coreunix.AddWithContext(ctx, g.node, r)
+
+	if err != nil {
+		fmt.Println("Error: failed to insert content ", err)
+		return "", opError(ctx, C.IPFS_ADD_FAILED)
+	}
+
+	return cid, C.IPFS_SUCCESS
+}
+
+// Stores `size` bytes of `c_data` as the data of a plain (i.e. not unixfs)
+// IPFS object which links to each of the `count` objects in `c_links`.
+// Pinning such object recursively pins everything it (transitively) links
+// to. The data of these objects is read back with go_ipfs_cache_cat.
+//export go_ipfs_cache_add_object
+func go_ipfs_cache_add_object(c_data unsafe.Pointer, size C.size_t, c_links unsafe.Pointer, count C.size_t, op_id C.uint64_t, timeout_ms C.int64_t, fn unsafe.Pointer, fn_arg unsafe.Pointer) {
+	data  := cBytes(c_data, size)
+	links := cStrings(c_links, count)
+	ctx, done := opContext(op_id, timeout_ms)
 
 	go func() {
+		defer done()
+
 		if debug {
-			fmt.Println("go_ipfs_cache_cat start");
-			defer fmt.Println("go_ipfs_cache_cat end");
+			fmt.Println("go_ipfs_cache_add_object start");
+			defer fmt.Println("go_ipfs_cache_add_object end");
+		}
+
+		cid, err := addObject(ctx, data, links)
+
+		if err != C.IPFS_SUCCESS {
+			C.execute_data_cb(fn, err, nil, C.size_t(0), fn_arg)
+			return;
 		}
 
-		reader, err := coreunix.Cat(g.ctx, g.node, cid)
+		cdata := C.CBytes([]byte(cid))
+		defer C.free(cdata)
+
+		C.execute_data_cb(fn, C.IPFS_SUCCESS, cdata, C.size_t(len(cid)), fn_arg)
+	}()
+}
+
+// Stores `size` bytes of `c_data` as a single raw block, i.e. without the
+// UnixFS import (chunking, DAG building). The CID passed to the callback is
+// the hash of the data itself.
+//export go_ipfs_cache_block_put
+func go_ipfs_cache_block_put(c_data unsafe.Pointer, size C.size_t, op_id C.uint64_t, timeout_ms C.int64_t, fn unsafe.Pointer, fn_arg unsafe.Pointer) {
+	data := cBytes(c_data, size)
+	ctx, done := opContext(op_id, timeout_ms)
+
+	go func() {
+		defer done()
+
+		if debug {
+			fmt.Println("go_ipfs_cache_block_put start");
+			defer fmt.Println("go_ipfs_cache_block_put end");
+		}
+
+		stat, err := g.api.Block().Put(ctx, bytes.NewReader(data), caopts.Block.Format("raw"))
 
 		if err != nil {
-			fmt.Println("go_ipfs_cache_cat failed to Cat");
-			C.execute_data_cb(fn, C.IPFS_CAT_FAILED, nil, C.size_t(0), fn_arg)
+			fmt.Println("go_ipfs_cache_block_put failed ", err)
+			C.execute_data_cb(fn, opError(ctx, C.IPFS_ADD_FAILED), nil, C.size_t(0), fn_arg)
 			return
 		}
 
-		bytes, err := ioutil.ReadAll(reader)
-		if err != nil {
-			fmt.Println("go_ipfs_cache_cat failed to read");
-			C.execute_data_cb(fn, C.IPFS_READ_FAILED, nil, C.size_t(0), fn_arg)
+		cid := stat.Path().Cid().String()
+
+		cdata := C.CBytes([]byte(cid))
+		defer C.free(cdata)
+
+		C.execute_data_cb(fn, C.IPFS_SUCCESS, cdata, C.size_t(len(cid)), fn_arg)
+	}()
+}
+
+// Passes the content of the block `c_cid` as it is stored to the callback.
+//export go_ipfs_cache_block_get
+func go_ipfs_cache_block_get(c_cid *C.char, op_id C.uint64_t, timeout_ms C.int64_t, fn unsafe.Pointer, fn_arg unsafe.Pointer) {
+	cid := C.GoString(c_cid)
+	ctx, done := opContext(op_id, timeout_ms)
+
+	go func() {
+		defer done()
+
+		if debug {
+			fmt.Println("go_ipfs_cache_block_get start");
+			defer fmt.Println("go_ipfs_cache_block_get end");
+		}
+
+		data, err := blockGet(ctx, cid)
+
+		if err != C.IPFS_SUCCESS {
+			C.execute_data_cb(fn, err, nil, C.size_t(0), fn_arg)
+			return
+		}
+
+		cdata := C.CBytes(data)
+		defer C.free(cdata)
+
+		C.execute_data_cb(fn, C.IPFS_SUCCESS, cdata, C.size_t(len(data)), fn_arg)
+	}()
+}
+
+func blockGet(ctx context.Context, cid string) ([]byte, C.int) {
+	p, err := coreapi.ParsePath(cid)
+
+	if err != nil {
+		fmt.Printf("go_ipfs_cache_block_get failed to parse %q %q\n", cid, err)
+		return nil, C.IPFS_CAT_FAILED
+	}
+
+	r, err := g.api.Block().Get(ctx, p)
+
+	if err != nil {
+		fmt.Printf("go_ipfs_cache_block_get failed to get %q %q\n", cid, err)
+		return nil, opError(ctx, C.IPFS_CAT_FAILED)
+	}
+
+	data, err := ioutil.ReadAll(r)
+
+	if err != nil {
+		fmt.Printf("go_ipfs_cache_block_get failed to read %q %q\n", cid, err)
+		return nil, opError(ctx, C.IPFS_READ_FAILED)
+	}
+
+	return data, C.IPFS_SUCCESS
+}
+
+// The JSON encoding of objects accepted by the Object API's Put.
+type objectLink struct {
+	Name string
+	Hash string
+	Size uint64
+}
+
+type object struct {
+	Data  string
+	Links []objectLink
+}
+
+func addObject(ctx context.Context, data []byte, links []string) (string, C.int) {
+	obj := object{Data: string(data), Links: make([]objectLink, len(links))}
+
+	for i, l := range links {
+		obj.Links[i] = objectLink{Name: strconv.Itoa(i), Hash: l}
+	}
+
+	encoded, err := json.Marshal(obj)
+
+	if err != nil {
+		fmt.Println("Error: failed to encode object ", err)
+		return "", C.IPFS_ADD_FAILED
+	}
+
+	p, err := g.api.Object().Put(ctx, bytes.NewReader(encoded))
+
+	if err != nil {
+		fmt.Println("Error: failed to put object ", err)
+		return "", opError(ctx, C.IPFS_ADD_FAILED)
+	}
+
+	return p.Cid().String(), C.IPFS_SUCCESS
+}
+
+// The node is fetched once and read according to its type, so that plain
+// objects created by go_ipfs_cache_add_object (e.g. the nodes of a database
+// stored as linked objects) don't first fail to be read as UnixFS.
+func cat(ctx context.Context, cid string) ([]byte, C.int) {
+	n := g.node
+
+	node, err := core.Resolve(ctx, n.Namesys, n.Resolver, path.Path(cid))
+
+	if err != nil {
+		fmt.Println("go_ipfs_cache_cat failed to resolve");
+		return nil, opError(ctx, C.IPFS_CAT_FAILED)
+	}
+
+	// Unixfs nodes which can't be cat'ed (e.g. directories) aren't plain
+	// objects, the reader below fails on them.
+	if pn, ok := node.(*dag.ProtoNode); ok {
+		if _, err := ft.FromBytes(pn.Data()); err != nil {
+			return pn.Data(), C.IPFS_SUCCESS
+		}
+	}
+
+	reader, err := uio.NewDagReader(ctx, node, n.DAG)
+
+	if err != nil {
+		fmt.Println("go_ipfs_cache_cat failed to Cat");
+		return nil, opError(ctx, C.IPFS_CAT_FAILED)
+	}
+
+	bytes, err := ioutil.ReadAll(reader)
+
+	if err != nil {
+		fmt.Println("go_ipfs_cache_cat failed to read");
+		return nil, opError(ctx, C.IPFS_READ_FAILED)
+	}
+
+	return bytes, C.IPFS_SUCCESS
+}
+
+func pin(ctx context.Context, cid string) C.int {
+	path, err := coreapi.ParsePath(cid)
+
+	if err != nil {
+		fmt.Printf("go_ipfs_cache_pin failed to pin %q %q\n", cid, err)
+		return C.IPFS_PIN_FAILED
+	}
+
+	err = g.api.Pin().Add(ctx, path)
+
+	if err != nil {
+		fmt.Printf("go_ipfs_cache_pin failed to pin %q %q\n", cid, err)
+		return opError(ctx, C.IPFS_PIN_FAILED)
+	}
+
+	return C.IPFS_SUCCESS
+}
+
+func unpin(ctx context.Context, cid string) C.int {
+	path, err := coreapi.ParsePath(cid)
+
+	if err != nil {
+		fmt.Printf("go_ipfs_cache_unpin failed to unpin %q %q\n", cid, err)
+		return C.IPFS_UNPIN_FAILED
+	}
+
+	err = g.api.Pin().Rm(ctx, path)
+
+	if err != nil {
+		fmt.Printf("go_ipfs_cache_unpin failed to unpin %q %q\n", cid, err);
+		return opError(ctx, C.IPFS_UNPIN_FAILED)
+	}
+
+	return C.IPFS_SUCCESS
+}
+
+//export go_ipfs_cache_cat
+func go_ipfs_cache_cat(c_cid *C.char, op_id C.uint64_t, timeout_ms C.int64_t, fn unsafe.Pointer, fn_arg unsafe.Pointer) {
+	cid := C.GoString(c_cid)
+	ctx, done := opContext(op_id, timeout_ms)
+
+	go func() {
+		defer done()
+
+		if debug {
+			fmt.Println("go_ipfs_cache_cat start");
+			defer fmt.Println("go_ipfs_cache_cat end");
+		}
+
+		bytes, err := cat(ctx, cid)
+
+		if err != C.IPFS_SUCCESS {
+			C.execute_data_cb(fn, err, nil, C.size_t(0), fn_arg)
 			return
 		}
 
@@ -340,58 +834,441 @@ func go_ipfs_cache_cat(c_cid *C.char, fn unsafe.Pointer, fn_arg unsafe.Pointer)
 }
 
 //export go_ipfs_cache_pin
-func go_ipfs_cache_pin(c_cid *C.char, fn unsafe.Pointer, fn_arg unsafe.Pointer) {
+func go_ipfs_cache_pin(c_cid *C.char, op_id C.uint64_t, timeout_ms C.int64_t, fn unsafe.Pointer, fn_arg unsafe.Pointer) {
 	cid := C.GoString(c_cid)
+	ctx, done := opContext(op_id, timeout_ms)
 
 	go func() {
+		defer done()
+
 		if debug {
 			fmt.Println("go_ipfs_cache_pin start");
 			defer fmt.Println("go_ipfs_cache_pin end");
 		}
 
-		path, err := coreapi.ParsePath(cid)
+		C.execute_void_cb(fn, pin(ctx, cid), fn_arg)
+	}()
+}
+
+//export go_ipfs_cache_unpin
+func go_ipfs_cache_unpin(c_cid *C.char, op_id C.uint64_t, timeout_ms C.int64_t, fn unsafe.Pointer, fn_arg unsafe.Pointer) {
+	cid := C.GoString(c_cid)
+	ctx, done := opContext(op_id, timeout_ms)
+
+	go func() {
+		defer done()
+
+		if debug {
+			fmt.Println("go_ipfs_cache_unpin start");
+			defer fmt.Println("go_ipfs_cache_unpin end");
+		}
+
+		C.execute_void_cb(fn, unpin(ctx, cid), fn_arg)
+	}()
+}
+
+// The *_many functions below are batched versions of the above. The whole
+// batch is passed in a single call and its results are handed back with a
+// single execute_batch_cb callback. Fetches run concurrently, modifications
+// of the pin set are done one after another. The `op_id` and `timeout_ms`
+// arguments apply to the batch as a whole.
+
+//export go_ipfs_cache_cat_many
+func go_ipfs_cache_cat_many(c_cids unsafe.Pointer, count C.size_t, op_id C.uint64_t, timeout_ms C.int64_t, fn unsafe.Pointer, fn_arg unsafe.Pointer) {
+	cids := cStrings(c_cids, count)
+	ctx, done := opContext(op_id, timeout_ms)
+
+	go func() {
+		defer done()
+
+		if debug {
+			fmt.Println("go_ipfs_cache_cat_many start");
+			defer fmt.Println("go_ipfs_cache_cat_many end");
+		}
+
+		errs := make([]C.int, len(cids))
+		data := make([][]byte, len(cids))
+
+		var wg sync.WaitGroup
+		wg.Add(len(cids))
+
+		for i := range cids {
+			go func(i int) {
+				defer wg.Done()
+				data[i], errs[i] = cat(ctx, cids[i])
+			}(i)
+		}
+
+		wg.Wait()
+
+		executeBatchCb(fn, fn_arg, errs, data)
+	}()
+}
+
+// Each of the `count` buffers is added as a separate piece of content. As
+// with go_ipfs_cache_add, the buffers are read in place.
+//export go_ipfs_cache_add_many
+func go_ipfs_cache_add_many(c_bufs unsafe.Pointer, c_sizes unsafe.Pointer, count C.size_t, op_id C.uint64_t, timeout_ms C.int64_t, fn unsafe.Pointer, fn_arg unsafe.Pointer) {
+	bufs  := cPointers(c_bufs, count)
+	sizes := cSizes(c_sizes, count)
+	ctx, done := opContext(op_id, timeout_ms)
+
+	go func() {
+		defer done()
+
+		if debug {
+			fmt.Println("go_ipfs_cache_add_many start");
+			defer fmt.Println("go_ipfs_cache_add_many end");
+		}
+
+		errs := make([]C.int, len(bufs))
+		data := make([][]byte, len(bufs))
+
+		for i := range bufs {
+			var cid string
+			cid, errs[i] = add(ctx, bytes.NewReader(cBytes(bufs[i], sizes[i])))
+			data[i] = []byte(cid)
+		}
+
+		executeBatchCb(fn, fn_arg, errs, data)
+	}()
+}
+
+//export go_ipfs_cache_pin_many
+func go_ipfs_cache_pin_many(c_cids unsafe.Pointer, count C.size_t, op_id C.uint64_t, timeout_ms C.int64_t, fn unsafe.Pointer, fn_arg unsafe.Pointer) {
+	cids := cStrings(c_cids, count)
+	ctx, done := opContext(op_id, timeout_ms)
+
+	go func() {
+		defer done()
+
+		if debug {
+			fmt.Println("go_ipfs_cache_pin_many start");
+			defer fmt.Println("go_ipfs_cache_pin_many end");
+		}
+
+		errs := make([]C.int, len(cids))
+
+		for i := range cids {
+			errs[i] = pin(ctx, cids[i])
+		}
+
+		executeBatchCb(fn, fn_arg, errs, nil)
+	}()
+}
+
+//export go_ipfs_cache_unpin_many
+func go_ipfs_cache_unpin_many(c_cids unsafe.Pointer, count C.size_t, op_id C.uint64_t, timeout_ms C.int64_t, fn unsafe.Pointer, fn_arg unsafe.Pointer) {
+	cids := cStrings(c_cids, count)
+	ctx, done := opContext(op_id, timeout_ms)
+
+	go func() {
+		defer done()
+
+		if debug {
+			fmt.Println("go_ipfs_cache_unpin_many start");
+			defer fmt.Println("go_ipfs_cache_unpin_many end");
+		}
+
+		errs := make([]C.int, len(cids))
+
+		for i := range cids {
+			errs[i] = unpin(ctx, cids[i])
+		}
+
+		executeBatchCb(fn, fn_arg, errs, nil)
+	}()
+}
+
+//export go_ipfs_cache_cat_open
+func go_ipfs_cache_cat_open(c_cid *C.char, op_id C.uint64_t, timeout_ms C.int64_t, fn unsafe.Pointer, fn_arg unsafe.Pointer) {
+	cid := C.GoString(c_cid)
+	ctx, done := opContext(op_id, timeout_ms)
+
+	go func() {
+		defer done()
+
+		if debug {
+			fmt.Println("go_ipfs_cache_cat_open start");
+			defer fmt.Println("go_ipfs_cache_cat_open end");
+		}
+
+		// The reader outlives this operation (it keeps fetching blocks in
+		// the background) so it gets a context of its own. Until the reader
+		// is opened, that context is also bound to the one of this
+		// operation.
+		rctx, rcancel := context.WithCancel(g.ctx)
+		opened := make(chan struct{})
+
+		go func() {
+			select {
+			case <-opened:
+			case <-ctx.Done():
+				// `done` cancels the context once the reader is opened,
+				// which must not stop the reader.
+				select {
+				case <-opened:
+				default: rcancel()
+				}
+			}
+		}()
+
+		reader, err := coreunix.Cat(rctx, g.node, cid)
+		close(opened)
+
+		if err == nil && ctx.Err() != nil {
+			reader.Close()
+			err = ctx.Err()
+		}
 
 		if err != nil {
-			fmt.Printf("go_ipfs_cache_pin failed to unpin %q %q\n", cid, err)
-			C.execute_void_cb(fn, C.IPFS_PIN_FAILED, fn_arg)
+			rcancel()
+			fmt.Println("go_ipfs_cache_cat_open failed to Cat");
+			C.execute_uint64_cb(fn, opError(ctx, C.IPFS_CAT_FAILED), C.uint64_t(0), fn_arg)
 			return
 		}
 
-		err = g.api.Pin().Add(g.ctx, path)
+		id := readers.add(&catReader{reader: reader, cancel: rcancel})
 
-		if err != nil {
-			fmt.Printf("go_ipfs_cache_pin failed to unpin %q %q\n", cid, err)
-			C.execute_void_cb(fn, C.IPFS_PIN_FAILED, fn_arg)
+		C.execute_uint64_cb(fn, C.IPFS_SUCCESS, C.uint64_t(id), fn_arg)
+	}()
+}
+
+// Reads at most `size` bytes from the reader directly into `buf` and passes
+// the number of bytes read to the callback. Zero means end of data.
+//export go_ipfs_cache_read
+func go_ipfs_cache_read(id C.uint64_t, buf unsafe.Pointer, size C.size_t, op_id C.uint64_t, timeout_ms C.int64_t, fn unsafe.Pointer, fn_arg unsafe.Pointer) {
+	ctx, done := opContext(op_id, timeout_ms)
+
+	go func() {
+		defer done()
+
+		if debug {
+			fmt.Println("go_ipfs_cache_read start");
+			defer fmt.Println("go_ipfs_cache_read end");
+		}
+
+		r, ok := readers.get(uint64(id))
+
+		if !ok {
+			fmt.Println("go_ipfs_cache_read invalid reader id");
+			C.execute_uint64_cb(fn, C.IPFS_READ_FAILED, C.uint64_t(0), fn_arg)
 			return
 		}
 
-		C.execute_void_cb(fn, C.IPFS_SUCCESS, fn_arg)
+		r.Lock()
+
+		if r.closed {
+			r.Unlock()
+			fmt.Println("go_ipfs_cache_read reader closed");
+			C.execute_uint64_cb(fn, C.IPFS_READ_FAILED, C.uint64_t(0), fn_arg)
+			return
+		}
+
+		n, err := r.reader.CtxReadFull(ctx, cBytes(buf, size))
+		r.Unlock()
+
+		if err != nil && err != io.EOF && err != io.ErrUnexpectedEOF {
+			fmt.Println("go_ipfs_cache_read failed to read");
+			C.execute_uint64_cb(fn, opError(ctx, C.IPFS_READ_FAILED), C.uint64_t(0), fn_arg)
+			return
+		}
+
+		C.execute_uint64_cb(fn, C.IPFS_SUCCESS, C.uint64_t(n), fn_arg)
 	}()
 }
 
-//export go_ipfs_cache_unpin
-func go_ipfs_cache_unpin(c_cid *C.char, fn unsafe.Pointer, fn_arg unsafe.Pointer) {
-	cid := C.GoString(c_cid)
+// Moves the reader to `offset` bytes from the start of the content (UnixFS
+// readers seek without fetching the blocks in between) and passes the new
+// offset to the callback. Seeking past the end leaves the reader at the end.
+//export go_ipfs_cache_seek
+func go_ipfs_cache_seek(id C.uint64_t, offset C.uint64_t, op_id C.uint64_t, timeout_ms C.int64_t, fn unsafe.Pointer, fn_arg unsafe.Pointer) {
+	ctx, done := opContext(op_id, timeout_ms)
 
 	go func() {
+		defer done()
+
 		if debug {
-			fmt.Println("go_ipfs_cache_unpin start");
-			defer fmt.Println("go_ipfs_cache_unpin end");
+			fmt.Println("go_ipfs_cache_seek start");
+			defer fmt.Println("go_ipfs_cache_seek end");
+		}
+
+		r, ok := readers.get(uint64(id))
+
+		if !ok {
+			fmt.Println("go_ipfs_cache_seek invalid reader id");
+			C.execute_uint64_cb(fn, C.IPFS_READ_FAILED, C.uint64_t(0), fn_arg)
+			return
+		}
+
+		r.Lock()
+
+		if r.closed {
+			r.Unlock()
+			fmt.Println("go_ipfs_cache_seek reader closed");
+			C.execute_uint64_cb(fn, C.IPFS_READ_FAILED, C.uint64_t(0), fn_arg)
+			return
+		}
+
+		size := r.reader.Size()
+		off := uint64(offset)
+
+		if off > size {
+			off = size
 		}
 
-		path, err := coreapi.ParsePath(cid)
+		pos, err := r.reader.Seek(int64(off), io.SeekStart)
+		r.Unlock()
+
+		if err == nil && ctx.Err() != nil {
+			err = ctx.Err()
+		}
 
 		if err != nil {
-			fmt.Printf("go_ipfs_cache_pin failed to unpin %q %q\n", cid, err)
-			C.execute_void_cb(fn, C.IPFS_PIN_FAILED, fn_arg)
+			fmt.Println("go_ipfs_cache_seek failed to seek");
+			C.execute_uint64_cb(fn, opError(ctx, C.IPFS_READ_FAILED), C.uint64_t(0), fn_arg)
 			return
 		}
 
-		err = g.api.Pin().Rm(g.ctx, path)
+		C.execute_uint64_cb(fn, C.IPFS_SUCCESS, C.uint64_t(pos), fn_arg)
+	}()
+}
+
+// Returns the size of the whole content of the reader, zero for unknown
+// readers.
+//export go_ipfs_cache_reader_size
+func go_ipfs_cache_reader_size(id C.uint64_t) C.uint64_t {
+	r, ok := readers.get(uint64(id))
+
+	if !ok {
+		return 0
+	}
+
+	r.Lock()
+	defer r.Unlock()
+
+	if r.closed {
+		return 0
+	}
+
+	return C.uint64_t(r.reader.Size())
+}
+
+// Cancelling first makes a read in progress return, the close then waits
+// for it to let go of the reader.
+//export go_ipfs_cache_cat_close
+func go_ipfs_cache_cat_close(id C.uint64_t) {
+	if r, ok := readers.remove(uint64(id)); ok {
+		r.cancel()
+
+		r.Lock()
+		defer r.Unlock()
+
+		r.closed = true
+		r.reader.Close()
+	}
+}
+
+// Starts adding a piece of content which is then written in chunks with
+// go_ipfs_cache_add_write and finished with go_ipfs_cache_add_close. The
+// add outlives this operation, so it runs in a context of its own which is
+// only cancelled by go_ipfs_cache_add_abort or a failed write or close.
+//export go_ipfs_cache_add_open
+func go_ipfs_cache_add_open(op_id C.uint64_t, timeout_ms C.int64_t, fn unsafe.Pointer, fn_arg unsafe.Pointer) {
+	ctx, done := opContext(op_id, timeout_ms)
+
+	go func() {
+		defer done()
+
+		if debug {
+			fmt.Println("go_ipfs_cache_add_open start");
+			defer fmt.Println("go_ipfs_cache_add_open end");
+		}
+
+		if ctx.Err() != nil {
+			C.execute_uint64_cb(fn, opError(ctx, C.IPFS_ADD_FAILED), C.uint64_t(0), fn_arg)
+			return
+		}
+
+		actx, acancel := context.WithCancel(g.ctx)
+		pr, pw := io.Pipe()
+		result := make(chan addResult, 1)
+
+		go func() {
+			cid, err := add(actx, pr)
+			// Unblocks a pending write if the add gave up early.
+			pr.CloseWithError(io.ErrClosedPipe)
+			result <- addResult{cid, err}
+		}()
+
+		id := writers.add(addWriter{pw, result, acancel})
+
+		C.execute_uint64_cb(fn, C.IPFS_SUCCESS, C.uint64_t(id), fn_arg)
+	}()
+}
+
+// Writes `size` bytes of `buf` to the content of the add. The callback is
+// called once the add has consumed all of them, until then the C side must
+// keep the buffer alive. If this operation is cancelled or times out, the
+// whole add is aborted (the content can't be left half written).
+//export go_ipfs_cache_add_write
+func go_ipfs_cache_add_write(id C.uint64_t, buf unsafe.Pointer, size C.size_t, op_id C.uint64_t, timeout_ms C.int64_t, fn unsafe.Pointer, fn_arg unsafe.Pointer) {
+	ctx, done := opContext(op_id, timeout_ms)
+
+	go func() {
+		defer done()
+
+		if debug {
+			fmt.Println("go_ipfs_cache_add_write start");
+			defer fmt.Println("go_ipfs_cache_add_write end");
+		}
+
+		w, ok := writers.get(uint64(id))
+
+		if !ok {
+			fmt.Println("go_ipfs_cache_add_write invalid writer id");
+			C.execute_void_cb(fn, C.IPFS_ADD_FAILED, fn_arg)
+			return
+		}
+
+		if size == 0 {
+			C.execute_void_cb(fn, C.IPFS_SUCCESS, fn_arg)
+			return
+		}
+
+		abort := func() {
+			w.writer.CloseWithError(ctx.Err())
+			w.cancel()
+		}
+
+		written := make(chan struct{})
+
+		go func() {
+			select {
+			case <-written:
+			case <-ctx.Done():
+				// `done` cancels the context once the write is over,
+				// which must not abort the add.
+				select {
+				case <-written:
+				default: abort()
+				}
+			}
+		}()
+
+		_, err := w.writer.Write(cBytes(buf, size))
+		close(written)
+
+		// Cancelled while writing, the add is aborted whether or not the
+		// watcher above got to it first.
+		if err == nil && ctx.Err() != nil {
+			abort()
+			err = ctx.Err()
+		}
 
 		if err != nil {
-			fmt.Printf("go_ipfs_cache_unpin failed to unpin %q %q\n", cid, err);
-			C.execute_void_cb(fn, C.IPFS_UNPIN_FAILED, fn_arg)
+			fmt.Println("go_ipfs_cache_add_write failed to write");
+			C.execute_void_cb(fn, opError(ctx, C.IPFS_ADD_FAILED), fn_arg)
 			return
 		}
 
@@ -399,3 +1276,56 @@ func go_ipfs_cache_unpin(c_cid *C.char, fn unsafe.Pointer, fn_arg unsafe.Pointer
 	}()
 }
 
+// Ends the content of the add and passes its CID to the callback. The
+// writer is released whether this succeeds or not.
+//export go_ipfs_cache_add_close
+func go_ipfs_cache_add_close(id C.uint64_t, op_id C.uint64_t, timeout_ms C.int64_t, fn unsafe.Pointer, fn_arg unsafe.Pointer) {
+	ctx, done := opContext(op_id, timeout_ms)
+
+	go func() {
+		defer done()
+
+		if debug {
+			fmt.Println("go_ipfs_cache_add_close start");
+			defer fmt.Println("go_ipfs_cache_add_close end");
+		}
+
+		w, ok := writers.remove(uint64(id))
+
+		if !ok {
+			fmt.Println("go_ipfs_cache_add_close invalid writer id");
+			C.execute_data_cb(fn, C.IPFS_ADD_FAILED, nil, C.size_t(0), fn_arg)
+			return
+		}
+
+		w.writer.Close()
+
+		var r addResult
+
+		select {
+		case r = <-w.result:
+		case <-ctx.Done():
+			r = addResult{"", opError(ctx, C.IPFS_ADD_FAILED)}
+		}
+
+		w.cancel()
+
+		if r.err != C.IPFS_SUCCESS {
+			C.execute_data_cb(fn, r.err, nil, C.size_t(0), fn_arg)
+			return
+		}
+
+		cdata := C.CBytes([]byte(r.cid))
+		defer C.free(cdata)
+
+		C.execute_data_cb(fn, C.IPFS_SUCCESS, cdata, C.size_t(len(r.cid)), fn_arg)
+	}()
+}
+
+//export go_ipfs_cache_add_abort
+func go_ipfs_cache_add_abort(id C.uint64_t) {
+	if w, ok := writers.remove(uint64(id)); ok {
+		w.writer.CloseWithError(context.Canceled)
+		w.cancel()
+	}
+}
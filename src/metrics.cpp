@@ -0,0 +1,144 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace ipfs_cache;
+
+static const auto relaxed = memory_order_relaxed;
+
+const unsigned OpMetrics::SUB_BITS;
+const unsigned OpMetrics::SUB_BUCKETS;
+const unsigned OpMetrics::MAX_BITS;
+const unsigned OpMetrics::BUCKET_COUNT;
+const unsigned OpMetrics::MAX_ERROR;
+const size_t BackendMetrics::OP_COUNT;
+
+uint64_t Metrics::Histogram::percentile(double q) const
+{
+    if (count == 0) return 0;
+
+    auto target = uint64_t(ceil(max(0.0, min(1.0, q)) * count));
+    uint64_t seen = 0;
+
+    for (auto& b : buckets) {
+        seen += b.second;
+        if (seen >= target) return b.first;
+    }
+
+    return buckets.back().first;
+}
+
+unsigned OpMetrics::bucket(uint64_t us)
+{
+    if (us < SUB_BUCKETS) return us;
+
+    unsigned bits = 63 - __builtin_clzll(us);
+
+    if (bits >= MAX_BITS) return BUCKET_COUNT - 1;
+
+    // The SUB_BITS bits below the highest one pick the sub bucket.
+    unsigned sub = (us >> (bits - SUB_BITS)) - SUB_BUCKETS;
+
+    return SUB_BUCKETS + (bits - SUB_BITS) * SUB_BUCKETS + sub;
+}
+
+uint64_t OpMetrics::bucket_max(unsigned bucket)
+{
+    if (bucket < SUB_BUCKETS) return bucket;
+
+    unsigned bits = (bucket - SUB_BUCKETS) / SUB_BUCKETS + SUB_BITS;
+    unsigned sub  = (bucket - SUB_BUCKETS) % SUB_BUCKETS;
+
+    return (uint64_t(SUB_BUCKETS + sub + 1) << (bits - SUB_BITS)) - 1;
+}
+
+void OpMetrics::start(size_t bytes_in)
+{
+    _started.fetch_add(1, relaxed);
+    if (bytes_in) _bytes_in.fetch_add(bytes_in, relaxed);
+}
+
+void OpMetrics::finish(Clock::duration d, int error, size_t bytes_out)
+{
+    using namespace std::chrono;
+
+    auto us = uint64_t(max<int64_t>(0, duration_cast<microseconds>(d).count()));
+
+    _buckets[bucket(us)].fetch_add(1, relaxed);
+    _sum_us.fetch_add(us, relaxed);
+
+    if (bytes_out) _bytes_out.fetch_add(bytes_out, relaxed);
+
+    if (error) {
+        _errors[min<unsigned>(unsigned(error), MAX_ERROR)].fetch_add(1, relaxed);
+    }
+
+    _completed.fetch_add(1, relaxed);
+}
+
+Metrics::Op OpMetrics::snapshot() const
+{
+    Metrics::Op op;
+
+    // Completions are loaded first so that in_flight doesn't underflow.
+    op.completed = _completed.load(relaxed);
+    op.started   = max(op.completed, _started.load(relaxed));
+    op.in_flight = op.started - op.completed;
+    op.bytes_in  = _bytes_in.load(relaxed);
+    op.bytes_out = _bytes_out.load(relaxed);
+
+    op.latency.sum_us = _sum_us.load(relaxed);
+
+    for (unsigned i = 0; i < BUCKET_COUNT; ++i) {
+        auto n = _buckets[i].load(relaxed);
+        if (!n) continue;
+        op.latency.buckets.emplace_back(bucket_max(i), n);
+        op.latency.count += n;
+    }
+
+    for (unsigned i = 0; i <= MAX_ERROR; ++i) {
+        auto n = _errors[i].load(relaxed);
+        if (n) op.errors[i] = n;
+    }
+
+    return op;
+}
+
+const char* BackendMetrics::name(OpKind k)
+{
+    switch (k) {
+        case OpKind::add:        return "add";
+        case OpKind::add_open:   return "add_open";
+        case OpKind::add_write:  return "add_write";
+        case OpKind::add_close:  return "add_close";
+        case OpKind::add_object: return "add_object";
+        case OpKind::block_put:  return "block_put";
+        case OpKind::block_get:  return "block_get";
+        case OpKind::cat:        return "cat";
+        case OpKind::cat_open:   return "cat_open";
+        case OpKind::read:       return "read";
+        case OpKind::seek:       return "seek";
+        case OpKind::publish:    return "publish";
+        case OpKind::resolve:    return "resolve";
+        case OpKind::pin:        return "pin";
+        case OpKind::unpin:      return "unpin";
+        case OpKind::cat_many:   return "cat_many";
+        case OpKind::add_many:   return "add_many";
+        case OpKind::pin_many:   return "pin_many";
+        case OpKind::unpin_many: return "unpin_many";
+    }
+    return "unknown";
+}
+
+Metrics BackendMetrics::snapshot() const
+{
+    Metrics m;
+
+    for (size_t i = 0; i < OP_COUNT; ++i) {
+        m.ops[name(OpKind(i))] = _ops[i].snapshot();
+    }
+
+    return m;
+}
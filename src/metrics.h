@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+
+#include <ipfs_cache/metrics.h>
+
+namespace ipfs_cache {
+
+/*
+ * Statistics of a single kind of operation. Updates are lock free (a few
+ * relaxed atomic increments) so they may be done from any thread, including
+ * the Go ones completing the operations.
+ *
+ * Latencies are kept in microseconds in log-linear buckets (as in HDR
+ * histograms): values below SUB_BUCKETS have a bucket each, above that every
+ * power of two range is split into SUB_BUCKETS buckets.
+ */
+class OpMetrics {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static const unsigned SUB_BITS     = 3;
+    static const unsigned SUB_BUCKETS  = 1u << SUB_BITS;
+    // Values from 2^MAX_BITS us (~12 days) up fall into the last bucket.
+    static const unsigned MAX_BITS     = 40;
+    static const unsigned BUCKET_COUNT = SUB_BUCKETS
+                                       + (MAX_BITS - SUB_BITS) * SUB_BUCKETS;
+    // Error codes from this one up are counted together.
+    static const unsigned MAX_ERROR    = 15;
+
+public:
+    void start(size_t bytes_in);
+    void finish(Clock::duration, int error, size_t bytes_out);
+
+    Metrics::Op snapshot() const;
+
+    static unsigned bucket(uint64_t us);
+    static uint64_t bucket_max(unsigned bucket);
+
+private:
+    std::atomic<uint64_t> _started{0};
+    std::atomic<uint64_t> _completed{0};
+    std::atomic<uint64_t> _bytes_in{0};
+    std::atomic<uint64_t> _bytes_out{0};
+    std::atomic<uint64_t> _sum_us{0};
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT> _buckets{};
+    std::array<std::atomic<uint64_t>, MAX_ERROR + 1> _errors{};
+};
+
+enum class OpKind {
+    add, add_open, add_write, add_close, add_object, block_put, block_get,
+    cat, cat_open, read, seek,
+    publish, resolve,
+    pin, unpin,
+    cat_many, add_many, pin_many, unpin_many
+};
+
+class BackendMetrics {
+public:
+    static const size_t OP_COUNT = size_t(OpKind::unpin_many) + 1;
+
+    OpMetrics& operator[](OpKind k) { return _ops[size_t(k)]; }
+
+    Metrics snapshot() const;
+
+    static const char* name(OpKind);
+
+private:
+    std::array<OpMetrics, OP_COUNT> _ops;
+};
+
+} // ipfs_cache namespace
@@ -1,5 +1,6 @@
 #include "republisher.h"
 #include "backend.h"
+#include "dispatch.h"
 #include <iostream>
 
 using namespace std;
@@ -8,10 +9,14 @@ using namespace ipfs_cache;
 using Timer = asio::steady_timer;
 using Clock = chrono::steady_clock;
 static const Timer::duration publish_duration = chrono::minutes(10);
+// Publishing which takes longer than this is given up, the next attempt is
+// made with the most recent CID.
+static const Timer::duration publish_timeout = chrono::minutes(3);
 
 Republisher::Republisher(Backend& backend)
     : _was_destroyed(make_shared<bool>(false))
     , _backend(backend)
+    , _strand(_backend.get_io_service())
     , _timer(_backend.get_io_service())
 {}
 
@@ -22,11 +27,19 @@ void Republisher::publish(const std::string& cid, asio::yield_context yield)
 
     Handler handler(move(yield));
     asio::async_result<Handler> result(handler);
-    publish(cid, move(handler));
+    publish(cid, wrap_handler<sys::error_code>(move(handler)));
     result.get();
 }
 
 void Republisher::publish(const std::string& cid, std::function<void(sys::error_code)> cb)
+{
+    _strand.dispatch([this, d = _was_destroyed, cid, cb = move(cb)] () mutable {
+            if (*d) return cb(asio::error::operation_aborted);
+            publish_(cid, move(cb));
+        });
+}
+
+void Republisher::publish_(const std::string& cid, std::function<void(sys::error_code)> cb)
 {
     _to_publish = cid;
 
@@ -44,13 +57,13 @@ void Republisher::start_publishing()
     if (_callbacks.empty()) {
         _is_publishing = false;
         _timer.expires_from_now(publish_duration / 2);
-        _timer.async_wait(
+        _timer.async_wait(_strand.wrap(
             [this, d = _was_destroyed] (sys::error_code ec) {
                 if (*d) return;
                 if (ec || _is_publishing) return;
                 _callbacks.push_back(nullptr);
                 start_publishing();
-            });
+            }));
         return;
     }
 
@@ -59,8 +72,12 @@ void Republisher::start_publishing()
 
     auto last_i = --_callbacks.end();
 
+    Backend::OpOptions opts;
+    opts.timeout = publish_timeout;
+    opts.cancel  = &_cancel_publish;
+
     cout << "Publishing DB: " << _to_publish << endl;
-    _backend.publish(_to_publish, publish_duration,
+    _backend.publish(_to_publish, publish_duration, opts, _strand.wrap(
         [this, d = _was_destroyed, last_i, id = _to_publish] (sys::error_code ec) {
             if (*d) return;
 
@@ -75,13 +92,15 @@ void Republisher::start_publishing()
             }
 
             start_publishing();
-        });
+        }));
 }
 
 Republisher::~Republisher()
 {
     *_was_destroyed = true;
 
+    if (_cancel_publish) _cancel_publish();
+
     auto& ios = _backend.get_io_service();
     auto cbs = move(_callbacks);
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
 #include <boost/asio/spawn.hpp>
 #include <boost/system/error_code.hpp>
 #include <string>
@@ -20,6 +21,9 @@ class Backend;
  *
  * This class periodically republished last value used in the
  * Republisher::publish function.
+ *
+ * The `publish` functions may be called from any thread running the
+ * io_service, the state of the republisher is only accessed on its strand.
  */
 class Republisher {
 public:
@@ -33,12 +37,18 @@ public:
     ~Republisher();
 
 private:
+    void publish_( const std::string&
+                 , std::function<void(boost::system::error_code)>);
+
     void start_publishing();
 
 private:
     std::shared_ptr<bool> _was_destroyed;
     Backend& _backend;
+    boost::asio::io_service::strand _strand;
     boost::asio::steady_timer _timer;
+    // Aborts the publishing in progress (if any).
+    std::function<void()> _cancel_publish;
     bool _is_publishing = false;
     std::string _to_publish;
     std::list<std::function<void(boost::system::error_code)>> _callbacks;
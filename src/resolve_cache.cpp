@@ -0,0 +1,74 @@
+#include "resolve_cache.h"
+
+using namespace std;
+using namespace ipfs_cache;
+
+// Same as go-ipfs' default lifetime of cached name system entries.
+static const chrono::minutes DEFAULT_FRESH_TTL(1);
+
+// Records are published with this validity (see republisher.cpp).
+static const chrono::minutes DEFAULT_MAX_AGE(10);
+
+ResolveCache::ResolveCache(Clock::duration fresh_ttl, Clock::duration max_age)
+    : _fresh_ttl(fresh_ttl)
+    , _max_age(max_age)
+{}
+
+ResolveCache::Entry
+ResolveCache::find(const string& ipns, Clock::time_point now) const
+{
+    return find(ipns, Clock::duration::max(), now);
+}
+
+ResolveCache::Entry
+ResolveCache::find( const string& ipns
+                  , Clock::duration max_age
+                  , Clock::time_point now) const
+{
+    lock_guard<mutex> lock(_mutex);
+
+    auto i = _items.find(ipns);
+
+    if (i == _items.end()) return { State::missing, {} };
+
+    auto age = now - i->second.resolved_at;
+
+    if (age >= max_age) return { State::missing, {} };
+
+    if (age < _fresh_ttl) return { State::fresh, i->second.cid };
+    if (age < _max_age)   return { State::stale, i->second.cid };
+
+    return { State::missing, {} };
+}
+
+void ResolveCache::insert(const string& ipns, string cid, Clock::time_point started)
+{
+    lock_guard<mutex> lock(_mutex);
+
+    auto& item = _items[ipns];
+
+    if (!item.cid.empty() && item.resolved_at > started) return;
+
+    item.cid         = move(cid);
+    item.resolved_at = started;
+}
+
+void ResolveCache::erase(const string& ipns)
+{
+    lock_guard<mutex> lock(_mutex);
+    _items.erase(ipns);
+}
+
+void ResolveCache::set_ttl(Clock::duration fresh_ttl, Clock::duration max_age)
+{
+    lock_guard<mutex> lock(_mutex);
+    _fresh_ttl = fresh_ttl;
+    _max_age   = max_age;
+}
+
+shared_ptr<ResolveCache> ResolveCache::shared()
+{
+    static auto cache = make_shared<ResolveCache>( DEFAULT_FRESH_TTL
+                                                 , DEFAULT_MAX_AGE);
+    return cache;
+}
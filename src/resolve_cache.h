@@ -0,0 +1,71 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace ipfs_cache {
+
+/*
+ * Cache of IPNS resolutions (IPNS id -> CID). A resolution is "fresh" for
+ * `fresh_ttl` after it was made and can be used without asking the
+ * network. After that it is "stale" until `max_age` passes; a stale result
+ * may still be used while a new resolution is made in the background
+ * (stale-while-revalidate). Older results are treated as missing, `max_age`
+ * should therefore not exceed the validity of published IPNS records.
+ *
+ * The IPFS node is process wide, so is the `shared` instance of this
+ * cache. The cache is thread safe.
+ */
+class ResolveCache {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class State { missing, fresh, stale };
+
+    struct Entry {
+        State state;
+        std::string cid;
+    };
+
+public:
+    ResolveCache(Clock::duration fresh_ttl, Clock::duration max_age);
+
+    ResolveCache(const ResolveCache&) = delete;
+    ResolveCache& operator=(const ResolveCache&) = delete;
+
+    Entry find( const std::string& ipns
+              , Clock::time_point now = Clock::now()) const;
+
+    // Same, but resolutions made more than `max_age` ago count as missing.
+    Entry find( const std::string& ipns
+              , Clock::duration max_age
+              , Clock::time_point now = Clock::now()) const;
+
+    // The `started` argument is when the resolution was started, results of
+    // resolutions started earlier than the cached one are ignored.
+    void insert( const std::string& ipns
+               , std::string cid
+               , Clock::time_point started = Clock::now());
+
+    void erase(const std::string& ipns);
+
+    void set_ttl(Clock::duration fresh_ttl, Clock::duration max_age);
+
+    static std::shared_ptr<ResolveCache> shared();
+
+private:
+    struct Item {
+        std::string cid;
+        Clock::time_point resolved_at;
+    };
+
+    mutable std::mutex _mutex;
+    Clock::duration _fresh_ttl;
+    Clock::duration _max_age;
+    std::unordered_map<std::string, Item> _items;
+};
+
+} // ipfs_cache namespace
@@ -0,0 +1,137 @@
+#include "sha256.h"
+
+#include <cstring>
+
+using namespace std;
+using namespace ipfs_cache;
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t rotr(uint32_t x, unsigned n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+Sha256::Sha256()
+    : _state{{ 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a
+             , 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 }}
+{
+}
+
+void Sha256::process_block(const uint8_t* p)
+{
+    uint32_t w[64];
+
+    for (unsigned i = 0; i < 16; ++i) {
+        w[i] = uint32_t(p[4*i]) << 24 | uint32_t(p[4*i+1]) << 16
+             | uint32_t(p[4*i+2]) << 8 | uint32_t(p[4*i+3]);
+    }
+
+    for (unsigned i = 16; i < 64; ++i) {
+        uint32_t s0 = rotr(w[i-15], 7) ^ rotr(w[i-15], 18) ^ (w[i-15] >> 3);
+        uint32_t s1 = rotr(w[i-2], 17) ^ rotr(w[i-2], 19)  ^ (w[i-2] >> 10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+
+    uint32_t a = _state[0], b = _state[1], c = _state[2], d = _state[3];
+    uint32_t e = _state[4], f = _state[5], g = _state[6], h = _state[7];
+
+    for (unsigned i = 0; i < 64; ++i) {
+        uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + K[i] + w[i];
+        uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+        uint32_t mj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + mj;
+
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    _state[0] += a; _state[1] += b; _state[2] += c; _state[3] += d;
+    _state[4] += e; _state[5] += f; _state[6] += g; _state[7] += h;
+}
+
+void Sha256::update(const void* data, size_t size)
+{
+    auto p = static_cast<const uint8_t*>(data);
+
+    _total_size += size;
+
+    if (_block_size) {
+        size_t n = min(size, _block.size() - _block_size);
+        memcpy(_block.data() + _block_size, p, n);
+        _block_size += n;
+        p += n;
+        size -= n;
+
+        if (_block_size < _block.size()) return;
+
+        process_block(_block.data());
+        _block_size = 0;
+    }
+
+    for (; size >= _block.size(); p += _block.size(), size -= _block.size()) {
+        process_block(p);
+    }
+
+    memcpy(_block.data(), p, size);
+    _block_size = size;
+}
+
+Sha256::Digest Sha256::close()
+{
+    uint64_t bits = _total_size * 8;
+
+    static const uint8_t pad[64] = { 0x80 };
+
+    // Pad to 56 bytes mod 64, then append the length.
+    size_t pad_size = _block_size < 56 ? 56 - _block_size : 120 - _block_size;
+    update(pad, pad_size);
+
+    uint8_t len[8];
+    for (unsigned i = 0; i < 8; ++i) len[i] = uint8_t(bits >> (56 - 8*i));
+    update(len, sizeof(len));
+
+    Digest d;
+
+    for (unsigned i = 0; i < 8; ++i) {
+        d[4*i]   = uint8_t(_state[i] >> 24);
+        d[4*i+1] = uint8_t(_state[i] >> 16);
+        d[4*i+2] = uint8_t(_state[i] >> 8);
+        d[4*i+3] = uint8_t(_state[i]);
+    }
+
+    return d;
+}
+
+Sha256::Digest Sha256::digest(const string& s)
+{
+    Sha256 h;
+    h.update(s);
+    return h.close();
+}
+
+string Sha256::to_hex(const Digest& d)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    string s;
+    s.reserve(d.size() * 2);
+
+    for (auto b : d) {
+        s += digits[b >> 4];
+        s += digits[b & 0xf];
+    }
+
+    return s;
+}
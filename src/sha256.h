@@ -0,0 +1,37 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace ipfs_cache {
+
+// SHA-256 (FIPS 180-4).
+class Sha256 {
+public:
+    using Digest = std::array<uint8_t, 32>;
+
+public:
+    Sha256();
+
+    void update(const void* data, size_t size);
+    void update(const std::string& s) { update(s.data(), s.size()); }
+
+    // Must be called at most once.
+    Digest close();
+
+    static Digest digest(const std::string& s);
+
+    static std::string to_hex(const Digest&);
+
+private:
+    void process_block(const uint8_t*);
+
+private:
+    std::array<uint32_t, 8> _state;
+    std::array<uint8_t, 64> _block;
+    size_t _block_size = 0;
+    uint64_t _total_size = 0;
+};
+
+} // ipfs_cache namespace
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/spawn.hpp>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include "namespaces.h"
+#include "defer.h"
+#include "dispatch.h"
+#include "or_throw.h"
+
+namespace ipfs_cache {
+
+/*
+ * Coalesces concurrent requests for the same key: the first caller runs the
+ * fetch, callers coming while it is in progress wait for it and get the
+ * same result (or error). Once done the key is forgotten, so `Value` should
+ * be cheap to copy (e.g. a shared_ptr to the actual data).
+ *
+ * May be used from coroutines in any number of threads.
+ */
+template<class Key, class Value>
+class SingleFlight {
+public:
+    using Fetch = std::function<Value(asio::yield_context)>;
+
+public:
+    SingleFlight(asio::io_service& ios) : _ios(ios) {}
+
+    Value run(const Key& key, const Fetch& fetch, asio::yield_context yield)
+    {
+        using Handler = typename asio::handler_type
+            < asio::yield_context
+            , void(sys::error_code, Value)>::type;
+
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        auto i = _flights.find(key);
+
+        if (i != _flights.end()) {
+            Handler handler(yield);
+            asio::async_result<Handler> result(handler);
+
+            i->second.push_back(
+                    wrap_handler<sys::error_code, Value>(std::move(handler)));
+            lock.unlock();
+
+            return result.get();
+        }
+
+        _flights[key];
+        lock.unlock();
+
+        sys::error_code ec;
+        Value value;
+
+        // Waiters must not be left hanging if the fetch throws.
+        bool done = false;
+
+        auto on_exit = defer([&] {
+                complete(key, done ? ec : asio::error::operation_aborted, value);
+            });
+
+        value = fetch(yield[ec]);
+        done = true;
+
+        return or_throw(yield, ec, value);
+    }
+
+    // Number of keys being fetched.
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _flights.size();
+    }
+
+private:
+    using Waiter = std::function<void(sys::error_code, Value)>;
+
+    void complete(const Key& key, sys::error_code ec, const Value& value)
+    {
+        std::list<Waiter> waiters;
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto i = _flights.find(key);
+            waiters = std::move(i->second);
+            _flights.erase(i);
+        }
+
+        for (auto& w : waiters) {
+            _ios.post([w = std::move(w), ec, value] { w(ec, value); });
+        }
+    }
+
+private:
+    asio::io_service& _ios;
+    mutable std::mutex _mutex;
+    std::unordered_map<Key, std::list<Waiter>> _flights;
+};
+
+} // ipfs_cache namespace
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace ipfs_cache {
+
+/*
+ * A thread running the jobs posted to it one after the other, for blocking
+ * work (such as file IO) which must not hold up the threads of an
+ * io_service (see `run_in_thread` in dispatch.h). Jobs posted before
+ * destruction are run before the thread is joined.
+ */
+class WorkThread {
+public:
+    WorkThread();
+
+    WorkThread(const WorkThread&) = delete;
+    WorkThread& operator=(const WorkThread&) = delete;
+
+    // May be called from any thread.
+    void post(std::function<void()> job);
+
+    ~WorkThread();
+
+private:
+    void run();
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _has_jobs;
+    std::deque<std::function<void()>> _jobs;
+    bool _stopping = false;
+    // Last, so that the above are there once it starts.
+    std::thread _thread;
+};
+
+inline
+WorkThread::WorkThread()
+    : _thread([this] { run(); })
+{}
+
+inline
+void WorkThread::post(std::function<void()> job)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _jobs.push_back(std::move(job));
+    }
+
+    _has_jobs.notify_one();
+}
+
+inline
+void WorkThread::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (;;) {
+        _has_jobs.wait(lock, [this] { return _stopping || !_jobs.empty(); });
+
+        if (_jobs.empty()) return; // Stopping.
+
+        auto job = std::move(_jobs.front());
+        _jobs.pop_front();
+
+        lock.unlock();
+        job();
+        lock.lock();
+    }
+}
+
+inline
+WorkThread::~WorkThread()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+
+    _has_jobs.notify_one();
+    _thread.join();
+}
+
+} // ipfs_cache namespace
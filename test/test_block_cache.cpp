@@ -0,0 +1,93 @@
+#define BOOST_TEST_MODULE block_cache
+#include <boost/test/included/unit_test.hpp>
+
+#include <block_cache.h>
+#include <sstream>
+
+BOOST_AUTO_TEST_SUITE(block_cache)
+
+using namespace std;
+using namespace ipfs_cache;
+
+static string cid(int i) {
+    stringstream ss;
+    ss << "Qm" << i;
+    return ss.str();
+}
+
+BOOST_AUTO_TEST_CASE(test_hit_miss)
+{
+    BlockCache cache(1000);
+
+    BOOST_REQUIRE(!cache.find(cid(0)));
+
+    cache.insert(cid(0), "data0");
+
+    auto d = cache.find(cid(0));
+    BOOST_REQUIRE(d);
+    BOOST_REQUIRE_EQUAL(*d, "data0");
+
+    BOOST_REQUIRE_EQUAL(cache.stats().hits,   1u);
+    BOOST_REQUIRE_EQUAL(cache.stats().misses, 1u);
+    BOOST_REQUIRE_EQUAL(cache.stats().size,   5u);
+}
+
+BOOST_AUTO_TEST_CASE(test_size_bound)
+{
+    BlockCache cache(1000);
+
+    for (int i = 0; i < 100; ++i) {
+        cache.insert(cid(i), string(100, 'x'));
+        BOOST_REQUIRE(cache.stats().size <= 1000);
+    }
+
+    BOOST_REQUIRE_EQUAL(cache.stats().count, 10u);
+    BOOST_REQUIRE_EQUAL(cache.stats().evictions, 90u);
+
+    // Too big to be admitted.
+    cache.insert(cid(1000), string(cache.max_item_size() + 1, 'x'));
+    BOOST_REQUIRE(!cache.find(cid(1000)));
+
+    cache.set_max_size(300);
+    BOOST_REQUIRE_EQUAL(cache.stats().count, 3u);
+
+    cache.insert(cid(1001), string(cache.max_item_size(), 'x'));
+    BOOST_REQUIRE(cache.find(cid(1001)));
+}
+
+BOOST_AUTO_TEST_CASE(test_shared_data)
+{
+    BlockCache cache(1000);
+
+    cache.insert(cid(0), "data0");
+
+    auto d = cache.find(cid(0));
+    BOOST_REQUIRE(d);
+
+    // Evicted, but the data found before stays valid.
+    cache.set_max_size(0);
+    BOOST_REQUIRE(!cache.find(cid(0)));
+    BOOST_REQUIRE_EQUAL(*d, "data0");
+}
+
+BOOST_AUTO_TEST_CASE(test_scan_resistance)
+{
+    BlockCache cache(1000);
+
+    // Make a few items popular.
+    for (int i = 0; i < 4; ++i) {
+        cache.insert(cid(i), string(100, 'x'));
+        BOOST_REQUIRE(cache.find(cid(i)));
+    }
+
+    // Scan over many items which are used only once.
+    for (int i = 100; i < 200; ++i) {
+        cache.insert(cid(i), string(100, 'x'));
+    }
+
+    for (int i = 0; i < 4; ++i) {
+        BOOST_REQUIRE(cache.find(cid(i)));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
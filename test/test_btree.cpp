@@ -4,7 +4,9 @@
 
 #include <btree.h>
 #include <namespaces.h>
+#include <atomic>
 #include <iostream>
+#include <thread>
 
 #include "or_throw.h"
 
@@ -98,13 +100,16 @@ struct MockStorage : public std::map<BTree::Hash, BTree::Value> {
     }
 
     BTree::AddOp add_op() {
-        return [this] (BTree::Value value , asio::yield_context yield) {
+        return [this] ( BTree::Value value
+                      , const std::vector<BTree::Hash>& children
+                      , asio::yield_context yield) {
             random_wait(_async_deviation, _ios, yield);
 
             std::stringstream ss;
             ss << next_id++;
             auto id = ss.str();
             Map::operator[](id) = std::move(value);
+            links[id] = children;
 
             return id;
         };
@@ -117,6 +122,16 @@ struct MockStorage : public std::map<BTree::Hash, BTree::Value> {
         };
     }
 
+    // Number of nodes reachable from `hash` through the links passed to
+    // the add operation.
+    size_t reachable_count(const BTree::Hash& hash) const {
+        size_t result = 1;
+        for (auto& h : links.at(hash)) result += reachable_count(h);
+        return result;
+    }
+
+    std::map<BTree::Hash, std::vector<BTree::Hash>> links;
+
 private:
     size_t next_id = 0;;
     asio::io_service& _ios;
@@ -178,6 +193,229 @@ BOOST_AUTO_TEST_CASE(test_3)
     ios.run();
 }
 
+// Test that the whole tree is reachable from the root through the links
+// handed to the add operation (i.e. that pinning the root would be enough).
+BOOST_AUTO_TEST_CASE(test_links)
+{
+    srand(time(NULL));
+
+    asio::io_service ios;
+
+    MockStorage storage(ios);
+
+    BTree db(storage.cat_op(), storage.add_op(), storage.remove_op(), 2);
+
+    asio::spawn(ios, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        for (int i = 0; i < 100; ++i) {
+            auto k = random_key(5);
+            db.insert(k, "v" + k, yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            BOOST_REQUIRE_EQUAL( storage.reachable_count(db.root_hash())
+                               , db.local_node_count());
+        }
+    });
+
+    ios.run();
+}
+
+// Test that the per call CatOp and OnParse of BTree::find see every node the
+// lookup loads.
+BOOST_AUTO_TEST_CASE(test_find_ops)
+{
+    asio::io_service ios;
+
+    MockStorage storage(ios);
+
+    BTree db(storage.cat_op(), storage.add_op(), storage.remove_op(), 2);
+
+    asio::spawn(ios, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        for (int i = 0; i < 100; ++i) {
+            db.insert(to_string(i), "v" + to_string(i), yield[ec]);
+            BOOST_REQUIRE(!ec);
+        }
+
+        BTree db2(storage.cat_op(), nullptr, nullptr, 2);
+
+        db2.load(db.root_hash(), yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        vector<string> fetched, parsed;
+
+        auto cat_op = [&] (const BTree::Hash& h, asio::yield_context yield) {
+            fetched.push_back(h);
+            return storage.cat_op()(h, yield);
+        };
+
+        auto on_parse = [&] (const BTree::Hash& h, chrono::steady_clock::duration) {
+            parsed.push_back(h);
+        };
+
+        auto v = db2.find("42", cat_op, on_parse, yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(v, "v42");
+
+        BOOST_REQUIRE(!fetched.empty());
+        BOOST_REQUIRE(fetched == parsed);
+        BOOST_REQUIRE_EQUAL(fetched.size(), db2.local_node_count());
+
+        // Loaded nodes are not fetched again.
+        fetched.clear();
+        db2.find("42", cat_op, on_parse, yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE(fetched.empty());
+    });
+
+    ios.run();
+}
+
+// Test that BTree::warm loads the top levels of the tree.
+BOOST_AUTO_TEST_CASE(test_warm)
+{
+    asio::io_service ios;
+
+    MockStorage storage(ios);
+
+    BTree db(storage.cat_op(), storage.add_op(), storage.remove_op(), 2);
+
+    asio::spawn(ios, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        for (int i = 0; i < 100; ++i) {
+            db.insert(to_string(i), "v" + to_string(i), yield[ec]);
+            BOOST_REQUIRE(!ec);
+        }
+
+        BTree db2(storage.cat_op(), nullptr, nullptr, 2);
+
+        db2.load(db.root_hash(), yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(db2.local_node_count(), 0u);
+
+        db2.warm(1, yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(db2.local_node_count(), 1u);
+
+        db2.warm(2, yield[ec]);
+        BOOST_REQUIRE(!ec);
+        size_t warmed = db2.local_node_count();
+        BOOST_REQUIRE(warmed > 1);
+
+        // Warming again fetches nothing.
+        db2.warm(2, yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(db2.local_node_count(), warmed);
+
+        auto v = db2.find("42", yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(v, "v42");
+
+        // A tree whose root can't be fetched fails to warm.
+        BTree db3(storage.cat_op(), nullptr, nullptr, 2);
+
+        db3.load("missing", yield[ec]);
+        BOOST_REQUIRE(!ec);
+        db3.warm(2, yield[ec]);
+        BOOST_REQUIRE(ec);
+        BOOST_REQUIRE_EQUAL(db3.local_node_count(), 0u);
+    });
+
+    ios.run();
+}
+
+// Test that lookups in a loaded tree may run on several threads at once.
+BOOST_AUTO_TEST_CASE(test_concurrent_finds)
+{
+    asio::io_service ios;
+
+    // Nodes are fetched in several steps, so that lookups interleave.
+    MockStorage storage(ios, 4);
+
+    BTree db(storage.cat_op(), storage.add_op(), storage.remove_op(), 2);
+
+    asio::spawn(ios, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        for (int i = 0; i < 200; ++i) {
+            db.insert(to_string(i), "v" + to_string(i), yield[ec]);
+            BOOST_REQUIRE(!ec);
+        }
+    });
+
+    ios.run();
+    ios.reset();
+
+    BTree db2(storage.cat_op(), nullptr, nullptr, 2);
+
+    asio::spawn(ios, [&](asio::yield_context yield) {
+        db2.load(db.root_hash(), yield);
+    });
+
+    ios.run();
+    ios.reset();
+
+    std::atomic<unsigned> found(0);
+
+    for (int i = 0; i < 2000; ++i) {
+        asio::spawn(ios, [&, i](asio::yield_context yield) {
+            auto k = to_string(i % 200);
+            sys::error_code ec;
+            auto v = db2.find(k, yield[ec]);
+            if (!ec && v == "v" + k) ++found;
+        });
+    }
+
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&ios] { ios.run(); });
+    }
+
+    for (auto& t : threads) t.join();
+
+    BOOST_REQUIRE_EQUAL(found, 2000u);
+}
+
+// Test that binary values survive storing and restoring of nodes.
+BOOST_AUTO_TEST_CASE(test_binary_values)
+{
+    asio::io_service ios;
+
+    MockStorage storage(ios);
+
+    BTree db(storage.cat_op(), storage.add_op(), storage.remove_op(), 2);
+
+    auto value = [] (int i) {
+        return string("\x01\x00\xff\"\\", 5) + to_string(i);
+    };
+
+    asio::spawn(ios, [&](asio::yield_context yield) {
+        sys::error_code ec;
+
+        for (int i = 0; i < 20; ++i) {
+            db.insert(to_string(i), value(i), yield[ec]);
+            BOOST_REQUIRE(!ec);
+        }
+
+        BTree db2(storage.cat_op(), nullptr, nullptr, 2);
+
+        db2.load(db.root_hash(), yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        for (int i = 0; i < 20; ++i) {
+            auto v = db2.find(to_string(i), yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE_EQUAL(v, value(i));
+        }
+    });
+
+    ios.run();
+}
+
 // Test that doing BTree::load while BTree::find doesn't crash the app.
 BOOST_AUTO_TEST_CASE(test_4)
 {
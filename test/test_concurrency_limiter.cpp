@@ -0,0 +1,117 @@
+#define BOOST_TEST_MODULE concurrency_limiter
+#include <boost/test/included/unit_test.hpp>
+
+#include <vector>
+
+#include <concurrency_limiter.h>
+
+BOOST_AUTO_TEST_SUITE(concurrency_limiter)
+
+using namespace std;
+using namespace ipfs_cache;
+
+using Clock   = ConcurrencyLimiter::Clock;
+using Op      = ConcurrencyLimiter::Op;
+using Outcome = ConcurrencyLimiter::Outcome;
+using ms      = chrono::milliseconds;
+
+// Starts as many operations as the limiter allows at `t` and finishes them
+// all after `latency`.
+static void round(ConcurrencyLimiter& l, Clock::time_point& t, ms latency,
+                  Outcome outcome = Outcome::done, size_t bytes = 1000)
+{
+    vector<Op> ops;
+
+    while (l.can_start()) ops.push_back(l.start(bytes, t));
+
+    t += latency;
+
+    for (auto& op : ops) l.finish(op, outcome, t);
+
+    t += ms(1);
+}
+
+BOOST_AUTO_TEST_CASE(test_bounds)
+{
+    ConcurrencyLimiter::Options opts;
+
+    opts.min = 4;
+    opts.max = 2;
+    opts.initial = 100;
+
+    ConcurrencyLimiter l(opts);
+
+    BOOST_REQUIRE_EQUAL(l.options().max, 4u);
+    BOOST_REQUIRE_EQUAL(l.limit(), 4u);
+}
+
+BOOST_AUTO_TEST_CASE(test_increase_and_decrease)
+{
+    ConcurrencyLimiter::Options opts;
+
+    opts.min = 2;
+    opts.max = 16;
+    opts.initial = 4;
+
+    ConcurrencyLimiter l(opts);
+
+    auto t = Clock::now();
+
+    // Fast operations grow the limit up to the max.
+    for (int i = 0; i < 50; ++i) round(l, t, ms(10));
+
+    BOOST_REQUIRE_EQUAL(l.limit(), 16u);
+    BOOST_REQUIRE_EQUAL(l.in_flight(), 0u);
+
+    // A slow round decreases it only once.
+    round(l, t, ms(100));
+    BOOST_REQUIRE_EQUAL(l.limit(), 12u);
+    BOOST_REQUIRE_EQUAL(l.decreases(), 1u);
+
+    // Timeouts do as well, down to the min.
+    for (int i = 0; i < 20; ++i) round(l, t, ms(10), Outcome::overloaded);
+    BOOST_REQUIRE_EQUAL(l.limit(), 2u);
+
+    // Canceled operations don't count.
+    auto limit = l.limit();
+    for (int i = 0; i < 5; ++i) round(l, t, ms(1000), Outcome::ignored);
+    BOOST_REQUIRE_EQUAL(l.limit(), limit);
+}
+
+BOOST_AUTO_TEST_CASE(test_size_classes)
+{
+    ConcurrencyLimiter l;
+
+    auto t = Clock::now();
+
+    round(l, t, ms(10), Outcome::done, 1000);
+    auto limit = l.limit();
+
+    // Large operations are slower, but that's not taken as overload.
+    round(l, t, ms(500), Outcome::done, 10*1000*1000);
+    BOOST_REQUIRE_EQUAL(l.decreases(), 0u);
+    BOOST_REQUIRE_GE(l.limit(), limit);
+
+    // Small ones being as slow is.
+    round(l, t, ms(500), Outcome::done, 1000);
+    BOOST_REQUIRE_EQUAL(l.decreases(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(test_unsaturated_doesnt_grow)
+{
+    ConcurrencyLimiter l;
+
+    auto t = Clock::now();
+    auto limit = l.limit();
+
+    // A single operation at a time says nothing about higher concurrency.
+    for (int i = 0; i < 100; ++i) {
+        auto op = l.start(1000, t);
+        t += ms(10);
+        l.finish(op, Outcome::done, t);
+    }
+
+    BOOST_REQUIRE_EQUAL(l.limit(), limit);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
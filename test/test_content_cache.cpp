@@ -0,0 +1,178 @@
+#define BOOST_TEST_MODULE content_cache
+#include <boost/test/included/unit_test.hpp>
+
+#include <cstdlib>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <content_cache.h>
+
+BOOST_AUTO_TEST_SUITE(content_cache)
+
+using namespace std;
+using namespace ipfs_cache;
+
+struct TmpDir {
+    string path = "/tmp/ipfs_cache_test_content." + to_string(getpid());
+
+    TmpDir()  { remove(); }
+    ~TmpDir() { remove(); }
+
+    void remove() {
+        int r = system(("rm -rf " + path).c_str());
+        (void) r;
+    }
+};
+
+BOOST_AUTO_TEST_CASE(test_sketch)
+{
+    FrequencySketch sketch(64);
+
+    for (int i = 0; i < 5; ++i) sketch.record("hot");
+    sketch.record("cold");
+
+    BOOST_REQUIRE_EQUAL(sketch.estimate("hot"), 5u);
+    BOOST_REQUIRE_EQUAL(sketch.estimate("cold"), 1u);
+
+    for (int i = 0; i < 100; ++i) sketch.record("hot");
+    BOOST_REQUIRE(sketch.estimate("hot") <= FrequencySketch::MAX_COUNT);
+
+    // Recording many keys ages the counts.
+    for (int i = 0; i < 640; ++i) sketch.record(to_string(i));
+    BOOST_REQUIRE(sketch.estimate("hot") < FrequencySketch::MAX_COUNT);
+}
+
+BOOST_AUTO_TEST_CASE(test_find_insert)
+{
+    TmpDir dir;
+    ContentCache cache(dir.path, 1000);
+
+    BOOST_REQUIRE(!cache.find("a"));
+
+    cache.insert("a", "aaa");
+    cache.insert("b", string(100, 'b'));
+
+    auto a = cache.find("a");
+    BOOST_REQUIRE(a);
+    BOOST_REQUIRE_EQUAL(*a, "aaa");
+    BOOST_REQUIRE_EQUAL(*cache.find("b"), string(100, 'b'));
+
+    // Too big for the cache.
+    cache.insert("c", string(200, 'c'));
+    BOOST_REQUIRE(!cache.find("c"));
+
+    auto s = cache.stats();
+    BOOST_REQUIRE_EQUAL(s.hits, 2u);
+    BOOST_REQUIRE_EQUAL(s.misses, 2u);
+    BOOST_REQUIRE_EQUAL(s.insertions, 2u);
+    BOOST_REQUIRE_EQUAL(s.rejections, 1u);
+    BOOST_REQUIRE_EQUAL(s.size, 103u);
+    BOOST_REQUIRE_EQUAL(s.count, 2u);
+}
+
+BOOST_AUTO_TEST_CASE(test_admission)
+{
+    TmpDir dir;
+    ContentCache cache(dir.path, 800);
+
+    // Fill the cache with contents asked for twice.
+    for (int i = 0; i < 8; ++i) {
+        auto cid = "hot" + to_string(i);
+        cache.find(cid);
+        cache.find(cid);
+        cache.insert(cid, string(100, 'h'));
+    }
+
+    BOOST_REQUIRE_EQUAL(cache.stats().count, 8u);
+
+    // A one-off content doesn't push out the popular ones.
+    cache.find("cold");
+    cache.insert("cold", string(100, 'c'));
+
+    BOOST_REQUIRE_EQUAL(cache.stats().rejections, 1u);
+    BOOST_REQUIRE(!cache.find("cold"));
+
+    // One asked for more often does, replacing the least recently used.
+    for (int i = 0; i < 3; ++i) cache.find("new");
+    cache.insert("new", string(100, 'n'));
+
+    BOOST_REQUIRE(cache.find("new"));
+    BOOST_REQUIRE_EQUAL(cache.stats().evictions, 1u);
+    BOOST_REQUIRE(!cache.find("hot0"));
+    BOOST_REQUIRE(cache.find("hot1"));
+}
+
+BOOST_AUTO_TEST_CASE(test_persistence)
+{
+    TmpDir dir;
+
+    {
+        ContentCache cache(dir.path, 1000);
+        cache.insert("a", "aaa");
+        cache.insert("b", "bbbb");
+    }
+
+    // A leftover of an interrupted write.
+    ofstream(dir.path + "/.tmp.0") << "garbage";
+
+    ContentCache cache(dir.path, 1000);
+
+    BOOST_REQUIRE_EQUAL(cache.stats().count, 2u);
+    BOOST_REQUIRE_EQUAL(cache.stats().size, 7u);
+    BOOST_REQUIRE_EQUAL(*cache.find("a"), "aaa");
+    BOOST_REQUIRE_EQUAL(*cache.find("b"), "bbbb");
+    BOOST_REQUIRE(!ifstream(dir.path + "/.tmp.0"));
+
+    cache.set_max_size(5);
+    BOOST_REQUIRE_EQUAL(cache.stats().count, 1u);
+}
+
+BOOST_AUTO_TEST_CASE(test_damaged)
+{
+    TmpDir dir;
+    ContentCache cache(dir.path, 1000);
+
+    BOOST_REQUIRE(cache.insert("a", "aaa"));
+    BOOST_REQUIRE(!cache.insert("a", "aaa"));
+
+    // E.g. truncated by a crash.
+    ofstream(dir.path + "/a", ios::trunc);
+
+    BOOST_REQUIRE(!cache.find("a"));
+    BOOST_REQUIRE_EQUAL(cache.stats().count, 0u);
+    BOOST_REQUIRE_EQUAL(cache.stats().size, 0u);
+    BOOST_REQUIRE(!ifstream(dir.path + "/a"));
+}
+
+BOOST_AUTO_TEST_CASE(test_hits_are_recent_on_load)
+{
+    TmpDir dir;
+
+    {
+        ContentCache cache(dir.path, 1000);
+        cache.insert("a", "aaa");
+        cache.insert("b", "bbb");
+    }
+
+    // Inserted long ago, "a" last.
+    struct utimbuf old_a = { 2000, 2000 };
+    struct utimbuf old_b = { 1000, 1000 };
+    utime((dir.path + "/a").c_str(), &old_a);
+    utime((dir.path + "/b").c_str(), &old_b);
+
+    {
+        ContentCache cache(dir.path, 1000);
+        BOOST_REQUIRE(cache.find("b"));
+    }
+
+    ContentCache cache(dir.path, 1000);
+
+    // "a" is now the least recently used.
+    cache.set_max_size(3);
+    BOOST_REQUIRE(!cache.find("a"));
+    BOOST_REQUIRE(cache.find("b"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
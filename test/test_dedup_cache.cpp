@@ -0,0 +1,157 @@
+#define BOOST_TEST_MODULE dedup_cache
+#include <boost/test/included/unit_test.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <unistd.h>
+
+#include <dedup_cache.h>
+#include <sha256.h>
+
+BOOST_AUTO_TEST_SUITE(dedup_cache)
+
+using namespace std;
+using namespace ipfs_cache;
+
+static string hex(const string& s)
+{
+    return Sha256::to_hex(Sha256::digest(s));
+}
+
+struct TmpFile {
+    string path = "/tmp/ipfs_cache_test_dedup." + to_string(getpid());
+
+    TmpFile()  { remove(); }
+    ~TmpFile() { remove(); }
+
+    void remove() {
+        ::remove(path.c_str());
+        ::remove((path + ".tmp").c_str());
+    }
+};
+
+BOOST_AUTO_TEST_CASE(test_sha256)
+{
+    BOOST_REQUIRE_EQUAL(hex(""),
+        "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    BOOST_REQUIRE_EQUAL(hex("abc"),
+        "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    BOOST_REQUIRE_EQUAL(hex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"),
+        "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+
+    // Fed in uneven pieces.
+    string m(1000000, 'a');
+    Sha256 h;
+    for (size_t i = 0, n = 1; i < m.size(); i += n, n = n % 97 + 1) {
+        h.update(m.data() + i, min(n, m.size() - i));
+    }
+    BOOST_REQUIRE_EQUAL(Sha256::to_hex(h.close()),
+        "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+}
+
+BOOST_AUTO_TEST_CASE(test_persistence)
+{
+    TmpFile tmp;
+
+    {
+        DedupCache cache(tmp.path, 10);
+
+        BOOST_REQUIRE(!cache.find("d1"));
+
+        cache.insert("d1", "cid1");
+        cache.insert("d2", "cid2");
+        cache.insert("d1", "cid3");
+
+        BOOST_REQUIRE_EQUAL(*cache.find("d1"), "cid3");
+        BOOST_REQUIRE_EQUAL(cache.stats().hits, 1u);
+        BOOST_REQUIRE_EQUAL(cache.stats().misses, 1u);
+    }
+
+    DedupCache cache(tmp.path, 10);
+
+    BOOST_REQUIRE_EQUAL(cache.size(), 2u);
+    BOOST_REQUIRE_EQUAL(*cache.find("d1"), "cid3");
+    BOOST_REQUIRE_EQUAL(*cache.find("d2"), "cid2");
+}
+
+BOOST_AUTO_TEST_CASE(test_erase)
+{
+    TmpFile tmp;
+
+    {
+        DedupCache cache(tmp.path, 10);
+
+        cache.insert("d1", "cid1");
+        cache.insert("d2", "cid2");
+        cache.erase("d1");
+        cache.erase("d3");
+
+        BOOST_REQUIRE(!cache.find("d1"));
+        BOOST_REQUIRE_EQUAL(cache.size(), 1u);
+    }
+
+    DedupCache cache(tmp.path, 10);
+
+    BOOST_REQUIRE_EQUAL(cache.size(), 1u);
+    BOOST_REQUIRE(!cache.find("d1"));
+    BOOST_REQUIRE_EQUAL(*cache.find("d2"), "cid2");
+
+    // Inserted again after having been erased.
+    cache.insert("d1", "cid4");
+    BOOST_REQUIRE_EQUAL(*cache.find("d1"), "cid4");
+}
+
+BOOST_AUTO_TEST_CASE(test_eviction_and_compaction)
+{
+    TmpFile tmp;
+
+    {
+        DedupCache cache(tmp.path, 100);
+
+        for (int i = 0; i < 3000; ++i) {
+            cache.insert("d" + to_string(i), "cid" + to_string(i));
+            // Keep d0 recently used.
+            BOOST_REQUIRE(cache.find("d0"));
+        }
+
+        BOOST_REQUIRE_EQUAL(cache.size(), 100u);
+    }
+
+    // The log was rewritten along the way.
+    size_t lines = 0;
+    ifstream file(tmp.path);
+    for (string l; getline(file, l);) ++lines;
+    BOOST_REQUIRE_LT(lines, 3000u);
+
+    DedupCache cache(tmp.path, 100);
+
+    BOOST_REQUIRE_EQUAL(cache.size(), 100u);
+    BOOST_REQUIRE(cache.find("d2999"));
+    BOOST_REQUIRE(!cache.find("d1"));
+}
+
+BOOST_AUTO_TEST_CASE(test_torn_line)
+{
+    TmpFile tmp;
+
+    {
+        ofstream file(tmp.path);
+        file << "d1 cid1\n" << "d2 ci";
+    }
+
+    {
+        DedupCache cache(tmp.path, 10);
+
+        BOOST_REQUIRE_EQUAL(cache.size(), 1u);
+        BOOST_REQUIRE(!cache.find("d2"));
+
+        cache.insert("d3", "cid3");
+    }
+
+    DedupCache cache(tmp.path, 10);
+
+    BOOST_REQUIRE_EQUAL(cache.size(), 2u);
+    BOOST_REQUIRE_EQUAL(*cache.find("d3"), "cid3");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,76 @@
+#define BOOST_TEST_MODULE fair_queue
+#include <boost/test/included/unit_test.hpp>
+
+#include <string>
+
+#include <fair_queue.h>
+
+BOOST_AUTO_TEST_SUITE(fair_queue)
+
+using namespace std;
+using namespace ipfs_cache;
+
+using Queue = FairQueue<string>;
+using Clock = Queue::Clock;
+
+static string pop_all(Queue& q)
+{
+    string s;
+    while (!q.empty()) s += q.pop();
+    return s;
+}
+
+BOOST_AUTO_TEST_CASE(test_weighted_round_robin)
+{
+    Queue q({3, 1});
+
+    for (int i = 0; i < 5; ++i) q.push(1, "b");
+    for (int i = 0; i < 7; ++i) q.push(0, "a");
+
+    BOOST_REQUIRE_EQUAL(q.size(), 12u);
+    BOOST_REQUIRE_EQUAL(q.size(0), 7u);
+
+    // Class 1 isn't starved, class 0 takes over once 1 runs dry and vice
+    // versa.
+    BOOST_REQUIRE_EQUAL(pop_all(q), "aaabaaabab" "bb");
+}
+
+BOOST_AUTO_TEST_CASE(test_fifo_within_class)
+{
+    Queue q({1, 1});
+
+    q.push(0, "1");
+    q.push(0, "2");
+    q.push(1, "x");
+    q.push(0, "3");
+
+    BOOST_REQUIRE_EQUAL(pop_all(q), "1x23");
+}
+
+BOOST_AUTO_TEST_CASE(test_expire)
+{
+    Queue q({1, 1});
+
+    auto t = Clock::now();
+
+    q.push(0, "a", t + chrono::seconds(2));
+    q.push(0, "b");
+    q.push(1, "c", t + chrono::seconds(1));
+    q.push(1, "d", t + chrono::seconds(3));
+
+    BOOST_REQUIRE(q.next_deadline() == t + chrono::seconds(1));
+
+    auto expired = q.expire(t + chrono::seconds(2));
+
+    BOOST_REQUIRE_EQUAL(expired.size(), 2u);
+    BOOST_REQUIRE_EQUAL(expired[0], "c");
+    BOOST_REQUIRE_EQUAL(expired[1], "a");
+    BOOST_REQUIRE(q.next_deadline() == t + chrono::seconds(3));
+
+    // Popped entries don't expire.
+    BOOST_REQUIRE_EQUAL(pop_all(q), "bd");
+    BOOST_REQUIRE(q.next_deadline() == Clock::time_point::max());
+    BOOST_REQUIRE(q.expire(t + chrono::seconds(10)).empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,100 @@
+#define BOOST_TEST_MODULE index_entry
+#include <boost/test/included/unit_test.hpp>
+
+#include <encoding.h>
+#include <index_entry.h>
+
+BOOST_AUTO_TEST_SUITE(index_entry)
+
+using namespace std;
+using namespace ipfs_cache;
+
+namespace pt = boost::posix_time;
+
+static const string CID = "QmYwAPJzv5CZsnA625s3Xf2nemtYgPpHdWEz79ojWnPbdG";
+
+BOOST_AUTO_TEST_CASE(test_base58)
+{
+    BOOST_REQUIRE_EQUAL(base58_encode(""), "");
+    BOOST_REQUIRE_EQUAL(base58_encode("hello world"), "StV1DL6CwTryKyV");
+    BOOST_REQUIRE_EQUAL(base58_encode(string("\0\0\x01", 3)), "112");
+
+    auto mh = base58_decode(CID);
+    BOOST_REQUIRE(mh);
+    BOOST_REQUIRE_EQUAL(mh->size(), 34u);
+    BOOST_REQUIRE_EQUAL(base58_encode(*mh), CID);
+
+    BOOST_REQUIRE(!base58_decode("0OIl"));
+}
+
+BOOST_AUTO_TEST_CASE(test_base64)
+{
+    BOOST_REQUIRE_EQUAL(base64_encode(""), "");
+    BOOST_REQUIRE_EQUAL(base64_encode("f"), "Zg==");
+    BOOST_REQUIRE_EQUAL(base64_encode("fo"), "Zm8=");
+    BOOST_REQUIRE_EQUAL(base64_encode("foobar"), "Zm9vYmFy");
+
+    BOOST_REQUIRE_EQUAL(*base64_decode("Zg=="), "f");
+    BOOST_REQUIRE_EQUAL(*base64_decode("Zm9vYmFy"), "foobar");
+
+    BOOST_REQUIRE(!base64_decode("Zg="));
+    BOOST_REQUIRE(!base64_decode("Z!=="));
+}
+
+BOOST_AUTO_TEST_CASE(test_round_trip)
+{
+    IndexEntry e;
+    e.ts           = pt::from_iso_extended_string("2018-03-01T12:34:56.789012");
+    e.cid          = CID;
+    e.size         = 1234567;
+    e.content_type = "text/html";
+
+    auto data = e.encode();
+
+    // Version, flags, time stamp, multihash, size, content type.
+    BOOST_REQUIRE_EQUAL(data.size(), 1 + 1 + 8 + 1 + 34 + 8 + 1 + 9u);
+
+    IndexEntryView view;
+    BOOST_REQUIRE(view.parse(data));
+    BOOST_REQUIRE(!view.cid_is_text());
+    BOOST_REQUIRE(view.ts() == e.ts);
+    BOOST_REQUIRE_EQUAL(view.cid(), CID);
+    BOOST_REQUIRE(view.has_size());
+    BOOST_REQUIRE_EQUAL(view.size(), 1234567u);
+    BOOST_REQUIRE_EQUAL(view.content_type(), "text/html");
+
+    // Truncated entries are rejected.
+    for (size_t n = 0; n < data.size(); ++n) {
+        BOOST_REQUIRE(!view.parse(boost::string_view(data.data(), n)));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_optional_fields)
+{
+    IndexEntry e;
+    e.ts  = pt::from_iso_extended_string("2018-03-01T12:34:56");
+    // Not a version 0 CID, kept as text.
+    e.cid = "bafybeigdyrzt5sfp7udm7hu76uh7y26nf3efuylqabf3oclgtqy55fbzdi";
+
+    auto p = IndexEntry::parse(e.encode());
+    BOOST_REQUIRE(p);
+    BOOST_REQUIRE(p->ts == e.ts);
+    BOOST_REQUIRE_EQUAL(p->cid, e.cid);
+    BOOST_REQUIRE(!p->size);
+    BOOST_REQUIRE(p->content_type.empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_legacy_json)
+{
+    auto p = IndexEntry::parse( "{\"ts\":\"2018-03-01T12:34:56.000001Z\","
+                                "\"value\":\"" + CID + "\"}");
+    BOOST_REQUIRE(p);
+    BOOST_REQUIRE(p->ts == pt::from_iso_extended_string("2018-03-01T12:34:56.000001"));
+    BOOST_REQUIRE_EQUAL(p->cid, CID);
+    BOOST_REQUIRE(!p->size);
+
+    BOOST_REQUIRE(!IndexEntry::parse("{\"value\": 1}"));
+    BOOST_REQUIRE(!IndexEntry::parse("garbage"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,63 @@
+#define BOOST_TEST_MODULE metrics
+#include <boost/test/included/unit_test.hpp>
+
+#include <metrics.h>
+
+BOOST_AUTO_TEST_SUITE(metrics)
+
+using namespace std;
+using namespace ipfs_cache;
+
+BOOST_AUTO_TEST_CASE(test_buckets)
+{
+    // Every value falls into a bucket whose bounds contain it and whose
+    // width is at most 1/SUB_BUCKETS of the value.
+    for (uint64_t v = 0; v < (uint64_t(1) << 20); v = v * 5 / 4 + 1) {
+        auto b = OpMetrics::bucket(v);
+
+        BOOST_REQUIRE(b < OpMetrics::BUCKET_COUNT);
+        BOOST_REQUIRE(v <= OpMetrics::bucket_max(b));
+
+        if (b > 0) {
+            BOOST_REQUIRE(v > OpMetrics::bucket_max(b - 1));
+            auto width = OpMetrics::bucket_max(b) - OpMetrics::bucket_max(b - 1);
+            BOOST_REQUIRE(width <= max<uint64_t>(1, v / OpMetrics::SUB_BUCKETS));
+        }
+    }
+
+    BOOST_REQUIRE_EQUAL( OpMetrics::bucket(uint64_t(-1))
+                       , OpMetrics::BUCKET_COUNT - 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_snapshot)
+{
+    OpMetrics m;
+
+    for (int i = 1; i <= 100; ++i) m.start(10);
+
+    for (int i = 1; i <= 90; ++i) {
+        m.finish(chrono::milliseconds(i), i % 10 == 0 ? 4 : 0, 100);
+    }
+
+    auto s = m.snapshot();
+
+    BOOST_REQUIRE_EQUAL(s.started,   100u);
+    BOOST_REQUIRE_EQUAL(s.completed,  90u);
+    BOOST_REQUIRE_EQUAL(s.in_flight,  10u);
+    BOOST_REQUIRE_EQUAL(s.bytes_in,  1000u);
+    BOOST_REQUIRE_EQUAL(s.bytes_out, 9000u);
+    BOOST_REQUIRE_EQUAL(s.errors.size(), 1u);
+    BOOST_REQUIRE_EQUAL(s.errors[4], 9u);
+
+    BOOST_REQUIRE_EQUAL(s.latency.count, 90u);
+    BOOST_REQUIRE_EQUAL(s.latency.sum_us, 45u * 91 * 1000);
+
+    // Within the precision of the buckets.
+    auto p50 = s.latency.percentile(0.5);
+    BOOST_REQUIRE(p50 >= 45000 && p50 <= 45000 * 9 / 8);
+
+    auto p100 = s.latency.percentile(1);
+    BOOST_REQUIRE(p100 >= 90000 && p100 <= 90000 * 9 / 8);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,70 @@
+#define BOOST_TEST_MODULE resolve_cache
+#include <boost/test/included/unit_test.hpp>
+
+#include <resolve_cache.h>
+
+BOOST_AUTO_TEST_SUITE(resolve_cache)
+
+using namespace std;
+using namespace ipfs_cache;
+
+using Clock = ResolveCache::Clock;
+using State = ResolveCache::State;
+
+BOOST_AUTO_TEST_CASE(test_freshness)
+{
+    ResolveCache cache(chrono::seconds(60), chrono::seconds(600));
+
+    auto t0 = Clock::now();
+
+    BOOST_REQUIRE(cache.find("ipns", t0).state == State::missing);
+
+    cache.insert("ipns", "cid", t0);
+
+    auto e = cache.find("ipns", t0 + chrono::seconds(30));
+    BOOST_REQUIRE(e.state == State::fresh);
+    BOOST_REQUIRE_EQUAL(e.cid, "cid");
+
+    e = cache.find("ipns", t0 + chrono::seconds(120));
+    BOOST_REQUIRE(e.state == State::stale);
+    BOOST_REQUIRE_EQUAL(e.cid, "cid");
+
+    e = cache.find("ipns", t0 + chrono::seconds(601));
+    BOOST_REQUIRE(e.state == State::missing);
+}
+
+BOOST_AUTO_TEST_CASE(test_max_age)
+{
+    ResolveCache cache(chrono::seconds(60), chrono::seconds(600));
+
+    auto t0 = Clock::now();
+
+    cache.insert("ipns", "cid", t0);
+
+    auto e = cache.find("ipns", chrono::seconds(5), t0 + chrono::seconds(4));
+    BOOST_REQUIRE(e.state == State::fresh);
+    BOOST_REQUIRE_EQUAL(e.cid, "cid");
+
+    // Still fresh for those who don't ask for recent resolutions.
+    e = cache.find("ipns", chrono::seconds(5), t0 + chrono::seconds(6));
+    BOOST_REQUIRE(e.state == State::missing);
+    BOOST_REQUIRE(cache.find("ipns", t0 + chrono::seconds(6)).state == State::fresh);
+}
+
+BOOST_AUTO_TEST_CASE(test_older_resolution_ignored)
+{
+    ResolveCache cache(chrono::seconds(60), chrono::seconds(600));
+
+    auto t0 = Clock::now();
+
+    cache.insert("ipns", "new", t0 + chrono::seconds(10));
+    // A resolution started before the one above finished after it.
+    cache.insert("ipns", "old", t0);
+
+    BOOST_REQUIRE_EQUAL(cache.find("ipns", t0 + chrono::seconds(20)).cid, "new");
+
+    cache.erase("ipns");
+    BOOST_REQUIRE(cache.find("ipns", t0).state == State::missing);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,124 @@
+#define BOOST_TEST_MODULE single_flight
+#include <boost/test/included/unit_test.hpp>
+
+#include <boost/asio/steady_timer.hpp>
+#include <memory>
+#include <string>
+
+#include <single_flight.h>
+
+BOOST_AUTO_TEST_SUITE(single_flight)
+
+using namespace std;
+using namespace ipfs_cache;
+
+using Value   = shared_ptr<const string>;
+using Flights = SingleFlight<string, Value>;
+
+// Waits a bit so that the other callers come while the fetch is running.
+static Value slow_fetch( asio::io_service& ios
+                       , int& fetches
+                       , sys::error_code ec
+                       , asio::yield_context yield)
+{
+    ++fetches;
+
+    asio::steady_timer timer(ios, chrono::milliseconds(10));
+    timer.async_wait(yield);
+
+    return or_throw(yield, ec, make_shared<const string>("data"));
+}
+
+BOOST_AUTO_TEST_CASE(test_coalescing)
+{
+    asio::io_service ios;
+    Flights flights(ios);
+
+    int fetches = 0;
+    vector<Value> results;
+
+    for (int i = 0; i < 10; ++i) {
+        asio::spawn(ios, [&] (asio::yield_context yield) {
+                auto v = flights.run("key", [&] (asio::yield_context yield) {
+                        return slow_fetch(ios, fetches, {}, yield);
+                    }
+                    , yield);
+                results.push_back(v);
+            });
+    }
+
+    ios.run();
+
+    BOOST_REQUIRE_EQUAL(fetches, 1);
+    BOOST_REQUIRE_EQUAL(results.size(), 10u);
+    BOOST_REQUIRE_EQUAL(flights.size(), 0u);
+
+    for (auto& v : results) {
+        BOOST_REQUIRE(v == results.front());
+        BOOST_REQUIRE_EQUAL(*v, "data");
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_distinct_keys)
+{
+    asio::io_service ios;
+    Flights flights(ios);
+
+    int fetches = 0;
+
+    for (int i = 0; i < 4; ++i) {
+        asio::spawn(ios, [&, i] (asio::yield_context yield) {
+                flights.run(to_string(i % 2), [&] (asio::yield_context yield) {
+                        return slow_fetch(ios, fetches, {}, yield);
+                    }
+                    , yield);
+            });
+    }
+
+    ios.run();
+
+    BOOST_REQUIRE_EQUAL(fetches, 2);
+
+    // Finished fetches aren't remembered.
+    asio::spawn(ios, [&] (asio::yield_context yield) {
+            flights.run("0", [&] (asio::yield_context yield) {
+                    return slow_fetch(ios, fetches, {}, yield);
+                }
+                , yield);
+        });
+
+    ios.reset();
+    ios.run();
+
+    BOOST_REQUIRE_EQUAL(fetches, 3);
+}
+
+BOOST_AUTO_TEST_CASE(test_errors)
+{
+    asio::io_service ios;
+    Flights flights(ios);
+
+    int fetches = 0;
+    int failed  = 0;
+
+    for (int i = 0; i < 5; ++i) {
+        asio::spawn(ios, [&] (asio::yield_context yield) {
+                sys::error_code ec;
+
+                flights.run("key", [&] (asio::yield_context yield) {
+                        return slow_fetch( ios, fetches
+                                         , asio::error::not_found, yield);
+                    }
+                    , yield[ec]);
+
+                if (ec == asio::error::not_found) ++failed;
+            });
+    }
+
+    ios.run();
+
+    BOOST_REQUIRE_EQUAL(fetches, 1);
+    BOOST_REQUIRE_EQUAL(failed, 5);
+}
+
+BOOST_AUTO_TEST_SUITE_END()